@@ -0,0 +1,190 @@
+/**
+ * @file
+ * @brief Benchmark for passing commands to the controller thread
+ * @details
+ *  Usage: command_queue_bench [COMMANDS]
+ *  Passes COMMANDS (default 1000000) commands from one thread to another, through the CommandQueue and through a
+ *  gz::Queue of commands with a std::set of device types, like before the SPSC ring.
+ *  The gz::Queue consumer polls with hasElement(), the CommandQueue consumer takes all commands with popAll() and
+ *  sleeps on the eventfd when the ring is empty, like the controller thread.
+ *  Stream: the producer pushes as fast as it can, the CommandQueue producer blocks in waitPush() when the ring is full
+ *  (a lost wakeup shows up as a dropped command), the gz::Queue grows.
+ *  Bursts: the producer pushes BURST_SIZE commands, then waits until they arrived. The time until the last one arrived is measured.
+ *  Counts the heap allocations per command on both sides.
+ *  Exits with 1 if a command is lost or arrives out of order.
+ */
+#include "../command_queue.hpp"
+
+#include <gz-util/container/queue.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace rgb;
+
+constexpr size_t BURST_SIZE = 8;
+constexpr size_t BURST_COUNT = 2000;
+
+std::atomic<uint64_t> allocations = 0;
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size)) { return p; }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+
+/// RGBSetting before the device types became a DeviceTypeMask
+struct SetSetting {
+    std::set<orgb::DeviceType> targetDevices;
+    RGBTransition transition;
+    RGBMode mode;
+    orgb::Color color;
+};
+struct SetCommand {
+    RGBCommandType type;
+    SetSetting setting;
+};
+
+
+/// The command number is stored in the color, to check the order
+RGBCommand makeCommand(uint32_t i) {
+    return RGBCommand{ CHANGE_SETTING, RGBSetting{ DeviceTypeMask{ orgb::DeviceType::Motherboard, orgb::DeviceType::DRAM, orgb::DeviceType::Mouse },
+                       FADE, STATIC, orgb::Color(i & 0xff, (i >> 8) & 0xff, (i >> 16) & 0xff) } };
+}
+SetCommand makeSetCommand(uint32_t i) {
+    return SetCommand{ CHANGE_SETTING, SetSetting{ { orgb::DeviceType::Motherboard, orgb::DeviceType::DRAM, orgb::DeviceType::Mouse },
+                       FADE, STATIC, orgb::Color(i & 0xff, (i >> 8) & 0xff, (i >> 16) & 0xff) } };
+}
+uint32_t getNumber(const orgb::Color& color) {
+    return color.r | (color.g << 8) | (color.b << 16);
+}
+
+
+struct Result {
+    double seconds;
+    uint64_t allocations;
+    bool ok;
+};
+
+
+/**
+ * @param burstSize 0 to push without waiting
+ * @param burstLatency set to the average time until the last command of a burst arrived
+ */
+Result runCommandQueue(size_t count, size_t burstSize, double& burstLatency) {
+    CommandQueue q;
+    std::atomic<size_t> received = 0;
+    bool ok = true;
+    const uint64_t allocationsBefore = allocations;
+    std::thread consumer([&]() {
+        std::vector<RGBCommand> commands;
+        commands.reserve(COMMAND_QUEUE_CAPACITY);
+        RGBCommand command;
+        size_t next = 0;
+        while (next < count) {
+            if (q.waitPop(command)) {
+                commands.push_back(command);
+                q.popAll(commands);
+            }
+            for (const RGBCommand& c : commands) {
+                if (getNumber(c.setting.color) != (next & 0xffffff)) { ok = false; }
+                next++;
+            }
+            commands.clear();
+            received.store(next, std::memory_order_release);
+        }
+    });
+    std::chrono::steady_clock::duration latency{};
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count;) {
+        const auto burstStart = std::chrono::steady_clock::now();
+        const size_t end = burstSize == 0 ? count : std::min(count, i + burstSize);
+        for (; i < end; i++) {
+            if (!q.waitPush(makeCommand(static_cast<uint32_t>(i)), std::chrono::seconds(1))) { ok = false; }
+        }
+        if (burstSize > 0) {
+            while (received.load(std::memory_order_acquire) < i) { std::this_thread::yield(); }
+            latency += std::chrono::steady_clock::now() - burstStart;
+        }
+    }
+    consumer.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (burstSize > 0) { burstLatency = std::chrono::duration<double, std::micro>(latency).count() / (count / burstSize); }
+    return { seconds, allocations - allocationsBefore, ok };
+}
+
+
+Result runGzQueue(size_t count, size_t burstSize, double& burstLatency) {
+    gz::Queue<SetCommand> q(4, 10);
+    std::atomic<size_t> received = 0;
+    bool ok = true;
+    const uint64_t allocationsBefore = allocations;
+    std::thread consumer([&]() {
+        for (size_t next = 0; next < count; next++) {
+            while (!q.hasElement()) { std::this_thread::yield(); }
+            SetCommand command = q.getCopy();
+            if (getNumber(command.setting.color) != (next & 0xffffff)) { ok = false; }
+            received.store(next + 1, std::memory_order_release);
+        }
+    });
+    std::chrono::steady_clock::duration latency{};
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count;) {
+        const auto burstStart = std::chrono::steady_clock::now();
+        const size_t end = burstSize == 0 ? count : std::min(count, i + burstSize);
+        for (; i < end; i++) {
+            q.push_back(makeSetCommand(static_cast<uint32_t>(i)));
+        }
+        if (burstSize > 0) {
+            while (received.load(std::memory_order_acquire) < i) { std::this_thread::yield(); }
+            latency += std::chrono::steady_clock::now() - burstStart;
+        }
+    }
+    consumer.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (burstSize > 0) { burstLatency = std::chrono::duration<double, std::micro>(latency).count() / (count / burstSize); }
+    return { seconds, allocations - allocationsBefore, ok };
+}
+
+
+void print(const std::string& name, const Result& result, size_t count) {
+    std::cout << "  " << name << (count / result.seconds / 1e6) << " M commands/s, "
+              << static_cast<double>(result.allocations) / count << " allocations/command\n";
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t count = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    const size_t burstCommands = BURST_SIZE * BURST_COUNT;
+    double unused, ringLatency, gzLatency;
+
+    const Result ringStream = runCommandQueue(count, 0, unused);
+    const Result gzStream = runGzQueue(count, 0, unused);
+    const Result ringBursts = runCommandQueue(burstCommands, BURST_SIZE, ringLatency);
+    const Result gzBursts = runGzQueue(burstCommands, BURST_SIZE, gzLatency);
+
+    std::cout << "stream of " << count << " commands, " << std::thread::hardware_concurrency() << " cpus\n";
+    print("CommandQueue: ", ringStream, count);
+    print("gz::Queue:    ", gzStream, count);
+    std::cout << BURST_COUNT << " bursts of " << BURST_SIZE << " commands\n";
+    print("CommandQueue: ", ringBursts, burstCommands);
+    std::cout << "                " << ringLatency << " us until the burst arrived\n";
+    print("gz::Queue:    ", gzBursts, burstCommands);
+    std::cout << "                " << gzLatency << " us until the burst arrived\n";
+
+    if (!ringStream.ok or !gzStream.ok or !ringBursts.ok or !gzBursts.ok) {
+        std::cerr << "Commands were lost or reordered\n";
+        return 1;
+    }
+    return 0;
+}
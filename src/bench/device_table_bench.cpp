@@ -0,0 +1,267 @@
+/**
+ * @file
+ * @brief Benchmark for the per-frame work of the rgb controller on a synthetic 1000 led rig
+ * @details
+ *  Usage: device_table_bench [FRAMES]
+ *  Runs FRAMES (default 2000) frames of rainbow and of fades that restart every FADE_RESTART_FRAMES frames, on
+ *  3 devices with 499, 499 and 2 leds and on 100 devices with 10 leds.
+ *  DeviceTable: animateDevice() and FrameDiff of RGBController::update(), the frame goes into a FrameBatch.
+ *  std::map: the containers keyed by device pointer from before the DeviceTable, with the same animateFade(), animateRainbow()
+ *  and FrameDiff, so that only the cost of the storage differs. Both rigs send the same bytes.
+ *  The batch is cleared instead of sent, so only the work of the controller thread is measured. The frame time is simulated,
+ *  33ms per frame. Also counts the heap allocations per frame.
+ *  Exits with 1 if the rigs do not send the same number of bytes.
+ */
+#include "../rgb_controller.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+gz::Log rgblog(gz::LogCreateInfo{
+        .logfile = "/tmp/device_table_bench.log",
+        .showLog = false,
+        .storeLog = false,
+        .prefix = "device_table_bench",
+        .prefixColor = gz::Color::CYAN,
+        .showTime = false,
+        .clearLogfileOnRestart = true,
+        });
+
+using namespace rgb;
+
+constexpr auto FRAME_DURATION = std::chrono::milliseconds(33);
+constexpr int FADE_RESTART_FRAMES = 20;
+
+std::atomic<uint64_t> allocations = 0;
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size)) { return p; }
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+
+std::vector<DeviceInfo> makeRig(const std::vector<uint32_t>& ledCounts) {
+    std::vector<DeviceInfo> devices;
+    for (size_t i = 0; i < ledCounts.size(); i++) {
+        DeviceInfo device;
+        device.idx = static_cast<uint32_t>(i);
+        device.type = i % 2 == 0 ? orgb::DeviceType::DRAM : orgb::DeviceType::Motherboard;
+        device.name = "device" + std::to_string(i);
+        device.ledCount = ledCounts[i];
+        device.zones = { ZoneInfo{ 0, ledCounts[i] } };
+        devices.push_back(device);
+    }
+    return devices;
+}
+
+
+orgb::Color getFadeColor(int frame) {
+    return (frame / FADE_RESTART_FRAMES) % 2 == 0 ? orgb::Color(255, 0, 0) : orgb::Color(0, 0, 255);
+}
+
+
+/// The per-frame part of RGBController with the DeviceTable
+class TableRig {
+    public:
+        TableRig(const std::vector<DeviceInfo>& devices, UpdateStats& stats) : frameDiff(stats), batch(stats), palette(makeRainbowPalette()) {
+            for (const DeviceInfo& device : devices) {
+                table.add(device, 0);
+            }
+        }
+        void startRainbow(std::chrono::steady_clock::time_point now) {
+            for (size_t i = 0; i < table.size(); i++) {
+                table.setMode(i, AnimationMode::RAINBOW);
+                table.getRainbowTiming(i) = { now, std::chrono::milliseconds(DEFAULT_RAINBOW_CYCLE_MS), DEFAULT_RAINBOW_SPREAD, FORWARD };
+            }
+        }
+        void startFade(orgb::Color color, std::chrono::steady_clock::time_point now) {
+            for (size_t i = 0; i < table.size(); i++) {
+                table.setMode(i, AnimationMode::FADE);
+                std::span<const orgb::Color> colors = table.getColors(i);
+                std::copy(colors.begin(), colors.end(), table.getFadeStarts(i).begin());
+                std::span<orgb::Color> targets = table.getFadeTargets(i);
+                std::fill(targets.begin(), targets.end(), color);
+                table.getFadeTiming(i) = { now, std::chrono::milliseconds(DEFAULT_FADE_DURATION_MS), LINEAR };
+            }
+        }
+        /// @returns the size of the frame
+        size_t update(std::chrono::steady_clock::time_point now) {
+            for (size_t i = 0; i < table.size(); i++) {
+                switch (animateDevice(table, i, palette, now)) {
+                    case AnimationMode::NONE: break;
+                    case AnimationMode::FADE: frameDiff.send(batch, table, i); break;
+                    case AnimationMode::RAINBOW: frameDiff.sendFull(batch, table, i); break;
+                }
+            }
+            const size_t size = batch.size();
+            batch.clear();
+            return size;
+        }
+
+    private:
+        DeviceTable table;
+        FrameDiff frameDiff;
+        FrameBatch batch;
+        const HuePalette palette;
+};
+
+
+/**
+ * @brief The per-frame part of RGBController with the containers from before the DeviceTable
+ * @details Animates and diffs with the same functions as TableRig, only the state is kept in containers keyed by device pointer
+ */
+class MapRig {
+    public:
+        MapRig(const std::vector<DeviceInfo>& devices, UpdateStats& stats) : deviceList(devices), frameDiff(stats), batch(stats), palette(makeRainbowPalette()) {
+            for (DeviceInfo& device : deviceList) {
+                this->devices.push_back(&device);
+                deviceColors[&device] = std::vector<orgb::Color>(device.ledCount, orgb::Color::Black);
+            }
+        }
+        void startRainbow(std::chrono::steady_clock::time_point now) {
+            for (DeviceInfo* device : devices) {
+                fadeMode.erase(device);
+                rainbowMode[device] = { now, std::chrono::milliseconds(DEFAULT_RAINBOW_CYCLE_MS), DEFAULT_RAINBOW_SPREAD, FORWARD };
+            }
+        }
+        void startFade(orgb::Color color, std::chrono::steady_clock::time_point now) {
+            for (DeviceInfo* device : devices) {
+                rainbowMode.erase(device);
+                Fade& fade = fadeMode[device];
+                fade.starts = deviceColors[device];
+                fade.targets.assign(device->ledCount, color);
+                fade.timing = { now, std::chrono::milliseconds(DEFAULT_FADE_DURATION_MS), LINEAR };
+            }
+        }
+        /// @returns the size of the frame
+        size_t update(std::chrono::steady_clock::time_point now) {
+            for (auto& [device, fade] : fadeMode) {
+                std::vector<orgb::Color>& colors = deviceColors[device];
+                if (!animateFade(fade.timing, fade.starts, fade.targets, colors, now)) {
+                    fadeFinished.push_back(device);
+                }
+                auto sent = sentColors.find(device);
+                const bool sentValid = sent != sentColors.end();
+                if (!sentValid) { sent = sentColors.emplace(device, std::vector<orgb::Color>(colors.size())).first; }
+                frameDiff.send(batch, *device, colors, sent->second, sentValid);
+            }
+            for (DeviceInfo* device : fadeFinished) {
+                fadeMode.erase(device);
+            }
+            fadeFinished.clear();
+            for (const auto& [device, rainbow] : rainbowMode) {
+                animateRainbow(rainbow, palette, deviceColors[device], now);
+                frameDiff.sendFull(batch, *device, deviceColors[device]);
+                sentColors.erase(device);
+            }
+            const size_t size = batch.size();
+            batch.clear();
+            return size;
+        }
+
+    private:
+        struct Fade {
+            std::vector<orgb::Color> starts;
+            std::vector<orgb::Color> targets;
+            FadeTiming timing;
+        };
+        std::vector<DeviceInfo> deviceList;
+        std::vector<DeviceInfo*> devices;
+        std::map<DeviceInfo*, std::vector<orgb::Color>> deviceColors;
+        std::map<DeviceInfo*, RainbowTiming> rainbowMode;
+        std::map<DeviceInfo*, Fade> fadeMode;
+        std::vector<DeviceInfo*> fadeFinished;
+        std::unordered_map<const DeviceInfo*, std::vector<orgb::Color>> sentColors;
+        FrameDiff frameDiff;
+        FrameBatch batch;
+        const HuePalette palette;
+};
+
+
+struct Result {
+    double usPerFrame;
+    double bytesPerFrame;
+    double allocationsPerFrame;
+};
+
+
+/// Time frames of rig, start(frame, now) is called before every frame
+template<typename Rig, typename Start>
+Result run(Rig& rig, int frames, Start start) {
+    const auto t0 = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    std::chrono::steady_clock::duration time{};
+    const uint64_t allocationsBefore = allocations;
+    for (int frame = 0; frame < frames; frame++) {
+        const auto now = t0 + frame * FRAME_DURATION;
+        start(frame, now);
+        const auto frameStart = std::chrono::steady_clock::now();
+        bytes += rig.update(now);
+        time += std::chrono::steady_clock::now() - frameStart;
+    }
+    return { std::chrono::duration<double, std::micro>(time).count() / frames, static_cast<double>(bytes) / frames,
+             static_cast<double>(allocations - allocationsBefore) / frames };
+}
+
+
+void print(const std::string& name, const Result& result) {
+    std::cout << "    " << name << result.usPerFrame << " us/frame, " << result.bytesPerFrame << " bytes/frame, "
+              << result.allocationsPerFrame << " allocations/frame\n";
+}
+
+
+int main(int argc, char* argv[]) {
+    const int frames = argc > 1 ? std::stoi(argv[1]) : 2000;
+    const std::vector<std::pair<std::string, std::vector<uint32_t>>> rigs = {
+        { "3 devices, 1000 leds", { 499, 499, 2 } },
+        { "100 devices, 1000 leds", std::vector<uint32_t>(100, 10) },
+    };
+    UpdateStats stats;
+    bool sameBytes = true;
+    auto compare = [&sameBytes](const Result& table, const Result& map) {
+        print("DeviceTable: ", table);
+        print("std::map:    ", map);
+        if (table.bytesPerFrame != map.bytesPerFrame) { sameBytes = false; }
+    };
+    std::cout << "color kernels: " << getColorKernelsName() << '\n';
+    for (const auto& [name, ledCounts] : rigs) {
+        const std::vector<DeviceInfo> devices = makeRig(ledCounts);
+        std::cout << name << '\n';
+        {
+            TableRig tableRig(devices, stats);
+            MapRig mapRig(devices, stats);
+            std::cout << "  rainbow\n";
+            compare(run(tableRig, frames, [&](int frame, auto now) { if (frame == 0) { tableRig.startRainbow(now); } }),
+                    run(mapRig, frames, [&](int frame, auto now) { if (frame == 0) { mapRig.startRainbow(now); } }));
+        }
+        {
+            TableRig tableRig(devices, stats);
+            MapRig mapRig(devices, stats);
+            std::cout << "  fade\n";
+            compare(run(tableRig, frames, [&](int frame, auto now) {
+                        if (frame % FADE_RESTART_FRAMES == 0) { tableRig.startFade(getFadeColor(frame), now); }
+                    }),
+                    run(mapRig, frames, [&](int frame, auto now) {
+                        if (frame % FADE_RESTART_FRAMES == 0) { mapRig.startFade(getFadeColor(frame), now); }
+                    }));
+        }
+    }
+    if (!sameBytes) {
+        std::cerr << "The rigs sent different frames\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file
+ * @brief Test for X11FocusWatcher
+ * @details
+ *  Usage: focus_watcher_test, with $DISPLAY set. focus_watcher_test.sh starts an X server for it.
+ *  The test is the window manager: it creates windows with _NET_WM_PID and sets _NET_ACTIVE_WINDOW on the root window.
+ *  Like the daemon, it only calls readFocus() when the fd of the watcher is readable, and checks that the pid of the
+ *  last active window is reported within FOCUS_TIMEOUT.
+ *  The focus is also changed while readFocus() waits for the replies of the X server. With x11_stub.py --get-property-delay,
+ *  that change arrives before the replies, so it is only seen if the watcher handles the events that xcb queued.
+ *  Exits with 1 if a check fails.
+ */
+#include "../focus_watcher.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <xcb/xcb.h>
+
+gz::Log rgblog(gz::LogCreateInfo{
+        .logfile = "/tmp/focus_watcher_test.log",
+        .showLog = true,
+        .storeLog = false,
+        .prefix = "focus_watcher_test",
+        .prefixColor = gz::Color::CYAN,
+        .showTime = false,
+        .clearLogfileOnRestart = true,
+        });
+
+using namespace rgb;
+
+constexpr auto FOCUS_TIMEOUT = std::chrono::seconds(2);
+constexpr size_t WINDOW_COUNT = 3;
+
+
+/// Fake window manager
+class WindowManager {
+    public:
+        WindowManager() {
+            connection = xcb_connect(nullptr, nullptr);
+            if (xcb_connection_has_error(connection)) {
+                std::cerr << "Can not connect to the X server, is $DISPLAY set?\n";
+                std::exit(1);
+            }
+            const xcb_screen_t* screen = xcb_setup_roots_iterator(xcb_get_setup(connection)).data;
+            root = screen->root;
+            activeWindowAtom = getAtom("_NET_ACTIVE_WINDOW");
+            wmPidAtom = getAtom("_NET_WM_PID");
+            for (size_t i = 0; i < WINDOW_COUNT; i++) {
+                uint32_t window = xcb_generate_id(connection);
+                xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, root, 0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, nullptr);
+                setProperty(window, wmPidAtom, XCB_ATOM_CARDINAL, getPID(i));
+                windows.push_back(window);
+            }
+            sync();
+        }
+        ~WindowManager() { xcb_disconnect(connection); }
+
+        /// pid of window i
+        static int getPID(size_t i) { return 1000 + static_cast<int>(i); }
+        /// @param i window index, or -1 for no active window
+        void activate(int i, bool waitForServer=true) {
+            setProperty(root, activeWindowAtom, XCB_ATOM_WINDOW, i < 0 ? 0 : windows[i]);
+            if (waitForServer) { sync(); }
+            else { xcb_flush(connection); }
+        }
+        /// Wait until the server handled all requests
+        void sync() { std::free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), nullptr)); }
+
+    private:
+        xcb_connection_t* connection;
+        uint32_t root;
+        uint32_t activeWindowAtom;
+        uint32_t wmPidAtom;
+        std::vector<uint32_t> windows;
+        uint32_t getAtom(const char* name) {
+            xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(connection, xcb_intern_atom(connection, 0, std::strlen(name), name), nullptr);
+            uint32_t atom = reply == nullptr ? 0 : reply->atom;
+            std::free(reply);
+            return atom;
+        }
+        void setProperty(uint32_t window, uint32_t property, uint32_t type, uint32_t value) {
+            xcb_change_property(connection, XCB_PROP_MODE_REPLACE, window, property, type, 32, 1, &value);
+        }
+};
+
+
+/**
+ * @brief Read the focus whenever the fd of watcher is readable, until it is expected
+ * @param focus last reported focus, updated
+ * @returns false after FOCUS_TIMEOUT
+ */
+bool waitForFocus(FocusWatcher& watcher, int& focus, int expected) {
+    const auto deadline = std::chrono::steady_clock::now() + FOCUS_TIMEOUT;
+    while (focus != expected) {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd pfd{ watcher.getFd(), POLLIN, 0 };
+        if (remaining.count() <= 0 or poll(&pfd, 1, static_cast<int>(remaining.count())) <= 0) { return false; }
+        if (std::optional<int> newFocus = watcher.readFocus()) { focus = *newFocus; }
+    }
+    return true;
+}
+
+
+int main() {
+    int failures = 0;
+    auto check = [&failures](bool ok, const std::string& name) {
+        std::cout << (ok ? "ok:     " : "FAILED: ") << name << '\n';
+        if (!ok) { failures++; }
+    };
+
+    WindowManager wm;
+    wm.activate(0);
+    X11FocusWatcher watcher("");
+    int focus = watcher.readFocus().value_or(-1);
+    check(focus == WindowManager::getPID(0), "initial focus");
+
+    wm.activate(1);
+    check(waitForFocus(watcher, focus, WindowManager::getPID(1)), "focus change");
+
+    wm.activate(-1);
+    check(waitForFocus(watcher, focus, 0), "no active window");
+
+    for (int i = 0; i < 20; i++) {
+        wm.activate(i % 2, false);
+    }
+    wm.activate(2);
+    check(waitForFocus(watcher, focus, WindowManager::getPID(2)), "20 changes without waiting");
+
+    // change the focus again while the watcher reads the properties
+    wm.activate(0);
+    pollfd pfd{ watcher.getFd(), POLLIN, 0 };
+    poll(&pfd, 1, static_cast<int>(std::chrono::milliseconds(FOCUS_TIMEOUT).count()));
+    std::thread changeFocus([&wm]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        wm.activate(1);
+    });
+    if (std::optional<int> newFocus = watcher.readFocus()) { focus = *newFocus; }
+    changeFocus.join();
+    check(waitForFocus(watcher, focus, WindowManager::getPID(1)), "focus change during readFocus()");
+
+    return failures == 0 ? 0 : 1;
+}
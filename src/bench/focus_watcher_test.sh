@@ -0,0 +1,24 @@
+#!/bin/sh
+# Run focus_watcher_test against Xvfb, or against x11_stub.py if Xvfb is not installed
+# Usage: focus_watcher_test.sh [TEST_EXECUTABLE]
+set -e
+cd "$(dirname "$0")"
+TEST=$(realpath "${1:-../../focus_watcher_test}")
+DISPLAY_NUMBER=${DISPLAY_NUMBER:-97}
+SOCKET="/tmp/.X11-unix/X$DISPLAY_NUMBER"
+rm -f "$SOCKET"
+
+if command -v Xvfb > /dev/null; then
+    Xvfb ":$DISPLAY_NUMBER" -nolisten tcp 2> /dev/null &
+else
+    echo "Xvfb not found, using x11_stub.py"
+    python3 x11_stub.py "$DISPLAY_NUMBER" --get-property-delay=100 &
+fi
+SERVER=$!
+trap 'kill $SERVER' EXIT
+
+for i in $(seq 50); do
+    [ -S "$SOCKET" ] && break
+    sleep 0.1
+done
+DISPLAY=":$DISPLAY_NUMBER" "$TEST"
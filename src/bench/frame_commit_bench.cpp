@@ -0,0 +1,184 @@
+/**
+ * @file
+ * @brief Benchmark for sending a frame to the OpenRGB server
+ * @details
+ *  Usage: frame_commit_bench [FRAMES]
+ *  Sends FRAMES (default 300) frames of UPDATELEDS packets with LED_COUNT leds to a local sink server,
+ *  for 3, 10 and 30 devices. Per-device sends: every packet is committed on its own, like the SDK client sent every update
+ *  with its own call. One commit: all packets of the frame are sent with a single FrameBatch::commit().
+ *  Commit is the time the controller spends sending the frame. Spread is the time between the arrival of the first and the
+ *  last device packet of a frame at the server, while it is not zero the devices show different frames.
+ *  Frames are FRAME_INTERVAL apart, so that the server is idle when a frame starts.
+ *  Exits with 1 if packets are lost.
+ */
+#include "../frame_batch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace rgb;
+
+constexpr size_t LED_COUNT = 30;
+constexpr auto FRAME_INTERVAL = std::chrono::milliseconds(2);
+
+using bench_clock = std::chrono::steady_clock;
+
+
+/// Local server that accepts one connection at a time, and records when the packets of every frame arrive
+class SinkServer {
+    public:
+        SinkServer() {
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if (listenFd < 0 or bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+                or listen(listenFd, 1) < 0 or getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) < 0) {
+                std::cerr << "Can not listen on a local port\n";
+                std::exit(1);
+            }
+            port = ntohs(address.sin_port);
+        }
+        ~SinkServer() { close(listenFd); }
+        uint16_t getPort() const { return port; }
+
+        /**
+         * @brief Answer the protocol version request, receive the client name and frames * devices update packets in a thread
+         * @details The arrival times are valid after join()
+         */
+        void start(size_t frames, size_t devices) {
+            firstArrival.assign(frames, {});
+            lastArrival.assign(frames, {});
+            packets = 0;
+            thread = std::thread(&SinkServer::receive, this, frames, devices);
+        }
+        /// @returns the number of update packets received
+        size_t join() {
+            thread.join();
+            return packets;
+        }
+        std::vector<bench_clock::time_point> firstArrival;
+        std::vector<bench_clock::time_point> lastArrival;
+
+    private:
+        int listenFd;
+        uint16_t port;
+        std::thread thread;
+        size_t packets = 0;
+
+        void receive(size_t frames, size_t devices) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) { return; }
+            std::vector<uint8_t> buffer;
+            uint8_t chunk[1 << 16];
+            while (packets < frames * devices) {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0) { break; }
+                const auto now = bench_clock::now();
+                buffer.insert(buffer.end(), chunk, chunk + n);
+                size_t offset = 0;
+                while (buffer.size() - offset >= ORGB_HEADER_SIZE) {
+                    uint32_t packetId, dataSize;
+                    std::memcpy(&packetId, buffer.data() + offset + 8, sizeof(packetId));
+                    std::memcpy(&dataSize, buffer.data() + offset + 12, sizeof(dataSize));
+                    if (buffer.size() - offset < ORGB_HEADER_SIZE + dataSize) { break; }
+                    if (packetId == NET_PACKET_ID_REQUEST_PROTOCOL_VERSION) {
+                        // the request with the client version is the answer
+                        send(fd, buffer.data() + offset, ORGB_HEADER_SIZE + dataSize, MSG_NOSIGNAL);
+                    }
+                    offset += ORGB_HEADER_SIZE + dataSize;
+                    if (packetId != NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS) { continue; }
+                    const size_t frame = packets / devices;
+                    const size_t device = packets % devices;
+                    if (device == 0) { firstArrival[frame] = now; }
+                    if (device == devices - 1) { lastArrival[frame] = now; }
+                    packets++;
+                }
+                buffer.erase(buffer.begin(), buffer.begin() + offset);
+            }
+            close(fd);
+        }
+};
+
+
+double median(std::vector<double>& values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+double p99(std::vector<double>& values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() * 99 / 100];
+}
+
+
+/**
+ * @brief Send frames to the sink and print the commit times and the spread
+ * @param perDevice commit every packet on its own
+ * @returns false if packets were lost
+ */
+bool run(SinkServer& sink, size_t frames, size_t devices, bool perDevice) {
+    UpdateStats stats;
+    FrameBatch batch(stats);
+    sink.start(frames, devices);
+    batch.connect("127.0.0.1", sink.getPort(), "frame_commit_bench");
+
+    std::vector<orgb::Color> colors(LED_COUNT, orgb::Color(1, 2, 3));
+    std::vector<double> commitTimes;
+    for (size_t frame = 0; frame < frames; frame++) {
+        colors[0] = orgb::Color(frame & 0xff, 0, 0);
+        const auto start = bench_clock::now();
+        for (size_t device = 0; device < devices; device++) {
+            batch.updateLEDs(static_cast<uint32_t>(device), colors);
+            if (perDevice) { batch.commit(); }
+        }
+        batch.commit();
+        commitTimes.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - start).count());
+        std::this_thread::sleep_for(FRAME_INTERVAL);
+    }
+    batch.disconnect();
+    const size_t received = sink.join();
+
+    std::vector<double> spreads;
+    for (size_t frame = 0; frame < frames; frame++) {
+        spreads.push_back(std::chrono::duration<double, std::micro>(sink.lastArrival[frame] - sink.firstArrival[frame]).count());
+    }
+    std::cout << "  " << std::setw(2) << devices << " devices, " << (perDevice ? "per-device sends:" : "one commit:      ")
+              << std::fixed << std::setprecision(1)
+              << " commit median " << std::setw(6) << median(commitTimes) << " us, p99 " << std::setw(6) << p99(commitTimes) << " us"
+              << " | spread median " << std::setw(6) << median(spreads) << " us, p99 " << std::setw(6) << p99(spreads) << " us\n";
+    if (received != frames * devices) {
+        std::cerr << "Received " << received << " of " << frames * devices << " packets\n";
+        return false;
+    }
+    return true;
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t frames = argc > 1 ? std::stoul(argv[1]) : 300;
+    if (frames == 0) {
+        std::cerr << "FRAMES must be at least 1\n";
+        return 1;
+    }
+    SinkServer sink;
+    std::cout << frames << " frames of " << LED_COUNT << " leds per device\n";
+    bool ok = true;
+    for (size_t devices : { 3, 10, 30 }) {
+        ok = run(sink, frames, devices, true) and ok;
+        ok = run(sink, frames, devices, false) and ok;
+    }
+    return ok ? 0 : 1;
+}
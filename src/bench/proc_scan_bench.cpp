@@ -0,0 +1,195 @@
+/**
+ * @file
+ * @brief Benchmark for scanning /proc
+ * @details
+ *  Usage: proc_scan_bench [PROCESSES...]
+ *  For every count (default 1000 10000 50000), generates a directory like /proc with PROCESSES process directories
+ *  that contain a stat file, and scans it with ProcessWatcher (getdents64 and one pread per process) and the way it
+ *  was done before (std::filesystem::directory_iterator, std::stoi, std::ifstream and std::istringstream).
+ *  The first scan, done by the constructor of the ProcessWatcher, reads and matches every process,
+ *  the following scans skip the processes in the PID cache.
+ *  Generating the stat files is cheap for tmpfs, so mostly the userspace part is measured. Finally /proc itself is scanned.
+ *  Exits with 1 if the results differ.
+ */
+#include "../process_watcher.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+gz::Log rgblog(gz::LogCreateInfo{
+        .logfile = "/tmp/proc_scan_bench.log",
+        .showLog = false,
+        .storeLog = false,
+        .prefix = "proc_scan_bench",
+        .prefixColor = gz::Color::CYAN,
+        .showTime = false,
+        .clearLogfileOnRestart = true,
+        });
+
+namespace fs = std::filesystem;
+using namespace rgb;
+
+constexpr size_t RULE_COUNT = 50;
+constexpr int REPEATS = 10;
+
+
+std::vector<std::string> makeRules() {
+    std::vector<std::string> rules;
+    for (size_t i = 0; i < RULE_COUNT; i++) {
+        rules.push_back("game" + std::to_string(i));
+    }
+    return rules;
+}
+
+
+/// Create dir/<pid>/stat for count processes, 1 in 100 is named like a rule, and some entries that are no processes
+void makeProcDir(const fs::path& dir, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const int pid = static_cast<int>(i) * 3 + 1;
+        std::string comm = "worker" + std::to_string(i);
+        if (i % 100 == 50) { comm = "game" + std::to_string(i / 100 % RULE_COUNT); }
+        else if (i % 100 == 7) { comm = "Web Content (" + std::to_string(i) + ")"; }
+        fs::create_directory(dir / std::to_string(pid));
+        std::ofstream stat(dir / std::to_string(pid) / "stat");
+        // fields 3 to 21, starttime (22) and a few more
+        stat << pid << " (" << comm << ") S 1 " << pid << ' ' << pid << " 0 -1 4194560 1532 0 3 0 12 7 0 0 20 0 1 0 "
+             << 1000 + i << " 23412736 1203 18446744073709551615 1 1 0 0 0 0 0 4096 0 0 0 0 17 3 0 0 0 0 0\n";
+    }
+    fs::create_directory(dir / "sys");
+    std::ofstream(dir / "meminfo") << "MemTotal: 1 kB\n";
+    fs::create_directory_symlink("1", dir / "self");
+}
+
+
+/// The scan before the getdents64 scanner
+class OldScanner {
+    public:
+        OldScanner(const fs::path& proc, const std::vector<std::string>& names) : proc(proc) {
+            for (size_t i = 0; i < names.size(); i++) {
+                process2index[names[i]] = static_cast<int>(i);
+            }
+        }
+        void clearCache() { checkedPIDs.clear(); }
+        /// @returns the highest running index or -1
+        int scan() {
+            std::string name;
+            name.reserve(16);
+            int pid;
+            uint64_t startTime;
+            int best = -1;
+            for (const auto& entry : fs::directory_iterator(proc)) {
+                if (!fs::is_directory(entry)) { continue; }
+                try {
+                    pid = std::stoi(entry.path().filename().c_str());
+                }
+                catch (std::invalid_argument& e) { continue; }
+                if (!readProcessStat(pid, name, startTime)) { continue; }
+                if (checkedPIDs.contains(pid, startTime)) { continue; }
+
+                auto it = process2index.find(name);
+                if (it != process2index.end()) {
+                    best = std::max(best, it->second);
+                }
+                else {
+                    checkedPIDs.insert(pid, startTime);
+                }
+            }
+            return best;
+        }
+
+    private:
+        fs::path proc;
+        std::unordered_map<std::string, int> process2index;
+        PIDCache checkedPIDs;
+        bool readProcessStat(int pid, std::string& name, uint64_t& startTime) {
+            std::ifstream statFile(proc / std::to_string(pid) / "stat");
+            std::string stat;
+            if (!getline(statFile, stat)) { return false; }
+            size_t nameBegin = stat.find('(');
+            size_t nameEnd = stat.rfind(')');
+            if (nameBegin == std::string::npos or nameEnd == std::string::npos or nameEnd < nameBegin) { return false; }
+            name.assign(stat, nameBegin + 1, nameEnd - nameBegin - 1);
+            std::istringstream fields(stat.substr(nameEnd + 1));
+            std::string field;
+            for (int i = 3; i < 22; i++) {
+                fields >> field;
+            }
+            return static_cast<bool>(fields >> startTime);
+        }
+};
+
+
+using bench_clock = std::chrono::steady_clock;
+
+double ms(bench_clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+
+/**
+ * @brief Scan proc with both scanners and print the times
+ * @returns false if the results differ
+ */
+bool compare(const fs::path& proc, const std::string& label) {
+    const auto rules = makeRules();
+    OldScanner old(proc, rules);
+
+    // first scan: every process is read and matched
+    auto start = bench_clock::now();
+    ProcessWatcher watcher(rules, proc);
+    const auto newFirst = bench_clock::now() - start;
+    start = bench_clock::now();
+    old.clearCache();
+    const int oldResult = old.scan();
+    const auto oldFirst = bench_clock::now() - start;
+
+    start = bench_clock::now();
+    for (int i = 0; i < REPEATS; i++) { watcher.resync(); }
+    const auto newCached = (bench_clock::now() - start) / REPEATS;
+    start = bench_clock::now();
+    for (int i = 0; i < REPEATS; i++) { old.scan(); }
+    const auto oldCached = (bench_clock::now() - start) / REPEATS;
+
+    const int newResult = watcher.processRunning() == watcher.end() ? -1 : watcher.processRunning()->second;
+    std::cout << label << ", highest running rule: " << newResult << '\n'
+              << "  first scan:  getdents64 " << ms(newFirst) << " ms, old " << ms(oldFirst) << " ms\n"
+              << "  cached scan: getdents64 " << ms(newCached) << " ms, old " << ms(oldCached) << " ms\n";
+    if (newResult != oldResult) {
+        std::cerr << "Mismatch for " << label << ": " << newResult << " != " << oldResult << '\n';
+        return false;
+    }
+    return true;
+}
+
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> counts;
+    for (int i = 1; i < argc; i++) {
+        counts.push_back(std::stoul(argv[i]));
+    }
+    if (counts.empty()) { counts = { 1000, 10000, 50000 }; }
+
+    bool ok = true;
+    for (size_t count : counts) {
+        char tmpl[] = "/tmp/proc_scan_bench.XXXXXX";
+        if (mkdtemp(tmpl) == nullptr) {
+            std::cerr << "Can not create a temporary directory\n";
+            return 1;
+        }
+        const fs::path dir(tmpl);
+        makeProcDir(dir, count);
+        ok = compare(dir, std::to_string(count) + " processes") and ok;
+        fs::remove_all(dir);
+    }
+    ok = compare("/proc", "/proc") and ok;
+    return ok ? 0 : 1;
+}
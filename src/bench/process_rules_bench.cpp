@@ -0,0 +1,170 @@
+/**
+ * @file
+ * @brief Benchmark for matching the process rules
+ * @details
+ *  Usage: process_rules_bench [RULES [PROCESSES]]
+ *  Generates RULES (default 500) rules for all fields and PROCESSES (default 20000) processes, of which about 1 in 10 match a rule,
+ *  and matches every process with the ProcessRuleSet and by testing the rules one by one, from the highest priority down.
+ *  The fields of the processes are kept in memory, so only the matching is measured.
+ *  The rules can be written in the config file, `=` is written as PROCESS_RULE_EQUALS_ESCAPE.
+ *  Exits with 1 if the results differ or a rule contains `=`, the regex rules contain escapes like \x2D, \u006C and backreferences.
+ */
+#include "../process_rules.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+using namespace rgb;
+
+struct Process {
+    std::string comm;
+    std::string cmdline;
+    std::string exe;
+    std::string cgroup;
+    const std::string& get(ProcessField field) const {
+        switch (field) {
+            case ProcessField::COMM: return comm;
+            case ProcessField::CMDLINE: return cmdline;
+            case ProcessField::EXE: return exe;
+            default: return cgroup;
+        }
+    }
+};
+
+
+std::vector<std::string> makeRules(size_t count) {
+    std::vector<std::string> rules;
+    for (size_t i = 0; i < count; i++) {
+        const std::string n = std::to_string(i);
+        switch (i % 10) {
+            case 0: case 1: case 2: case 3: case 4:
+                rules.push_back("game" + n);
+                break;
+            case 5:
+                rules.push_back("tool" + n + "-*");
+                break;
+            case 6:
+                rules.push_back("cmdline:*--profile" + std::string(PROCESS_RULE_EQUALS_ESCAPE) + "p" + n + " *");
+                break;
+            case 7:
+                rules.push_back("exe:/opt/app" + n + "/*");
+                break;
+            case 8:
+                rules.push_back("cgroup:*/app-launcher" + n + "@*.scope");
+                break;
+            case 9:
+                // the escapes must not end up in the literal that is searched for, see getRegexLiteral()
+                switch ((i / 10) % 4) {
+                    case 0: rules.push_back("cmdline:re:--level\\x3d" + n + "\\b"); break;
+                    case 1: rules.push_back("cmdline:re:\\x2D\\x2Dlevel\\x3d" + n + "\\b"); break;
+                    case 2: rules.push_back("cmdline:re:--\\u006Cevel\\x3d" + n + "\\b"); break;
+                    case 3: rules.push_back("cmdline:re:(-)\\1level\\x3d" + n + "\\b"); break;
+                }
+                break;
+        }
+    }
+    return rules;
+}
+
+
+std::vector<Process> makeProcesses(size_t count, size_t ruleCount) {
+    std::minstd_rand rng(42);
+    std::uniform_int_distribution<size_t> rule(0, ruleCount - 1);
+    std::vector<Process> processes;
+    for (size_t i = 0; i < count; i++) {
+        const std::string n = std::to_string(i);
+        Process p{ "worker" + n, "/usr/bin/worker" + n + " --threads 4 --log /var/log/worker.log", "/usr/bin/worker" + n,
+                   "/user.slice/user-1000.slice/user@1000.service/app.slice/app-worker" + n + ".scope" };
+        if (i % 10 == 0) {
+            // make it match the rule
+            const std::string r = std::to_string(rule(rng));
+            switch (std::stoul(r) % 10) {
+                case 0: case 1: case 2: case 3: case 4: p.comm = "game" + r; break;
+                case 5: p.comm = "tool" + r + "-bin"; break;
+                case 6: p.cmdline += " --profile=p" + r + " --fullscreen"; break;
+                case 7: p.exe = "/opt/app" + r + "/bin/app"; break;
+                case 8: p.cgroup = "/user.slice/user-1000.slice/user@1000.service/app.slice/app-launcher" + r + "@" + n + ".scope"; break;
+                case 9: p.cmdline += " --level=" + r; break;
+            }
+        }
+        processes.push_back(std::move(p));
+    }
+    return processes;
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t ruleCount = argc > 1 ? std::stoul(argv[1]) : 500;
+    const size_t processCount = argc > 2 ? std::stoul(argv[2]) : 20000;
+    const std::vector<std::string> ruleStrings = makeRules(ruleCount);
+    const std::vector<Process> processes = makeProcesses(processCount, ruleCount);
+    // the config file is split at the first =
+    for (const std::string& rule : ruleStrings) {
+        if (rule.find('=') != std::string::npos) {
+            std::cout << "FAILED: rule '" << rule << "' can not be written in the config file\n";
+            return 1;
+        }
+    }
+    using clock = std::chrono::steady_clock;
+
+    auto compileStart = clock::now();
+    ProcessRuleSet ruleSet(ruleStrings);
+    auto compileTime = clock::now() - compileStart;
+
+    std::vector<int> compiledResults;
+    auto compiledStart = clock::now();
+    for (const Process& process : processes) {
+        int best = -1;
+        for (ProcessField field : { ProcessField::COMM, ProcessField::CMDLINE, ProcessField::EXE, ProcessField::CGROUP }) {
+            if (ruleSet.needsField(field, best)) {
+                best = ruleSet.match(field, process.get(field), best);
+            }
+        }
+        compiledResults.push_back(best);
+    }
+    auto compiledTime = clock::now() - compiledStart;
+
+    // one rule after another
+    std::vector<ProcessRule> rules;
+    std::vector<std::regex> regexes;
+    for (const std::string& s : ruleStrings) {
+        rules.push_back(parseProcessRule(s));
+        regexes.emplace_back(rules.back().type == PatternType::REGEX ? rules.back().pattern : "", std::regex::ECMAScript | std::regex::optimize);
+    }
+    std::vector<int> naiveResults;
+    auto naiveStart = clock::now();
+    for (const Process& process : processes) {
+        int best = -1;
+        for (int i = static_cast<int>(rules.size()) - 1; i >= 0 and best < 0; i--) {
+            const std::string& value = process.get(rules[i].field);
+            switch (rules[i].type) {
+                case PatternType::EXACT: if (value == rules[i].pattern) { best = i; } break;
+                case PatternType::GLOB: if (fnmatch(rules[i].pattern.c_str(), value.c_str(), 0) == 0) { best = i; } break;
+                case PatternType::REGEX: if (std::regex_search(value, regexes[i])) { best = i; } break;
+            }
+        }
+        naiveResults.push_back(best);
+    }
+    auto naiveTime = clock::now() - naiveStart;
+
+    size_t matches = 0;
+    for (size_t i = 0; i < processes.size(); i++) {
+        if (compiledResults[i] != naiveResults[i]) {
+            std::cerr << "Mismatch for process " << i << ": " << compiledResults[i] << " != " << naiveResults[i] << '\n';
+            return 1;
+        }
+        if (compiledResults[i] >= 0) { matches++; }
+    }
+
+    auto us = [](clock::duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+    std::cout << ruleCount << " rules, " << processCount << " processes, " << matches << " matches\n"
+              << "compile:    " << us(compileTime) << " us\n"
+              << "rule set:   " << us(compiledTime) << " us (" << std::chrono::duration_cast<std::chrono::nanoseconds>(compiledTime).count() / processCount << " ns/process)\n"
+              << "one by one: " << us(naiveTime) << " us (" << std::chrono::duration_cast<std::chrono::nanoseconds>(naiveTime).count() / processCount << " ns/process)\n";
+    return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file
+ * @brief Test the Schedule at the daylight saving time changes of Europe/Berlin
+ * @details
+ *  Usage: schedule_test
+ *  In 2026, the clocks go from 02:00 to 03:00 on March 29 (UTC 01:00) and from 03:00 back to 02:00 on October 25 (UTC 01:00).
+ *  A local time that is skipped has to happen at the moment of the change, one that happens twice the first time (see Schedule).
+ *  Checks isInWindow(), getActiveSetting() and getNextTransition() for:
+ *  - a time window that ends in the skipped hour and one that spans the repeated hour
+ *  - a scheduled setting (at:) in the skipped hour and one in the repeated hour
+ *  The instants are given in UTC, so that the expected values do not depend on the time zone code that is tested.
+ *  Exits with 1 if a check fails.
+ */
+#include "../schedule.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace rgb;
+using namespace std::chrono;
+
+int failures = 0;
+
+
+/// @returns the instant of a UTC date and time
+sys_seconds utc(int month, int day, int hour, int minute) {
+    return sys_days(year(2026) / month / day) + hours(hour) + minutes(minute);
+}
+
+
+std::string toString(system_clock::time_point time) {
+    if (time == system_clock::time_point::max()) { return "never"; }
+    const sys_seconds seconds = floor<std::chrono::seconds>(time);
+    const sys_days day = floor<days>(seconds);
+    const year_month_day date(day);
+    const hh_mm_ss<std::chrono::seconds> clock(seconds - day);
+    char s[32];
+    std::snprintf(s, sizeof(s), "%02u-%02u %02ld:%02ld UTC", static_cast<unsigned>(date.month()), static_cast<unsigned>(date.day()),
+                  static_cast<long>(clock.hours().count()), static_cast<long>(clock.minutes().count()));
+    return s;
+}
+
+
+void check(const std::string& name, bool ok) {
+    std::cout << (ok ? "ok:     " : "FAILED: ") << name << "\n";
+    if (!ok) { failures++; }
+}
+
+
+void checkTransition(const std::string& name, const Schedule& schedule, sys_seconds from, sys_seconds expected) {
+    const system_clock::time_point next = schedule.getNextTransition(from);
+    check(name + ": next transition after " + toString(from) + " is " + toString(next) + ", expected " + toString(expected), next == expected);
+}
+
+
+int main() {
+    const time_zone* berlin = getTimeZone("Europe/Berlin");
+
+    // 01:30 CET (00:30 UTC) until 02:30, which is skipped: the window ends at the change, 03:00 CEST (01:00 UTC)
+    {
+        const Schedule schedule(parseTimeWindows("01:30-02:30"), {}, berlin);
+        checkTransition("spring forward window start", schedule, utc(3, 28, 12, 0), utc(3, 29, 0, 30));
+        checkTransition("spring forward window stop in the skipped hour", schedule, utc(3, 29, 0, 30), utc(3, 29, 1, 0));
+        check("spring forward: in the window before the change", schedule.isInWindow(utc(3, 29, 0, 59)));
+        check("spring forward: not in the window at the change", !schedule.isInWindow(utc(3, 29, 1, 0)));
+        check("spring forward: not in the window at 02:30 UTC (04:30 CEST)", !schedule.isInWindow(utc(3, 29, 2, 30)));
+        checkTransition("spring forward window start on the next day (CEST)", schedule, utc(3, 29, 1, 0), utc(3, 29, 23, 30));
+    }
+
+    // 02:30 happens at 00:30 UTC (CEST) and at 01:30 UTC (CET), the window starts the first time and ends at 03:30 CET (02:30 UTC)
+    {
+        const Schedule schedule(parseTimeWindows("02:30-03:30"), {}, berlin);
+        checkTransition("fall back window start in the repeated hour", schedule, utc(10, 24, 12, 0), utc(10, 25, 0, 30));
+        checkTransition("fall back window stop", schedule, utc(10, 25, 0, 30), utc(10, 25, 2, 30));
+        check("fall back: not in the window at the first 02:29", !schedule.isInWindow(utc(10, 25, 0, 29)));
+        check("fall back: in the window at the first 02:30", schedule.isInWindow(utc(10, 25, 0, 30)));
+        check("fall back: in the window at the second 02:45", schedule.isInWindow(utc(10, 25, 1, 45)));
+        check("fall back: not in the window at 03:30 CET", !schedule.isInWindow(utc(10, 25, 2, 30)));
+    }
+
+    // a window that ends before the change, and at:02:30 in the skipped hour: the setting starts at the change
+    {
+        const Schedule schedule(parseTimeWindows("18:30-01:00"), { parseScheduleTime("02:30") }, berlin);
+        checkTransition("spring forward window stop before the change", schedule, utc(3, 28, 23, 0), utc(3, 29, 0, 0));
+        checkTransition("spring forward at: in the skipped hour", schedule, utc(3, 29, 0, 0), utc(3, 29, 1, 0));
+        check("spring forward: idle setting before the change", schedule.getActiveSetting(utc(3, 29, 0, 59)) == -1);
+        check("spring forward: scheduled setting at the change", schedule.getActiveSetting(utc(3, 29, 1, 0)) == 0);
+        checkTransition("spring forward window start after the at: time", schedule, utc(3, 29, 1, 0), utc(3, 29, 16, 30));
+    }
+
+    // at:02:30 in the repeated hour: the setting starts the first time, the second 02:30 is no transition
+    {
+        const Schedule schedule(parseTimeWindows("18:30-01:00"), { parseScheduleTime("02:30") }, berlin);
+        checkTransition("fall back at: in the repeated hour", schedule, utc(10, 25, 0, 0), utc(10, 25, 0, 30));
+        check("fall back: idle setting before the first 02:30", schedule.getActiveSetting(utc(10, 25, 0, 29)) == -1);
+        check("fall back: scheduled setting at the first 02:30", schedule.getActiveSetting(utc(10, 25, 0, 30)) == 0);
+        check("fall back: scheduled setting at the second 02:30", schedule.getActiveSetting(utc(10, 25, 1, 30)) == 0);
+        checkTransition("fall back window start (CET) after the at: time", schedule, utc(10, 25, 0, 30), utc(10, 25, 17, 30));
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,389 @@
+/**
+ * @file
+ * @brief Test that a hung OpenRGB server does not delay the frames of the others
+ * @details
+ *  Usage: server_fanout_test [FRAMES]
+ *  Starts SERVER_COUNT fake OpenRGB servers on local ports and connects a ServerConnection to each of them.
+ *  The device cache of every server is written to a temporary directory beforehand, so the fake servers only answer
+ *  REQUEST_PROTOCOL_VERSION and REQUEST_CONTROLLER_COUNT and never have to send the device list, the check of the cache is turned off.
+ *  The controller commits FRAMES (default 60) frames every FRAME_INTERVAL to all servers, first while all servers read,
+ *  then while the first server no longer reads from its connections, like a hung OpenRGB. The sockets of the fake servers
+ *  have small receive buffers, so the sender thread of the hung server blocks soon.
+ *  Commit is the time the controller thread spends in ServerConnection::commit() for all servers of a frame.
+ *  Latency is the time from the commit until the last device packet of the frame arrived at a server that reads.
+ *  Then a black frame is committed and the connections are destroyed right away, like the controller thread does on shutdown.
+ *  Exits with 1 if a server that reads misses a frame, a frame arrives later than FRAME_INTERVAL, a commit takes
+ *  longer than MAX_COMMIT_TIME or the black frame does not reach the servers that read after the shutdown.
+ */
+#include "../server_connection.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+gz::Log rgblog(gz::LogCreateInfo{
+        .logfile = "/tmp/server_fanout_test.log",
+        .showLog = false,
+        .storeLog = false,
+        .prefix = "server_fanout_test",
+        .prefixColor = gz::Color::CYAN,
+        .showTime = false,
+        .clearLogfileOnRestart = true,
+        });
+
+namespace fs = std::filesystem;
+using namespace rgb;
+using test_clock = std::chrono::steady_clock;
+
+const DeviceTypeMask TARGET_DEVICES{ orgb::DeviceType::LEDStrip };
+constexpr size_t SERVER_COUNT = 3;
+constexpr size_t DEVICE_COUNT = 3;
+constexpr uint32_t LED_COUNT = 500;
+constexpr auto FRAME_INTERVAL = std::chrono::milliseconds(33);
+constexpr auto MAX_COMMIT_TIME = std::chrono::milliseconds(2);
+constexpr auto CONNECT_WAIT = std::chrono::seconds(5);
+/// Receive buffer of the fake servers, so that the sender of a hung server blocks after a few frames
+constexpr int SERVER_RECEIVE_BUFFER = 16 * 1024;
+
+// the OpenRGB SDK client also requests the controller count when connecting, as in OpenRGB's NetworkProtocol.h
+constexpr uint32_t NET_PACKET_ID_REQUEST_CONTROLLER_COUNT = 0;
+
+
+/**
+ * @brief Stand-in for an OpenRGB server
+ * @details
+ *  Answers the protocol version (with the version of the client) and the controller count, and records when the last device
+ *  packet of every frame arrived. The frame number is stored in the first led of every UPDATELEDS packet,
+ *  except in a black frame, which is recorded on its own. While hung, no connection is read.
+ */
+class FakeServer {
+    public:
+        FakeServer(size_t frames) : arrival(frames) {
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            // accepted sockets inherit the buffer size
+            setsockopt(listenFd, SOL_SOCKET, SO_RCVBUF, &SERVER_RECEIVE_BUFFER, sizeof(SERVER_RECEIVE_BUFFER));
+            if (listenFd < 0 or bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+                or listen(listenFd, 4) < 0 or getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length) < 0
+                or pipe(stopPipe) < 0) {
+                std::cerr << "Can not listen on a local port\n";
+                std::exit(1);
+            }
+            port = ntohs(address.sin_port);
+            thread = std::thread(&FakeServer::run, this);
+        }
+        ~FakeServer() {
+            hung = false;
+            close(stopPipe[1]);
+            thread.join();
+            for (const Connection& connection : connections) { close(connection.fd); }
+            close(stopPipe[0]);
+            close(listenFd);
+        }
+        uint16_t getPort() const { return port; }
+        void setHung(bool hung) { this->hung = hung; }
+        /// @returns the time the last device packet of frame arrived, or time_point() if it did not
+        test_clock::time_point getArrival(size_t frame) {
+            std::lock_guard lock(mutex);
+            return arrival.at(frame);
+        }
+        /// @returns true if the last device packet of a black frame arrived
+        bool blackArrived() const { return black; }
+
+    private:
+        struct Connection {
+            int fd;
+            std::vector<uint8_t> buffer;
+        };
+        int listenFd;
+        int stopPipe[2];
+        uint16_t port;
+        std::atomic<bool> hung = false;
+        std::atomic<bool> black = false;
+        std::thread thread;
+        std::vector<Connection> connections;
+        std::mutex mutex;
+        std::vector<test_clock::time_point> arrival;
+
+        void run() {
+            while (true) {
+                std::vector<pollfd> fds{ { stopPipe[0], POLLIN, 0 }, { listenFd, POLLIN, 0 } };
+                if (!hung) {
+                    for (const Connection& connection : connections) { fds.push_back({ connection.fd, POLLIN, 0 }); }
+                }
+                // a hung server still notices when it is stopped or resumed
+                if (poll(fds.data(), fds.size(), hung ? 10 : -1) < 0) { continue; }
+                if (fds[0].revents != 0) { return; }
+                if (fds[1].revents != 0) {
+                    int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (fd >= 0) { connections.push_back({ fd, {} }); }
+                }
+                for (size_t i = 2; i < fds.size(); i++) {
+                    if (fds[i].revents != 0) { receive(connections[i - 2]); }
+                }
+            }
+        }
+
+        void receive(Connection& connection) {
+            uint8_t chunk[1 << 16];
+            ssize_t n = recv(connection.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n <= 0) { return; }
+            const auto now = test_clock::now();
+            connection.buffer.insert(connection.buffer.end(), chunk, chunk + n);
+            size_t offset = 0;
+            while (connection.buffer.size() - offset >= ORGB_HEADER_SIZE) {
+                const uint8_t* packet = connection.buffer.data() + offset;
+                uint32_t deviceIdx, packetId, dataSize;
+                std::memcpy(&deviceIdx, packet + 4, sizeof(deviceIdx));
+                std::memcpy(&packetId, packet + 8, sizeof(packetId));
+                std::memcpy(&dataSize, packet + 12, sizeof(dataSize));
+                if (connection.buffer.size() - offset < ORGB_HEADER_SIZE + dataSize) { break; }
+                handlePacket(connection.fd, deviceIdx, packetId, packet + ORGB_HEADER_SIZE, dataSize, now);
+                offset += ORGB_HEADER_SIZE + dataSize;
+            }
+            connection.buffer.erase(connection.buffer.begin(), connection.buffer.begin() + offset);
+        }
+
+        void handlePacket(int fd, uint32_t deviceIdx, uint32_t packetId, const uint8_t* data, uint32_t dataSize, test_clock::time_point now) {
+            switch (packetId) {
+                case NET_PACKET_ID_REQUEST_PROTOCOL_VERSION: {
+                    uint32_t version = 0;
+                    if (dataSize >= sizeof(version)) { std::memcpy(&version, data, sizeof(version)); }
+                    reply(fd, packetId, version);
+                    break;
+                }
+                case NET_PACKET_ID_REQUEST_CONTROLLER_COUNT:
+                    reply(fd, packetId, static_cast<uint32_t>(DEVICE_COUNT));
+                    break;
+                case NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS: {
+                    // data size, color count, colors
+                    if (dataSize < 6 + ORGB_COLOR_SIZE or deviceIdx != DEVICE_COUNT - 1) { break; }
+                    const uint8_t* color = data + 6;
+                    if (std::all_of(color, data + dataSize, [](uint8_t byte) { return byte == 0; })) {
+                        black = true;
+                        break;
+                    }
+                    const size_t frame = color[0] | (color[1] << 8) | (color[2] << 16);
+                    std::lock_guard lock(mutex);
+                    if (frame < arrival.size()) { arrival[frame] = now; }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+
+        void reply(int fd, uint32_t packetId, uint32_t value) {
+            uint8_t packet[ORGB_HEADER_SIZE + sizeof(value)] = { 'O', 'R', 'G', 'B' };
+            const uint32_t deviceIdx = 0;
+            const uint32_t dataSize = sizeof(value);
+            std::memcpy(packet + 4, &deviceIdx, sizeof(deviceIdx));
+            std::memcpy(packet + 8, &packetId, sizeof(packetId));
+            std::memcpy(packet + 12, &dataSize, sizeof(dataSize));
+            std::memcpy(packet + 16, &value, sizeof(value));
+            if (send(fd, packet, sizeof(packet), MSG_NOSIGNAL) != sizeof(packet)) {
+                std::cerr << "Can not reply to the client\n";
+            }
+        }
+};
+
+
+std::vector<DeviceInfo> makeDevices() {
+    std::vector<DeviceInfo> devices;
+    for (uint32_t i = 0; i < DEVICE_COUNT; i++) {
+        DeviceInfo device;
+        device.idx = i;
+        device.type = orgb::DeviceType::LEDStrip;
+        device.name = "Fake strip " + std::to_string(i);
+        device.ledCount = LED_COUNT;
+        device.zones = { ZoneInfo{ 0, LED_COUNT } };
+        devices.push_back(device);
+    }
+    return devices;
+}
+
+
+double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, static_cast<size_t>(values.size() * p))];
+}
+double us(test_clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+
+/**
+ * @brief Commit frames [begin, end) to all servers and check the arrival at all servers but hungServer
+ * @param hungServer SERVER_COUNT if all servers read
+ * @returns false if a check failed
+ */
+bool runFrames(std::vector<std::unique_ptr<FakeServer>>& fakes, std::vector<std::unique_ptr<ServerConnection>>& connections,
+               size_t begin, size_t end, size_t hungServer, const std::string& name) {
+    std::vector<orgb::Color> colors(LED_COUNT, orgb::Color(10, 20, 30));
+    std::vector<test_clock::time_point> commitTimes;
+    std::vector<double> commitDurations;
+    auto nextFrame = test_clock::now();
+    for (size_t frame = begin; frame < end; frame++) {
+        colors[0] = orgb::Color(frame & 0xff, (frame >> 8) & 0xff, (frame >> 16) & 0xff);
+        for (auto& connection : connections) {
+            for (uint32_t device = 0; device < DEVICE_COUNT; device++) {
+                connection->getFrame().updateLEDs(device, colors);
+            }
+        }
+        const auto start = test_clock::now();
+        for (auto& connection : connections) { connection->commit(); }
+        commitTimes.push_back(start);
+        commitDurations.push_back(us(test_clock::now() - start));
+        nextFrame += FRAME_INTERVAL;
+        std::this_thread::sleep_until(nextFrame);
+    }
+    // the last frame had FRAME_INTERVAL to arrive
+
+    bool ok = true;
+    size_t missing = 0;
+    size_t hungReceived = 0;
+    std::vector<double> latencies;
+    for (size_t server = 0; server < fakes.size(); server++) {
+        for (size_t frame = begin; frame < end; frame++) {
+            const auto arrival = fakes[server]->getArrival(frame);
+            if (server == hungServer) { hungReceived += arrival != test_clock::time_point(); }
+            else if (arrival == test_clock::time_point()) { missing++; }
+            else { latencies.push_back(us(arrival - commitTimes[frame - begin])); }
+        }
+    }
+    const double maxCommit = *std::max_element(commitDurations.begin(), commitDurations.end());
+    std::cout << name << ":\n" << std::fixed << std::setprecision(1)
+              << "  commit median " << std::setw(6) << percentile(commitDurations, 0.5) << " us, max " << std::setw(7) << maxCommit << " us\n";
+    if (!latencies.empty()) {
+        std::cout << "  latency median " << std::setw(6) << percentile(latencies, 0.5) << " us, p99 " << std::setw(7) << percentile(latencies, 0.99)
+                  << " us, max " << std::setw(7) << *std::max_element(latencies.begin(), latencies.end()) << " us\n";
+    }
+    if (hungServer < fakes.size()) {
+        std::cout << "  the hung server received " << hungReceived << " of " << end - begin << " frames\n";
+        // otherwise nothing was tested
+        if (hungReceived == end - begin) {
+            std::cout << "FAILED: the hung server received all frames\n";
+            ok = false;
+        }
+    }
+    if (missing > 0) {
+        std::cout << "FAILED: " << missing << " frames did not arrive at the servers that read\n";
+        ok = false;
+    }
+    if (!latencies.empty() and *std::max_element(latencies.begin(), latencies.end()) > us(FRAME_INTERVAL)) {
+        std::cout << "FAILED: a frame arrived later than " << FRAME_INTERVAL.count() << " ms\n";
+        ok = false;
+    }
+    if (maxCommit > us(MAX_COMMIT_TIME)) {
+        std::cout << "FAILED: a commit took longer than " << MAX_COMMIT_TIME.count() << " ms\n";
+        ok = false;
+    }
+    return ok;
+}
+
+
+/**
+ * @brief Commit a black frame and destroy the connections right away, like the controller thread on shutdown
+ * @returns false if the frame did not arrive at the servers that read (all but the first, which was hung)
+ */
+bool checkShutdownFrame(std::vector<std::unique_ptr<FakeServer>>& fakes, std::vector<std::unique_ptr<ServerConnection>>& connections) {
+    const std::vector<orgb::Color> black(LED_COUNT, orgb::Color::Black);
+    for (auto& connection : connections) {
+        for (uint32_t device = 0; device < DEVICE_COUNT; device++) {
+            connection->getFrame().updateLEDs(device, black);
+        }
+        connection->commit();
+    }
+    // the servers that read first, so that waiting for the worker of the hung server does not give the others time
+    while (!connections.empty()) { connections.pop_back(); }
+    // sent, but maybe not read yet
+    const auto deadline = test_clock::now() + FRAME_INTERVAL;
+    auto arrived = [&fakes]() { return std::all_of(fakes.begin() + 1, fakes.end(), [](const auto& fake) { return fake->blackArrived(); }); };
+    while (!arrived() and test_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!arrived()) {
+        std::cout << "FAILED: the black frame committed before the shutdown did not arrive\n";
+        return false;
+    }
+    std::cout << "the black frame committed before the shutdown arrived\n";
+    return true;
+}
+
+
+int main(int argc, char* argv[]) {
+    const size_t frames = argc > 1 ? std::stoul(argv[1]) : 60;
+    if (frames == 0) {
+        std::cerr << "FRAMES must be at least 1\n";
+        return 1;
+    }
+    char tmpl[] = "/tmp/server_fanout_test.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        std::cerr << "Can not create a temporary directory\n";
+        return 1;
+    }
+    const std::string cacheDir = tmpl;
+
+    bool ok = true;
+    {
+        std::vector<std::unique_ptr<FakeServer>> fakes;
+        std::vector<std::unique_ptr<ServerConnection>> connections;
+        UpdateStats stats;
+        for (size_t i = 0; i < SERVER_COUNT; i++) {
+            fakes.push_back(std::make_unique<FakeServer>(2 * frames));
+            const ServerAddress address{ "127.0.0.1", fakes.back()->getPort() };
+            saveDeviceCache(getDeviceCachePath(address.toString(), cacheDir),
+                            getDeviceFingerprint(DEVICE_COUNT, TARGET_DEVICES), makeDevices());
+            connections.push_back(std::make_unique<ServerConnection>(address, "server_fanout_test", stats, cacheDir, false));
+            connections.back()->start(TARGET_DEVICES, []() {});
+        }
+
+        const auto deadline = test_clock::now() + CONNECT_WAIT;
+        auto connected = [&connections]() {
+            return std::all_of(connections.begin(), connections.end(), [](const auto& c) { return c->getState() == ServerState::CONNECTED; });
+        };
+        while (!connected() and test_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        // take the devices like the controller, frames are dropped until then
+        const bool tookDevices = connected() and std::all_of(connections.begin(), connections.end(), [](const auto& c) { return c->takeDevices().has_value(); });
+        if (!tookDevices or stats.connects != SERVER_COUNT) {
+            std::cout << "FAILED: connecting to the fake servers, see /tmp/server_fanout_test.log\n";
+            ok = false;
+        }
+        else {
+            std::cout << frames << " frames of " << DEVICE_COUNT << " x " << LED_COUNT << " leds to " << SERVER_COUNT << " servers\n";
+            ok = runFrames(fakes, connections, 0, frames, SERVER_COUNT, "all servers read") and ok;
+            fakes[0]->setHung(true);
+            ok = runFrames(fakes, connections, frames, 2 * frames, 0, "first server hung") and ok;
+        }
+        // let the hung server read again, so that a reconnect of its worker does not wait for a reply
+        fakes[0]->setHung(false);
+        if (ok) { ok = checkShutdownFrame(fakes, connections); }
+        connections.clear();
+    }
+    fs::remove_all(cacheDir);
+    if (ok) { std::cout << "ok\n"; }
+    return ok ? 0 : 1;
+}
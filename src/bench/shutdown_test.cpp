@@ -0,0 +1,239 @@
+/**
+ * @file
+ * @brief Shutdown latency test for the rgb controller thread
+ * @details
+ *  Usage: shutdown_test
+ *  Every case runs in a child process that shuts down like the daemon: SIGTERM is received through a signalfd,
+ *  then ControllerThread::stop() turns the lights off and joins the thread, as in App::exit().
+ *  The parent sends SIGTERM while the controller thread waits and checks that the child exits within MAX_SHUTDOWN_TIME:
+ *  - while it retries to connect (the port refuses the connection)
+ *  - while it waits for commands and while it animates a rainbow, connected to a fake server that reports no devices
+ *  The controller connects to the fixed OpenRGB port, so the test is skipped if that port is in use.
+ *  Exits with 1 if a check fails.
+ */
+#include "../controller_thread.hpp"
+#include "../main.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+gz::Log rgblog(gz::LogCreateInfo{
+        .logfile = "/tmp/shutdown_test.log",
+        .showLog = false,
+        .storeLog = false,
+        .prefix = "shutdown_test",
+        .prefixColor = gz::Color::CYAN,
+        .showTime = false,
+        .clearLogfileOnRestart = true,
+        });
+
+using namespace rgb;
+
+constexpr auto MAX_SHUTDOWN_TIME = std::chrono::milliseconds(100);
+/// Time between the last command and SIGTERM, so that the thread is waiting
+constexpr auto SETTLE_TIME = std::chrono::milliseconds(50);
+/// A child that did not exit after this time is killed
+constexpr auto KILL_TIME = std::chrono::seconds(5);
+
+// the OpenRGB SDK client also requests the controller count when connecting, as in OpenRGB's NetworkProtocol.h
+constexpr uint32_t NET_PACKET_ID_REQUEST_CONTROLLER_COUNT = 0;
+constexpr size_t HEADER_SIZE = 16;
+
+
+/// @returns a socket bound to the OpenRGB port on localhost or -1 if the port is in use
+int bindOpenRGBPort() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(DEFAULT_SERVER_PORT);
+    if (fd < 0 or bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        if (fd >= 0) { close(fd); }
+        return -1;
+    }
+    return fd;
+}
+
+
+/**
+ * @brief Stand-in for an OpenRGB server without devices
+ * @details Answers the protocol version (with the version of the client) and the controller count (0) in a thread
+ */
+class FakeServer {
+    public:
+        /// @param listenFd socket bound to the OpenRGB port
+        FakeServer(int listenFd) : listenFd(listenFd) {
+            if (listen(listenFd, 4) < 0 or pipe(stopPipe) < 0) {
+                std::cerr << "Can not listen on the OpenRGB port\n";
+                std::exit(1);
+            }
+            thread = std::thread(&FakeServer::run, this);
+        }
+        ~FakeServer() {
+            close(stopPipe[1]);
+            thread.join();
+            for (int fd : connections) { close(fd); }
+            close(stopPipe[0]);
+        }
+
+    private:
+        int listenFd;
+        int stopPipe[2];
+        std::thread thread;
+        std::vector<int> connections;
+
+        void run() {
+            while (true) {
+                std::vector<pollfd> fds{ { stopPipe[0], POLLIN, 0 }, { listenFd, POLLIN, 0 } };
+                for (int fd : connections) { fds.push_back({ fd, POLLIN, 0 }); }
+                if (poll(fds.data(), fds.size(), -1) < 0) { continue; }
+                if (fds[0].revents != 0) { return; }
+                if (fds[1].revents != 0) {
+                    int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (fd >= 0) { connections.push_back(fd); }
+                }
+                for (size_t i = 2; i < fds.size(); i++) {
+                    if (fds[i].revents != 0) { receive(fds[i].fd); }
+                }
+            }
+        }
+
+        /// the client waits for each reply, so a packet is never split across reads
+        void receive(int fd) {
+            uint8_t packet[1 << 12];
+            ssize_t n = recv(fd, packet, sizeof(packet), MSG_DONTWAIT);
+            for (ssize_t offset = 0; offset + static_cast<ssize_t>(HEADER_SIZE) <= n;) {
+                uint32_t packetId, dataSize;
+                std::memcpy(&packetId, packet + offset + 8, sizeof(packetId));
+                std::memcpy(&dataSize, packet + offset + 12, sizeof(dataSize));
+                if (packetId == NET_PACKET_ID_REQUEST_PROTOCOL_VERSION) {
+                    uint32_t version = 0;
+                    if (dataSize >= sizeof(version) and offset + static_cast<ssize_t>(HEADER_SIZE + sizeof(version)) <= n) {
+                        std::memcpy(&version, packet + offset + HEADER_SIZE, sizeof(version));
+                    }
+                    reply(fd, packetId, version);
+                }
+                else if (packetId == NET_PACKET_ID_REQUEST_CONTROLLER_COUNT) {
+                    reply(fd, packetId, 0);
+                }
+                offset += HEADER_SIZE + dataSize;
+            }
+        }
+
+        void reply(int fd, uint32_t packetId, uint32_t value) {
+            uint8_t packet[HEADER_SIZE + sizeof(value)] = { 'O', 'R', 'G', 'B' };
+            const uint32_t deviceIdx = 0;
+            const uint32_t dataSize = sizeof(value);
+            std::memcpy(packet + 4, &deviceIdx, sizeof(deviceIdx));
+            std::memcpy(packet + 8, &packetId, sizeof(packetId));
+            std::memcpy(packet + 12, &dataSize, sizeof(dataSize));
+            std::memcpy(packet + 16, &value, sizeof(value));
+            send(fd, packet, sizeof(packet), MSG_NOSIGNAL);
+        }
+};
+
+
+/**
+ * @brief Run the controller thread with commands and shut it down on SIGTERM
+ * @param readyFd written after the commands were pushed
+ */
+[[noreturn]] void runChild(const std::vector<RGBCommand>& commands, int readyFd) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+
+    auto config = std::make_shared<Config>();
+    config->servers = { ServerAddress{ "127.0.0.1", DEFAULT_SERVER_PORT } };
+    config->clearSetting = clearSetting;
+    std::atomic<std::shared_ptr<const Config>> currentConfig(config);
+    ControllerThread controllerThread(&currentConfig);
+    for (const RGBCommand& command : commands) {
+        controllerThread.getQueue().push(command);
+    }
+    char ready = 1;
+    if (signalFd < 0 or write(readyFd, &ready, 1) != 1) { std::_Exit(2); }
+
+    signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) != sizeof(info));
+    controllerThread.stop(config->clearSetting);
+    std::exit(controllerThread.getReturnCode() == 0 ? 0 : 3);
+}
+
+
+/**
+ * @brief Send SIGTERM to a child that runs commands
+ * @returns false if the child did not exit with 0 within MAX_SHUTDOWN_TIME
+ */
+bool checkShutdown(const std::string& name, const std::vector<RGBCommand>& commands) {
+    int readyPipe[2];
+    if (pipe(readyPipe) < 0) { std::exit(1); }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) { std::exit(1); }
+    if (pid == 0) {
+        close(readyPipe[0]);
+        runChild(commands, readyPipe[1]);
+    }
+    close(readyPipe[1]);
+    char ready;
+    bool started = read(readyPipe[0], &ready, 1) == 1;
+    close(readyPipe[0]);
+    std::this_thread::sleep_for(SETTLE_TIME);
+
+    const auto start = std::chrono::steady_clock::now();
+    kill(pid, SIGTERM);
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (std::chrono::steady_clock::now() - start > KILL_TIME) {
+            kill(pid, SIGKILL);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    const bool ok = started and WIFEXITED(status) and WEXITSTATUS(status) == 0 and elapsed <= MAX_SHUTDOWN_TIME;
+    std::cout << (ok ? "ok:     " : "FAILED: ") << name << ": exit after " << elapsed.count() << " ms\n";
+    return ok;
+}
+
+
+int main() {
+    // bound but not listening: connections are refused
+    const int portFd = bindOpenRGBPort();
+    if (portFd < 0) {
+        std::cout << "skipped: port " << DEFAULT_SERVER_PORT << " is in use, stop the OpenRGB server to run the test\n";
+        return 0;
+    }
+    const RGBSetting rainbowSetting{ targetDeviceTypes, INSTANT, RGBMode::RAINBOW, orgb::Color::Black };
+    int failures = 0;
+    if (!checkShutdown("retrying to connect", {})) { failures++; }
+    {
+        FakeServer server(portFd);
+        if (!checkShutdown("waiting for commands", {})) { failures++; }
+        if (!checkShutdown("animating", { RGBCommand{ RGBCommandType::CHANGE_SETTING, rainbowSetting } })) { failures++; }
+    }
+    close(portFd);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file
+ * @brief Test for SleepWatcher
+ * @details
+ *  Usage: sleep_watcher_test, with $DBUS_SYSTEM_BUS_ADDRESS set to a private bus. sleep_watcher_test.sh starts one.
+ *  A fake systemd-logind runs in a second thread on its own connection: Inhibit returns the read end of a pipe,
+ *  which is released when the write end reports POLLERR, and PrepareForSleep is emitted on request.
+ *  Like the daemon, the test only calls readSleep() when the fd of the watcher is readable.
+ *  The fake can also emit PrepareForSleep(true) before it replies to Inhibit, like a suspend right after waking up.
+ *  That signal is only seen if it is not read into the queue of sd-bus by a synchronous call.
+ *  Exits with 1 if a check fails.
+ */
+#include "../sleep_watcher.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <systemd/sd-bus.h>
+#include <unistd.h>
+
+gz::Log rgblog(gz::LogCreateInfo{
+        .logfile = "/tmp/sleep_watcher_test.log",
+        .showLog = true,
+        .storeLog = false,
+        .prefix = "sleep_watcher_test",
+        .prefixColor = gz::Color::CYAN,
+        .showTime = false,
+        .clearLogfileOnRestart = true,
+        });
+
+using namespace rgb;
+
+constexpr auto SIGNAL_TIMEOUT = std::chrono::seconds(2);
+
+
+/// Stand-in for systemd-logind
+class FakeLogind {
+    public:
+        FakeLogind() {
+            if (sd_bus_open_system(&bus) < 0
+                or sd_bus_add_object(bus, &objectSlot, "/org/freedesktop/login1", onMethodCall, this) < 0
+                or sd_bus_request_name(bus, "org.freedesktop.login1", 0) < 0) {
+                std::cerr << "Can not provide org.freedesktop.login1, is $DBUS_SYSTEM_BUS_ADDRESS set?\n";
+                std::exit(1);
+            }
+            if (pipe(commandPipe) < 0) { std::exit(1); }
+            thread = std::thread(&FakeLogind::run, this);
+        }
+        ~FakeLogind() {
+            close(commandPipe[1]);
+            thread.join();
+            close(commandPipe[0]);
+            for (int fd : locks) { close(fd); }
+            sd_bus_slot_unref(objectSlot);
+            sd_bus_flush_close_unref(bus);
+        }
+
+        void emitPrepareForSleep(bool sleeping) {
+            char command = sleeping ? 'S' : 'W';
+            if (write(commandPipe[1], &command, 1) != 1) { std::exit(1); }
+        }
+        /// The next Inhibit call is answered after PrepareForSleep(true)
+        void sleepBeforeNextInhibitReply() { sleepBeforeReply = true; }
+        /// @returns the number of inhibitor locks that were not released
+        size_t getHeldLocks() {
+            std::lock_guard lock(mutex);
+            std::vector<pollfd> fds;
+            for (int fd : locks) { fds.push_back({ fd, 0, 0 }); }
+            poll(fds.data(), fds.size(), 0);
+            size_t held = 0;
+            for (const pollfd& pfd : fds) {
+                if ((pfd.revents & POLLERR) == 0) { held++; }
+            }
+            return held;
+        }
+        unsigned getInhibitCalls() const { return inhibitCalls; }
+
+    private:
+        sd_bus* bus = nullptr;
+        sd_bus_slot* objectSlot = nullptr;
+        int commandPipe[2];
+        std::thread thread;
+        std::mutex mutex;
+        /// write ends of the pipes of the locks
+        std::vector<int> locks;
+        std::atomic<bool> sleepBeforeReply = false;
+        std::atomic<unsigned> inhibitCalls = 0;
+
+        static int onMethodCall(sd_bus_message* message, void* userdata, sd_bus_error*) {
+            auto* logind = static_cast<FakeLogind*>(userdata);
+            if (!sd_bus_message_is_method_call(message, "org.freedesktop.login1.Manager", "Inhibit")) { return 0; }
+            const char *what, *who, *why, *mode;
+            if (sd_bus_message_read(message, "ssss", &what, &who, &why, &mode) < 0 or std::string(what) != "sleep" or std::string(mode) != "delay") {
+                std::cerr << "Unexpected Inhibit arguments\n";
+                return 0;
+            }
+            logind->inhibitCalls++;
+            if (logind->sleepBeforeReply.exchange(false)) {
+                sd_bus_emit_signal(logind->bus, "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "PrepareForSleep", "b", 1);
+            }
+            int lockPipe[2];
+            if (pipe(lockPipe) < 0) { return -errno; }
+            {
+                std::lock_guard lock(logind->mutex);
+                logind->locks.push_back(lockPipe[1]);
+            }
+            sd_bus_reply_method_return(message, "h", lockPipe[0]);
+            close(lockPipe[0]);
+            return 1;
+        }
+
+        void run() {
+            while (true) {
+                while (sd_bus_process(bus, nullptr) > 0);
+                sd_bus_flush(bus);
+                pollfd fds[2] = { { sd_bus_get_fd(bus), POLLIN, 0 }, { commandPipe[0], POLLIN, 0 } };
+                poll(fds, 2, -1);
+                if (fds[1].revents == 0) { continue; }
+                char command;
+                if (read(commandPipe[0], &command, 1) != 1) { return; }
+                sd_bus_emit_signal(bus, "/org/freedesktop/login1", "org.freedesktop.login1.Manager", "PrepareForSleep", "b", command == 'S');
+            }
+        }
+};
+
+
+/**
+ * @brief Handle the messages whenever the fd of watcher is readable, until done() returns true
+ * @param onSleep called with the result of readSleep() when there was a signal
+ * @returns false after SIGNAL_TIMEOUT
+ */
+bool waitFor(SleepWatcher& watcher, std::function<bool()> done, std::function<void(bool)> onSleep=[](bool) {}) {
+    const auto deadline = std::chrono::steady_clock::now() + SIGNAL_TIMEOUT;
+    while (!done()) {
+        const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        pollfd pfd{ watcher.getFd(), POLLIN, 0 };
+        if (remaining.count() <= 0 or poll(&pfd, 1, static_cast<int>(remaining.count())) <= 0) { return false; }
+        if (std::optional<bool> sleeping = watcher.readSleep()) { onSleep(*sleeping); }
+    }
+    return true;
+}
+
+
+/// @returns the argument of the next PrepareForSleep signal, or std::nullopt after SIGNAL_TIMEOUT
+std::optional<bool> waitForSignal(SleepWatcher& watcher) {
+    std::optional<bool> signal;
+    waitFor(watcher, [&signal]() { return signal.has_value(); }, [&signal](bool sleeping) { signal = sleeping; });
+    return signal;
+}
+
+
+/// @returns true when logind has held locks within SIGNAL_TIMEOUT
+bool waitForHeldLocks(FakeLogind& logind, size_t expected) {
+    const auto deadline = std::chrono::steady_clock::now() + SIGNAL_TIMEOUT;
+    while (logind.getHeldLocks() != expected) {
+        if (std::chrono::steady_clock::now() > deadline) { return false; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+
+int main() {
+    int failures = 0;
+    auto check = [&failures](bool ok, const std::string& name) {
+        std::cout << (ok ? "ok:     " : "FAILED: ") << name << '\n';
+        if (!ok) { failures++; }
+    };
+
+    FakeLogind logind;
+    SleepWatcher watcher;
+    watcher.takeInhibitor();
+    check(waitFor(watcher, [&watcher]() { return watcher.holdsInhibitor(); }), "inhibitor lock taken");
+    check(logind.getInhibitCalls() == 1 and logind.getHeldLocks() == 1, "logind has one lock");
+
+    logind.emitPrepareForSleep(true);
+    check(waitForSignal(watcher) == true, "PrepareForSleep(true)");
+    watcher.releaseInhibitor();
+    check(waitForHeldLocks(logind, 0), "lock released");
+
+    logind.emitPrepareForSleep(false);
+    check(waitForSignal(watcher) == false, "PrepareForSleep(false)");
+
+    // sleeping again while the lock is requested after waking up
+    logind.sleepBeforeNextInhibitReply();
+    watcher.takeInhibitor();
+    check(waitForSignal(watcher) == true, "PrepareForSleep(true) before the Inhibit reply");
+    check(waitFor(watcher, [&watcher]() { return watcher.holdsInhibitor(); }), "inhibitor lock taken after the signal");
+    check(logind.getInhibitCalls() == 2, "lock requested once");
+    return failures == 0 ? 0 : 1;
+}
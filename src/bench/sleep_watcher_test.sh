@@ -0,0 +1,17 @@
+#!/bin/sh
+# Run sleep_watcher_test on a private bus, the test provides the fake systemd-logind
+# Usage: sleep_watcher_test.sh [TEST_EXECUTABLE]
+set -e
+cd "$(dirname "$0")"
+TEST=$(realpath "${1:-../../sleep_watcher_test}")
+DIR=$(mktemp -d)
+
+dbus-daemon --config-file=test_bus.conf --address="unix:path=$DIR/bus" --nofork --nopidfile &
+BUS=$!
+trap 'kill $BUS; rm -rf "$DIR"' EXIT
+
+for i in $(seq 50); do
+    [ -S "$DIR/bus" ] && break
+    sleep 0.1
+done
+DBUS_SYSTEM_BUS_ADDRESS="unix:path=$DIR/bus" "$TEST"
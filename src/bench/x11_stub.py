@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Minimal X11 server for focus_watcher_test, when Xvfb is not installed
+
+Usage: x11_stub.py DISPLAY_NUMBER [--get-property-delay=MS]
+
+Implements just enough of the protocol for X11FocusWatcher and the fake window manager of the test:
+InternAtom, CreateWindow (ignored), ChangeWindowAttributes (event mask only), ChangeProperty (replace only),
+GetProperty, GetInputFocus (to wait for the server) and QueryExtension (no extensions).
+ChangeProperty sends PropertyNotify to the clients that selected PropertyChange on the window.
+With --get-property-delay, GetProperty is answered after MS milliseconds, so that events of other clients
+arrive before the reply.
+"""
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+
+ROOT = 0x100
+PROPERTY_CHANGE_MASK = 0x400000
+PROPERTY_NOTIFY = 28
+
+display_number = sys.argv[1]
+get_property_delay = 0.0
+for arg in sys.argv[2:]:
+    if arg.startswith("--get-property-delay="):
+        get_property_delay = int(arg.split("=", 1)[1]) / 1000
+
+lock = threading.Lock()
+atoms = {"CARDINAL": 6, "WINDOW": 33}
+# (window, atom) -> (type, format, data)
+properties = {}
+clients = []
+
+
+class Client:
+    def __init__(self, connection):
+        self.connection = connection
+        self.sequence = 0
+        # window -> event mask
+        self.event_masks = {}
+        self.send_lock = threading.Lock()
+
+    def send(self, data):
+        with self.send_lock:
+            self.connection.sendall(data)
+
+
+def pad(n):
+    return (4 - n % 4) % 4
+
+
+def receive(connection, n):
+    data = b""
+    while len(data) < n:
+        chunk = connection.recv(n - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def intern_atom(name):
+    with lock:
+        if name not in atoms:
+            atoms[name] = 300 + len(atoms)
+        return atoms[name]
+
+
+def setup_reply():
+    vendor = b"stub"
+    pixmap_format = struct.pack("<BBB5x", 24, 32, 32)
+    visual = struct.pack("<IBBHIII4x", 0x21, 4, 8, 256, 0xff0000, 0xff00, 0xff)
+    depth = struct.pack("<BxH4x", 24, 1) + visual
+    screen = struct.pack("<IIIIIHHHHHHIBBBB", ROOT, 0x20, 0xffffff, 0, 0, 1920, 1080, 500, 300, 1, 1, 0x21, 0, 0, 24, 1) + depth
+    data = struct.pack("<IIIIHHBBBBBBBB4x", 1, 0x400000, 0x1fffff, 0, len(vendor), 65535, 1, 1, 0, 0, 32, 32, 8, 255)
+    data += vendor + b"\0" * pad(len(vendor)) + pixmap_format + screen
+    return struct.pack("<BxHHH", 1, 11, 0, len(data) // 4) + data
+
+
+def change_property(body):
+    window, atom, type_, format_, length = struct.unpack("<IIIB3xI", body[:20])
+    data = body[20:20 + length * format_ // 8]
+    with lock:
+        properties[(window, atom)] = (type_, format_, data)
+        receivers = [c for c in clients if c.event_masks.get(window, 0) & PROPERTY_CHANGE_MASK]
+    for client in receivers:
+        event = struct.pack("<BxHIIIB15x", PROPERTY_NOTIFY, client.sequence, window, atom, int(time.monotonic() * 1000) & 0xffffffff, 0)
+        try:
+            client.send(event)
+        except OSError:
+            pass
+
+
+def get_property(body, sequence):
+    window, atom, type_, offset, length = struct.unpack("<IIIII", body[:20])
+    with lock:
+        value = properties.get((window, atom))
+    if get_property_delay > 0:
+        time.sleep(get_property_delay)
+    if value is None or (type_ != 0 and type_ != value[0]):
+        return struct.pack("<BBHIIII12x", 1, 0, sequence, 0, 0, 0, 0)
+    actual_type, format_, data = value
+    data = data[offset * 4:(offset + length) * 4]
+    padded = data + b"\0" * pad(len(data))
+    return struct.pack("<BBHIIII12x", 1, format_, sequence, len(padded) // 4, actual_type, 0, len(data) * 8 // format_) + padded
+
+
+def serve(connection):
+    client = Client(connection)
+    try:
+        header = receive(connection, 12)
+        name_length, data_length = struct.unpack("<HH", header[6:10])
+        receive(connection, name_length + pad(name_length) + data_length + pad(data_length))
+        client.send(setup_reply())
+        with lock:
+            clients.append(client)
+        while True:
+            opcode, _, length = struct.unpack("<BBH", receive(connection, 4))
+            body = receive(connection, length * 4 - 4)
+            client.sequence = (client.sequence + 1) & 0xffff
+            reply = None
+            if opcode == 2:  # ChangeWindowAttributes
+                window, value_mask = struct.unpack("<II", body[:8])
+                if value_mask & 0x800:  # CWEventMask, the only value that is read
+                    offset = 8 + 4 * bin(value_mask & 0x7ff).count("1")
+                    client.event_masks[window] = struct.unpack("<I", body[offset:offset + 4])[0]
+            elif opcode == 16:  # InternAtom
+                name_length = struct.unpack("<H", body[:2])[0]
+                reply = struct.pack("<BxHII20x", 1, client.sequence, 0, intern_atom(body[4:4 + name_length].decode()))
+            elif opcode == 18:  # ChangeProperty
+                change_property(body)
+            elif opcode == 20:  # GetProperty
+                reply = get_property(body, client.sequence)
+            elif opcode == 43:  # GetInputFocus
+                reply = struct.pack("<BBHII20x", 1, 0, client.sequence, 0, ROOT)
+            elif opcode == 98:  # QueryExtension
+                reply = struct.pack("<BxHIBBBB20x", 1, client.sequence, 0, 0, 0, 0, 0)
+            if reply is not None:
+                client.send(reply)
+    except (EOFError, OSError):
+        pass
+    with lock:
+        if client in clients:
+            clients.remove(client)
+    connection.close()
+
+
+os.makedirs("/tmp/.X11-unix", exist_ok=True)
+path = "/tmp/.X11-unix/X" + display_number
+if os.path.exists(path):
+    os.unlink(path)
+server = socket.socket(socket.AF_UNIX)
+server.bind(path)
+server.listen(8)
+try:
+    while True:
+        connection, _ = server.accept()
+        threading.Thread(target=serve, args=(connection,), daemon=True).start()
+finally:
+    os.unlink(path)
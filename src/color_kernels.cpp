@@ -0,0 +1,222 @@
+#include "color_kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GZ_RGB_X86
+#include <immintrin.h>
+#endif
+
+namespace rgb {
+    //
+    // SCALAR
+    //
+    static void blendScalar(const uint8_t* from, const uint8_t* to, uint8_t* out, size_t size, uint16_t weight) {
+        const unsigned int fromWeight = BLEND_WEIGHT_MAX - weight;
+        for (size_t i = 0; i < size; i++) {
+            out[i] = static_cast<uint8_t>((from[i] * fromWeight + to[i] * weight + 128) >> 8);
+        }
+    }
+
+
+    static inline uint8_t scaleChannel(uint8_t c, uint8_t brightness) {
+        // exact round(c * brightness / 255) without a division
+        unsigned int t = c * brightness + 128;
+        return static_cast<uint8_t>((t + (t >> 8)) >> 8);
+    }
+
+
+    static void scaleBrightnessScalar(const uint8_t* colors, uint8_t* out, size_t size, uint8_t brightness) {
+        for (size_t i = 0; i < size; i++) {
+            out[i] = scaleChannel(colors[i], brightness);
+        }
+    }
+
+
+#ifdef GZ_RGB_X86
+    //
+    // SSE2
+    //
+    static void blendSSE2(const uint8_t* from, const uint8_t* to, uint8_t* out, size_t size, uint16_t weight) {
+        // 255 * 256 + 128 still fits in 16 bits
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i fw = _mm_set1_epi16(static_cast<short>(BLEND_WEIGHT_MAX - weight));
+        const __m128i tw = _mm_set1_epi16(static_cast<short>(weight));
+        const __m128i half = _mm_set1_epi16(128);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from + i));
+            __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(to + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(f, zero), fw), _mm_mullo_epi16(_mm_unpacklo_epi8(t, zero), tw));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(f, zero), fw), _mm_mullo_epi16(_mm_unpackhi_epi8(t, zero), tw));
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+        }
+        blendScalar(from + i, to + i, out + i, size - i, weight);
+    }
+
+
+    static void scaleBrightnessSSE2(const uint8_t* colors, uint8_t* out, size_t size, uint8_t brightness) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i b = _mm_set1_epi16(brightness);
+        const __m128i half = _mm_set1_epi16(128);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), b), half);
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), b), half);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+        }
+        scaleBrightnessScalar(colors + i, out + i, size - i, brightness);
+    }
+
+
+    //
+    // AVX2
+    //
+    __attribute__((target("avx2")))
+    static void blendAVX2(const uint8_t* from, const uint8_t* to, uint8_t* out, size_t size, uint16_t weight) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i fw = _mm256_set1_epi16(static_cast<short>(BLEND_WEIGHT_MAX - weight));
+        const __m256i tw = _mm256_set1_epi16(static_cast<short>(weight));
+        const __m256i half = _mm256_set1_epi16(128);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(from + i));
+            __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(to + i));
+            __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(f, zero), fw), _mm256_mullo_epi16(_mm256_unpacklo_epi8(t, zero), tw));
+            __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(f, zero), fw), _mm256_mullo_epi16(_mm256_unpackhi_epi8(t, zero), tw));
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, half), 8);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, half), 8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_packus_epi16(lo, hi));
+        }
+        // the tail is a tail call into legacy SSE code, which gcc does not clear the upper halves for
+        _mm256_zeroupper();
+        blendSSE2(from + i, to + i, out + i, size - i, weight);
+    }
+
+
+    __attribute__((target("avx2")))
+    static void scaleBrightnessAVX2(const uint8_t* colors, uint8_t* out, size_t size, uint8_t brightness) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i b = _mm256_set1_epi16(brightness);
+        const __m256i half = _mm256_set1_epi16(128);
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + i));
+            // unpack and pack both work within 128 bit lanes, so the byte order is preserved
+            __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero), b), half);
+            __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(c, zero), b), half);
+            lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+            hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_packus_epi16(lo, hi));
+        }
+        _mm256_zeroupper();
+        scaleBrightnessSSE2(colors + i, out + i, size - i, brightness);
+    }
+#endif
+
+
+    //
+    // DISPATCH
+    //
+    struct ColorKernels {
+        void (*blend)(const uint8_t*, const uint8_t*, uint8_t*, size_t, uint16_t);
+        void (*scaleBrightness)(const uint8_t*, uint8_t*, size_t, uint8_t);
+        const char* name;
+    };
+
+
+    static ColorKernels selectColorKernels() {
+#ifdef GZ_RGB_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return { blendAVX2, scaleBrightnessAVX2, "avx2" };
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return { blendSSE2, scaleBrightnessSSE2, "sse2" };
+        }
+#endif
+        return { blendScalar, scaleBrightnessScalar, "scalar" };
+    }
+
+
+    static const ColorKernels& getColorKernels() {
+        static const ColorKernels kernels = selectColorKernels();
+        return kernels;
+    }
+
+
+    static inline uint8_t* bytes(orgb::Color* colors) { return reinterpret_cast<uint8_t*>(colors); }
+    static inline const uint8_t* bytes(const orgb::Color* colors) { return reinterpret_cast<const uint8_t*>(colors); }
+
+
+    void blendColors(std::span<const orgb::Color> from, std::span<const orgb::Color> to, std::span<orgb::Color> out, uint16_t weight) {
+        getColorKernels().blend(bytes(from.data()), bytes(to.data()), bytes(out.data()), out.size_bytes(), std::min(weight, BLEND_WEIGHT_MAX));
+    }
+
+
+    static float srgbToLinear(float c) {
+        return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+
+    static float linearToSrgb(float c) {
+        return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1 / 2.4f) - 0.055f;
+    }
+
+
+    /// sRGB <-> linear light with LINEAR_LIGHT_BITS of precision
+    struct GammaTables {
+        std::array<uint16_t, 256> toLinear;
+        std::array<uint8_t, 1 << LINEAR_LIGHT_BITS> fromLinear;
+        GammaTables() {
+            const float linearMax = fromLinear.size() - 1;
+            for (size_t i = 0; i < toLinear.size(); i++) {
+                toLinear[i] = static_cast<uint16_t>(std::lround(srgbToLinear(i / 255.0f) * linearMax));
+            }
+            for (size_t i = 0; i < fromLinear.size(); i++) {
+                fromLinear[i] = static_cast<uint8_t>(std::lround(linearToSrgb(i / linearMax) * 255));
+            }
+        }
+    };
+
+
+    void blendColorsLinearLight(std::span<const orgb::Color> from, std::span<const orgb::Color> to, std::span<orgb::Color> out, uint16_t weight) {
+        // table lookups, scalar
+        static const GammaTables tables;
+        weight = std::min(weight, BLEND_WEIGHT_MAX);
+        const unsigned int fromWeight = BLEND_WEIGHT_MAX - weight;
+        const uint8_t* f = bytes(from.data());
+        const uint8_t* t = bytes(to.data());
+        uint8_t* o = bytes(out.data());
+        for (size_t i = 0; i < out.size_bytes(); i++) {
+            unsigned int linear = (tables.toLinear[f[i]] * fromWeight + tables.toLinear[t[i]] * weight + 128) >> 8;
+            o[i] = tables.fromLinear[linear];
+        }
+    }
+
+
+    void scaleBrightness(std::span<const orgb::Color> colors, std::span<orgb::Color> out, uint8_t brightness) {
+        getColorKernels().scaleBrightness(bytes(colors.data()), bytes(out.data()), colors.size_bytes(), brightness);
+    }
+
+
+    void fillFromPalette(std::span<orgb::Color> colors, const HuePalette& palette, uint8_t phase, int spread) {
+        // a table lookup per led, 3 byte entries do not gather well
+        unsigned int idx = phase;
+        for (orgb::Color& color : colors) {
+            color = palette[idx & 0xff];
+            idx += spread;
+        }
+    }
+
+
+    const char* getColorKernelsName() {
+        return getColorKernels().name;
+    }
+}
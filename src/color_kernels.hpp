@@ -0,0 +1,50 @@
+#pragma once
+
+#include "OpenRGB/Color.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace rgb {
+    static_assert(sizeof(orgb::Color) == 3, "color kernels treat color buffers as packed rgb bytes");
+
+    /// 256 colors, indexed by a hue phase
+    using HuePalette = std::array<orgb::Color, 256>;
+
+    /// Weight at which blendColors() returns the target colors
+    const uint16_t BLEND_WEIGHT_MAX = 256;
+    /// Precision of the linear light values in blendColorsLinearLight(), enough to decode and encode every 8 bit value exactly
+    const int LINEAR_LIGHT_BITS = 14;
+
+    /**
+     * @brief out = from + (to - from) * weight / BLEND_WEIGHT_MAX for every channel, rounded
+     * @details
+     *  from, to and out must have the same size, out may be the same buffer as from or to.
+     */
+    void blendColors(std::span<const orgb::Color> from, std::span<const orgb::Color> to, std::span<orgb::Color> out, uint16_t weight);
+
+    /**
+     * @brief Like blendColors(), but blends in linear light
+     * @details
+     *  The channels are decoded with the sRGB transfer function before and encoded again after blending,
+     *  so that a fade changes the perceived brightness evenly.
+     */
+    void blendColorsLinearLight(std::span<const orgb::Color> from, std::span<const orgb::Color> to, std::span<orgb::Color> out, uint16_t weight);
+
+    /**
+     * @brief out = colors * brightness / 255, rounded
+     * @details
+     *  colors and out must have the same size, they may be the same buffer.
+     */
+    void scaleBrightness(std::span<const orgb::Color> colors, std::span<orgb::Color> out, uint8_t brightness);
+
+    /**
+     * @brief colors[i] = palette[(phase + i * spread) % 256]
+     */
+    void fillFromPalette(std::span<orgb::Color> colors, const HuePalette& palette, uint8_t phase, int spread);
+
+    /// @returns the instruction set the kernels use on this cpu: "avx2", "sse2" or "scalar"
+    const char* getColorKernelsName();
+}
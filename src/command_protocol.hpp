@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Protocol of the command socket
+ * @details
+ *  The socket is a SOCK_SEQPACKET unix socket, so every request and response is one message.
+ *  - Request: the command as string, eg "rainbow", "colorHexff0000" or a RGBSetting like "Motherboard,DRAM|FADE|STATIC|#ff0000|500|GAMMA"
+ *  - Response: one Status byte followed by the resulting setting (on OK) or an error message
+ *  A client can send any number of requests over one connection.
+ *  A request that is longer than MAX_MESSAGE_SIZE is answered with an error.
+ *  The server closes the connection if the client does not read the responses.
+ */
+namespace rgb::protocol {
+    /// Only writable by root, created by systemd (RuntimeDirectory) or the daemon
+    const std::string SOCKET_DIR = "/run/gz-rgb";
+    const std::string SOCKET_PATH = SOCKET_DIR + "/command.sock";
+    /// Members of this group can use the socket (mode 0660), otherwise only root
+    const std::string SOCKET_GROUP = "gz-rgb";
+    /// Maximum size of a request or response, the response includes the status byte
+    const size_t MAX_MESSAGE_SIZE = 1024;
+    /// Maximum number of simultaneously connected clients
+    const int MAX_CLIENTS = 16;
+
+    enum Status : uint8_t {
+        OK = 0, ERROR = 1,
+    };
+
+    struct Response {
+        Status status;
+        std::string message;
+    };
+}
@@ -0,0 +1,165 @@
+#include "command_queue.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace rgb {
+    CommandQueue::CommandQueue()
+        // on a single cpu, spinning only delays the producer
+        : spinCount(std::thread::hardware_concurrency() > 1 ? COMMAND_QUEUE_SPIN_COUNT : 0)
+    {
+        wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        spaceFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wakeupFd < 0 or spaceFd < 0) {
+            int error = errno;
+            if (wakeupFd >= 0) { close(wakeupFd); }
+            throw std::system_error(error, std::generic_category(), "eventfd");
+        }
+    }
+
+
+    CommandQueue::~CommandQueue() {
+        close(wakeupFd);
+        close(spaceFd);
+    }
+
+
+    bool CommandQueue::tryPush(const RGBCommand& command) {
+        if (!ring.tryPush(command)) { return false; }
+        wakeConsumer();
+        return true;
+    }
+
+
+    bool CommandQueue::push(const RGBCommand& command) {
+        if (tryPush(command)) { return true; }
+        droppedCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+
+    bool CommandQueue::waitPush(const RGBCommand& command, std::chrono::milliseconds timeout) {
+        const auto giveUpAt = std::chrono::steady_clock::now() + timeout;
+        while (!tryPush(command)) {
+            auto remaining = std::chrono::ceil<std::chrono::milliseconds>(giveUpAt - std::chrono::steady_clock::now());
+            if (remaining <= std::chrono::milliseconds::zero()) {
+                droppedCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // same handshake as wait(), with the roles swapped
+            producerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const bool pushed = tryPush(command);
+            if (!pushed) {
+                pollfd pfd { .fd = spaceFd, .events = POLLIN, .revents = 0 };
+                poll(&pfd, 1, static_cast<int>(remaining.count()));
+            }
+            producerWaiting.store(false, std::memory_order_relaxed);
+            if (pushed) { return true; }
+            uint64_t count;
+            read(spaceFd, &count, sizeof(count));
+        }
+        return true;
+    }
+
+
+    void CommandQueue::interrupt() {
+        interrupted.store(true, std::memory_order_relaxed);
+        wakeConsumer();
+    }
+
+
+    void CommandQueue::wakeConsumer() {
+        // pairs with the fence in wait(): either the consumer sees the new command (or the interrupt)
+        // or we see that it is waiting
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumerWaiting.load(std::memory_order_relaxed)) {
+            uint64_t one = 1;
+            write(wakeupFd, &one, sizeof(one));
+        }
+    }
+
+
+    void CommandQueue::wakeProducer() {
+        // pairs with the fence in waitPush()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producerWaiting.load(std::memory_order_relaxed)) {
+            uint64_t one = 1;
+            write(spaceFd, &one, sizeof(one));
+        }
+    }
+
+
+    void CommandQueue::wait() {
+        // commands often arrive in bursts, spinning briefly avoids a syscall on both sides
+        for (unsigned int i = 0; i < spinCount; i++) {
+            if (!ring.empty() or interrupted.load(std::memory_order_relaxed)) { return; }
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        consumerWaiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.empty() and !interrupted.load(std::memory_order_relaxed)) {
+            pollfd pfd { .fd = wakeupFd, .events = POLLIN, .revents = 0 };
+            poll(&pfd, 1, -1);
+        }
+        consumerWaiting.store(false, std::memory_order_relaxed);
+        // reset the counter, wakeups for commands that were already popped are harmless
+        uint64_t count;
+        read(wakeupFd, &count, sizeof(count));
+    }
+
+
+    size_t coalesceCommands(std::vector<RGBCommand>& commands) {
+        // walk backwards: covered holds all device types that a later setting overwrites
+        DeviceTypeMask covered;
+        for (auto it = commands.rbegin(); it != commands.rend(); it++) {
+            if (it->type != RGBCommandType::CHANGE_SETTING) { continue; }
+            DeviceTypeMask targetDevices = it->setting.targetDevices;
+            it->setting.targetDevices = targetDevices.without(covered);
+            covered |= targetDevices;
+        }
+        auto superseded = std::remove_if(commands.begin(), commands.end(), [](const RGBCommand& command) {
+            return command.type == RGBCommandType::CHANGE_SETTING and command.setting.targetDevices.empty();
+        });
+        size_t removed = std::distance(superseded, commands.end());
+        commands.erase(superseded, commands.end());
+        return removed;
+    }
+
+
+    bool CommandQueue::tryPop(RGBCommand& command) {
+        if (!ring.tryPop(command)) { return false; }
+        wakeProducer();
+        return true;
+    }
+
+
+    size_t CommandQueue::popAll(std::vector<RGBCommand>& commands) {
+        size_t count = 0;
+        RGBCommand command;
+        while (ring.tryPop(command)) {
+            commands.push_back(command);
+            count++;
+        }
+        if (count > 0) { wakeProducer(); }
+        return count;
+    }
+
+
+    bool CommandQueue::waitPop(RGBCommand& command) {
+        while (!ring.tryPop(command)) {
+            if (interrupted.exchange(false, std::memory_order_relaxed)) { return false; }
+            wait();
+        }
+        wakeProducer();
+        return true;
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "rgb_command.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace rgb {
+    /// Number of commands the CommandQueue can hold, must be a power of two
+    constexpr size_t COMMAND_QUEUE_CAPACITY = 64;
+    /// How often the consumer checks for new commands before sleeping on the eventfd
+    constexpr unsigned int COMMAND_QUEUE_SPIN_COUNT = 256;
+    /// Size of a cache line, used to keep the producer and consumer indices apart
+    constexpr size_t CACHE_LINE_SIZE = 64;
+
+    /**
+     * @brief Bounded, wait-free single-producer/single-consumer ring buffer
+     * @details
+     *  tryPush may only be called from one thread and tryPop only from one (other) thread.
+     *  The indices count up and are masked when accessing the buffer, so that a full ring
+     *  can be distinguished from an empty one without wasting a slot.
+     */
+    template<typename T, size_t Capacity>
+    class SPSCRing {
+        static_assert(std::is_trivially_copyable_v<T>, "SPSCRing elements must be trivially copyable");
+        static_assert(Capacity > 0 and (Capacity & (Capacity - 1)) == 0, "SPSCRing capacity must be a power of two");
+        public:
+            /**
+             * @returns false if the ring is full
+             */
+            bool tryPush(const T& value) {
+                const size_t t = tail.load(std::memory_order_relaxed);
+                if (t - cachedHead == Capacity) {
+                    cachedHead = head.load(std::memory_order_acquire);
+                    if (t - cachedHead == Capacity) { return false; }
+                }
+                buffer[t & (Capacity - 1)] = value;
+                tail.store(t + 1, std::memory_order_release);
+                return true;
+            }
+            /**
+             * @returns false if the ring is empty
+             */
+            bool tryPop(T& value) {
+                const size_t h = head.load(std::memory_order_relaxed);
+                if (h == cachedTail) {
+                    cachedTail = tail.load(std::memory_order_acquire);
+                    if (h == cachedTail) { return false; }
+                }
+                value = buffer[h & (Capacity - 1)];
+                head.store(h + 1, std::memory_order_release);
+                return true;
+            }
+            /// Only exact when called from the consumer
+            bool empty() const {
+                return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+            }
+            static constexpr size_t capacity() { return Capacity; }
+
+        private:
+            // written by the consumer
+            alignas(CACHE_LINE_SIZE) std::atomic<size_t> head = 0;
+            size_t cachedTail = 0;
+            // written by the producer
+            alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail = 0;
+            size_t cachedHead = 0;
+            alignas(CACHE_LINE_SIZE) std::array<T, Capacity> buffer;
+    };
+
+
+    /**
+     * @brief Remove the parts of CHANGE_SETTING commands that are superseded by later commands
+     * @details
+     *  For every device type, only the latest CHANGE_SETTING that targets it is kept:
+     *  earlier settings lose that type from their targetDevices and are removed when none are left.
+     *  All other command types are kept in their original order.
+     * @returns the number of removed commands
+     */
+    size_t coalesceCommands(std::vector<RGBCommand>& commands);
+
+
+    /**
+     * @brief Queue for RGBCommands from the main thread to the rgb controller thread
+     * @details
+     *  The main thread is the only producer and the controller thread the only consumer.
+     *  Commands are passed through a SPSCRing, the consumer sleeps on an eventfd when the ring is empty.
+     *  The producer only writes to the eventfd when the consumer announced that it is going to sleep,
+     *  so pushing a command while the controller is animating does not cost a syscall.
+     *  The same is done in the other direction for a producer that waits for space in waitPush().
+     *  Other threads can wake the consumer without a command with interrupt().
+     */
+    class CommandQueue {
+        public:
+            CommandQueue();
+            ~CommandQueue();
+            CommandQueue(const CommandQueue&) = delete;
+            CommandQueue& operator=(const CommandQueue&) = delete;
+            /**
+             * @brief Add a command without blocking
+             * @returns false if the queue is full
+             */
+            bool tryPush(const RGBCommand& command);
+            /**
+             * @brief Add a command without blocking, a full queue drops it
+             * @returns false if the queue is full and the command was dropped (counted in getDroppedCount())
+             */
+            bool push(const RGBCommand& command);
+            /**
+             * @brief Add a command, block on an eventfd until the consumer makes space if the queue is full
+             * @returns false if the queue stayed full for timeout and the command was dropped (counted in getDroppedCount())
+             */
+            bool waitPush(const RGBCommand& command, std::chrono::milliseconds timeout);
+            /**
+             * @brief Get the next command without blocking
+             * @returns false if the queue is empty
+             */
+            bool tryPop(RGBCommand& command);
+            /**
+             * @brief Append all available commands to commands without blocking
+             * @returns the number of commands appended
+             */
+            size_t popAll(std::vector<RGBCommand>& commands);
+            /**
+             * @brief Block until a command is available or the queue is interrupted
+             * @returns false if interrupted
+             */
+            bool waitPop(RGBCommand& command);
+            /**
+             * @brief Make the current or next waitPop() return false
+             * @details
+             *  May be called from any thread, eg. to make the consumer check for other events.
+             */
+            void interrupt();
+            /// Number of commands that were dropped because the queue was full
+            uint64_t getDroppedCount() const { return droppedCount.load(std::memory_order_relaxed); }
+
+        private:
+            /// Wait until the eventfd is signaled
+            void wait();
+            void wakeConsumer();
+            void wakeProducer();
+            SPSCRing<RGBCommand, COMMAND_QUEUE_CAPACITY> ring;
+            alignas(CACHE_LINE_SIZE) std::atomic<bool> consumerWaiting = false;
+            std::atomic<bool> producerWaiting = false;
+            std::atomic<bool> interrupted = false;
+            std::atomic<uint64_t> droppedCount = 0;
+            unsigned int spinCount;
+            int wakeupFd;
+            /// written by the consumer when a waiting producer can push again
+            int spaceFd;
+    };
+}
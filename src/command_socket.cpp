@@ -0,0 +1,118 @@
+#include "command_socket.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <cerrno>
+#include <cstring>
+
+#include <grp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern gz::Log rgblog;
+
+namespace rgb {
+    CommandSocket::CommandSocket(EventLoop& eventLoop, RequestHandler handler) : eventLoop(eventLoop), handler(std::move(handler)) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, protocol::SOCKET_PATH.c_str(), sizeof(address.sun_path) - 1);
+
+        if (mkdir(protocol::SOCKET_DIR.c_str(), 0755) < 0 and errno != EEXIST) {
+            rgblog.error("Command Socket: Could not create " + protocol::SOCKET_DIR + ": '" + std::string(std::strerror(errno)) + "'");
+            return;
+        }
+        listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd >= 0) {
+            // remove socket of a previous instance
+            unlink(protocol::SOCKET_PATH.c_str());
+            if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or listen(listenFd, protocol::MAX_CLIENTS) < 0) {
+                close(listenFd);
+                listenFd = -1;
+            }
+        }
+        if (listenFd < 0) {
+            rgblog.error("Command Socket: Could not create " + protocol::SOCKET_PATH + ": '" + std::string(std::strerror(errno)) + "'");
+            return;
+        }
+        // only root can write to SOCKET_DIR, so the path can not be replaced between bind() and chmod()
+        const group* socketGroup = getgrnam(protocol::SOCKET_GROUP.c_str());
+        if (socketGroup == nullptr or chown(protocol::SOCKET_PATH.c_str(), -1, socketGroup->gr_gid) < 0) {
+            rgblog.warning("Command Socket: Group " + protocol::SOCKET_GROUP + " does not exist, only root can use " + protocol::SOCKET_PATH);
+        }
+        chmod(protocol::SOCKET_PATH.c_str(), 0660);
+        eventLoop.add(listenFd, [this]() { acceptClients(); });
+    }
+
+
+    CommandSocket::~CommandSocket() {
+        for (int clientFd : clients) {
+            eventLoop.remove(clientFd);
+            close(clientFd);
+        }
+        if (listenFd >= 0) {
+            eventLoop.remove(listenFd);
+            close(listenFd);
+            unlink(protocol::SOCKET_PATH.c_str());
+        }
+    }
+
+
+    void CommandSocket::acceptClients() {
+        int clientFd;
+        while ((clientFd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            if (clients.size() >= protocol::MAX_CLIENTS) {
+                rgblog.warning("Command Socket: Too many clients, rejecting connection");
+                close(clientFd);
+                continue;
+            }
+            clients.insert(clientFd);
+            eventLoop.add(clientFd, [this, clientFd]() { handleClient(clientFd); });
+        }
+    }
+
+
+    void CommandSocket::handleClient(int clientFd) {
+        char buffer[protocol::MAX_MESSAGE_SIZE];
+        while (true) {
+            // with MSG_TRUNC, the length of the whole message is returned even if it did not fit
+            ssize_t length = recv(clientFd, buffer, sizeof(buffer), MSG_TRUNC);
+            if (length < 0 and errno == EINTR) { continue; }
+            if (length < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) { return; }
+            if (length <= 0) {
+                // disconnected
+                closeClient(clientFd);
+                return;
+            }
+
+            protocol::Response response;
+            if (static_cast<size_t>(length) > sizeof(buffer)) {
+                rgblog.warning("Command Socket: Rejecting a request of", length, "bytes");
+                response = { protocol::ERROR, "Request too long, the maximum is " + std::to_string(protocol::MAX_MESSAGE_SIZE) + " bytes" };
+            }
+            else {
+                response = handler(std::string(buffer, length));
+            }
+            response.message.insert(response.message.begin(), static_cast<char>(response.status));
+            if (response.message.size() > protocol::MAX_MESSAGE_SIZE) {
+                response.message.resize(protocol::MAX_MESSAGE_SIZE);
+            }
+            if (send(clientFd, response.message.data(), response.message.size(), MSG_NOSIGNAL) < 0) {
+                // EAGAIN: the client does not read the responses, dropping one would mix up the following ones
+                if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                    rgblog.error("Command Socket: Client does not read the responses, closing the connection");
+                }
+                closeClient(clientFd);
+                return;
+            }
+        }
+    }
+
+
+    void CommandSocket::closeClient(int clientFd) {
+        eventLoop.remove(clientFd);
+        clients.erase(clientFd);
+        close(clientFd);
+    }
+}
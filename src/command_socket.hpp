@@ -0,0 +1,41 @@
+#pragma once
+
+#include "command_protocol.hpp"
+#include "event_loop.hpp"
+
+#include <functional>
+#include <set>
+#include <string>
+
+namespace rgb {
+    /**
+     * @brief Server side of the command socket, see rgb::protocol
+     * @details
+     *  Listens on protocol::SOCKET_PATH and handles all requests in the event loop.
+     */
+    class CommandSocket {
+        public:
+            using RequestHandler = std::function<protocol::Response(const std::string& request)>;
+            /**
+             * @brief Create the socket and register it in eventLoop
+             * @details
+             *  Creates protocol::SOCKET_DIR if it does not exist. The socket gets the mode 0660 and protocol::SOCKET_GROUP,
+             *  if that group exists.
+             *  Logs an error and stays inactive if the socket can not be created.
+             */
+            CommandSocket(EventLoop& eventLoop, RequestHandler handler);
+            ~CommandSocket();
+            CommandSocket(const CommandSocket&) = delete;
+            CommandSocket& operator=(const CommandSocket&) = delete;
+            bool isListening() const { return listenFd >= 0; }
+
+        private:
+            EventLoop& eventLoop;
+            RequestHandler handler;
+            int listenFd = -1;
+            std::set<int> clients;
+            void acceptClients();
+            void handleClient(int clientFd);
+            void closeClient(int clientFd);
+    };
+}
@@ -0,0 +1,127 @@
+#include "config.hpp"
+
+#include "process_rules.hpp"
+
+#include <gz-util/exceptions.hpp>
+#include <gz-util/file_io.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace rgb {
+    std::vector<std::string> Config::getProcessNames() const {
+        std::vector<std::string> names;
+        for (const auto& [name, setting] : processSettings) {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+
+    uint8_t brightnessFromPercent(int percent) {
+        return static_cast<uint8_t>((std::clamp(percent, 0, 100) * 255 + 50) / 100);
+    }
+
+
+    std::shared_ptr<const Config> loadConfig(const std::string& path, const Config& defaults, std::vector<std::string>& errors) {
+        auto entries = gz::readKeyValueFile<std::vector<std::pair<std::string, std::string>>>(path);
+        auto config = std::make_shared<Config>(defaults);
+        config->processSettings.clear();
+        config->scheduledSettings.clear();
+        // the schedule is built when all of its keys are known
+        std::vector<TimeWindow> windows = defaults.schedule.getWindows();
+        std::vector<ScheduleTime> settingTimes;
+        const std::chrono::time_zone* zone = defaults.schedule.getTimeZone();
+        for (const auto& [key, value] : entries) {
+            try {
+                if (key == "clearSetting") {
+                    config->clearSetting = fromString<RGBSetting>(value);
+                }
+                else if (key == "idleSetting") {
+                    config->idleSetting = fromString<RGBSetting>(value);
+                }
+                else if (key == "brightness") {
+                    int percent;
+                    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), percent);
+                    if (ec != std::errc() or end != value.data() + value.size()) {
+                        throw gz::InvalidArgument("Not a number: '" + value + "'", "loadConfig");
+                    }
+                    config->brightness = brightnessFromPercent(percent);
+                }
+                else if (key == "servers") {
+                    config->servers = parseServerAddresses(value);
+                }
+                else if (key == "focus") {
+                    config->focus = parseFocusSource(value);
+                }
+                else if (key == "schedule") {
+                    windows = parseTimeWindows(value);
+                }
+                else if (key == "timezone") {
+                    zone = getTimeZone(value);
+                }
+                else if (key.starts_with(SCHEDULED_SETTING_PREFIX)) {
+                    ScheduleTime time = parseScheduleTime(key.substr(SCHEDULED_SETTING_PREFIX.size()));
+                    config->scheduledSettings.push_back(fromString<RGBSetting>(value));
+                    settingTimes.push_back(time);
+                }
+                else {
+                    parseProcessRule(key);
+                    config->processSettings.emplace_back(key, fromString<RGBSetting>(value));
+                }
+            }
+            catch (gz::InvalidArgument& e) {
+                errors.push_back("Invalid setting '" + key + " = " + value + "': " + e.what());
+            }
+        }
+        config->schedule = Schedule(windows, settingTimes, zone);
+        return config;
+    }
+
+
+    //
+    // ConfigWatcher
+    //
+    ConfigWatcher::ConfigWatcher(const std::string& path) {
+        std::filesystem::path file(path);
+        filename = file.filename().string();
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        // IN_MOVED_TO: editors that write a copy and rename it, IN_CLOSE_WRITE: editors that write in place
+        if (inotifyFd >= 0 and inotify_add_watch(inotifyFd, file.parent_path().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+    }
+
+
+    ConfigWatcher::~ConfigWatcher() {
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+        }
+    }
+
+
+    bool ConfigWatcher::fileChanged() {
+        if (inotifyFd < 0) { return false; }
+        bool changed = false;
+        alignas(inotify_event) char buffer[sizeof(inotify_event) + NAME_MAX + 1];
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t offset = 0; offset < length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                offset += sizeof(inotify_event) + event->len;
+                if (event->mask & IN_Q_OVERFLOW or (event->len > 0 and filename == event->name)) {
+                    changed = true;
+                }
+            }
+        }
+        return changed;
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "focus_watcher.hpp"
+#include "rgb_command.hpp"
+#include "schedule.hpp"
+#include "server_connection.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rgb {
+    /// Prefix of the keys of scheduled settings, followed by a ScheduleTime, eg. "at:Fri,Sat 23:30"
+    const std::string SCHEDULED_SETTING_PREFIX = "at:";
+
+    /**
+     * @brief The settings from the config file
+     * @details
+     *  A Config is not changed after it was loaded. The App publishes the current one as std::shared_ptr<const Config>,
+     *  a reload swaps in a new one while the threads that still use the old one keep it alive until they load the next.
+     */
+    struct Config {
+        /// when the time window ended
+        RGBSetting clearSetting;
+        /// when none of the processes are running
+        RGBSetting idleSetting;
+        /// when process watching is enabled and when the scheduledSettings replace the idleSetting
+        Schedule schedule;
+        /// in the order of schedule.getSettingTimes()
+        std::vector<RGBSetting> scheduledSettings;
+        /// of all leds, 255 is full brightness
+        uint8_t brightness = 255;
+        std::vector<ServerAddress> servers;
+        /// follow the focused window instead of all running processes, see FocusWatcher
+        FocusSource focus;
+        /// process names and their settings, the index is the priority
+        std::vector<std::pair<std::string, RGBSetting>> processSettings;
+        /// @returns the process names in the order of processSettings
+        std::vector<std::string> getProcessNames() const;
+    };
+
+    /// @returns percent (clamped to 0-100) scaled to 0-255
+    uint8_t brightnessFromPercent(int percent);
+
+    /**
+     * @brief Read and validate the config file
+     * @param defaults Values for the keys that are not in the file
+     * @param errors Set to a message for each invalid entry. Invalid keys keep the default, invalid process and scheduled settings are skipped
+     * @throws gz::FileIOError if the file can not be read
+     */
+    std::shared_ptr<const Config> loadConfig(const std::string& path, const Config& defaults, std::vector<std::string>& errors);
+
+
+    /**
+     * @brief Notices when the config file is written or replaced
+     * @details
+     *  Watches the directory of the file with inotify, so that editors that replace the file (write a copy and rename it) are noticed as well.
+     */
+    class ConfigWatcher {
+        public:
+            ConfigWatcher(const std::string& path);
+            ~ConfigWatcher();
+            ConfigWatcher(const ConfigWatcher&) = delete;
+            ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+            /**
+             * @brief Read all pending events, does not block
+             * @returns true if the config file was changed
+             */
+            bool fileChanged();
+            /// @returns the inotify fd or -1 if the file can not be watched
+            int getFd() const { return inotifyFd; }
+
+        private:
+            std::string filename;
+            int inotifyFd = -1;
+    };
+}
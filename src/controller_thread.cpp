@@ -0,0 +1,159 @@
+#include "controller_thread.hpp"
+
+#include "main.hpp"
+#include "rgb_controller.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <ctime>
+#include <system_error>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace rgb {
+    // 
+    // RGB THREAD
+    //
+    /**
+     * @brief Sleep until time with clock_nanosleep(TIMER_ABSTIME)
+     */
+    static void sleepUntil(std::chrono::steady_clock::time_point time) {
+        auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch());
+        timespec deadline;
+        deadline.tv_sec = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch).count();
+        deadline.tv_nsec = (sinceEpoch - std::chrono::seconds(deadline.tv_sec)).count();
+        // steady_clock is CLOCK_MONOTONIC
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR);
+    }
+
+
+    ControllerThread::ControllerThread(const std::atomic<std::shared_ptr<const Config>>* config)
+        : config(config), exitFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), suspendFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        if (exitFd < 0 or suspendFd < 0) {
+            throw std::system_error(errno, std::generic_category(), "eventfd");
+        }
+        thread = std::thread(&ControllerThread::run, this);
+    }
+
+
+    ControllerThread::~ControllerThread() {
+        if (thread.joinable()) { quit(); }
+        close(exitFd);
+        close(suspendFd);
+    }
+
+
+    void ControllerThread::stop(const RGBSetting& clearSetting) {
+        if (!thread.joinable()) { return; }
+        if (!q.waitPush(RGBCommand{ RGBCommandType::CHANGE_SETTING, clearSetting }, commandQueuePushTimeout)) {
+            rgblog.error("Command queue is full, the lights are not turned off.");
+        }
+        quit();
+    }
+
+
+    void ControllerThread::quit() {
+        if (q.waitPush(RGBCommand{ RGBCommandType::QUIT, idleSetting }, commandQueuePushTimeout)) {
+            thread.join();
+        }
+        else {
+            // joining would block forever, the process is exiting anyway
+            rgblog.error("Command queue is full, the rgb controller thread is stuck and can not be stopped.");
+            thread.detach();
+        }
+    }
+
+
+    void ControllerThread::run() {
+        auto notifyExit = [this](int code) {
+            returnCode = code;
+            uint64_t one = 1;
+            write(exitFd, &one, sizeof(one));
+        };
+        bool running = true;
+        // changed servers are only used after a restart
+        std::shared_ptr<const Config> currentConfig = config->load();
+        RGBController controller(currentConfig->servers, stats.updates);
+        controller.setBrightness(currentConfig->brightness);
+        // true after SUSPEND until the lights are off
+        bool suspendPending = false;
+        auto handleCommand = [&controller, &running, &suspendPending](const RGBCommand& command) {
+            switch (command.type) {
+                case RGBCommandType::CHANGE_SETTING:
+                    controller.changeSetting(command.setting);
+                    break;
+                case RGBCommandType::SUSPEND:
+                    controller.suspend();
+                    suspendPending = true;
+                    break;
+                case RGBCommandType::RESUME_FROM_HIBERNATE:
+                    controller.resume();
+                    suspendPending = false;
+                    break;
+                case RGBCommandType::QUIT:
+                    running = false;
+                    break;
+            }
+        };
+        std::vector<RGBCommand> commands;
+        commands.reserve(COMMAND_QUEUE_CAPACITY);
+        // coalesce and handle all commands, then clear them
+        auto handleCommands = [this, &commands, &handleCommand, &running]() {
+            stats.commandsReceived += commands.size();
+            stats.commandsCoalesced += coalesceCommands(commands);
+            for (const RGBCommand& command : commands) {
+                if (!running) { break; }
+                handleCommand(command);
+                if (command.type == RGBCommandType::CHANGE_SETTING) { stats.commandsApplied++; }
+            }
+            commands.clear();
+        };
+
+        // connecting happens in the background, commands are applied to the devices as they are found
+        controller.init(targetDeviceTypes, [this]() { q.interrupt(); });
+
+        RGBCommand command;
+        auto nextFrame = std::chrono::steady_clock::now();
+        while (running) {
+            // pick up a reloaded config, the App interrupts the queue after swapping it
+            if (std::shared_ptr<const Config> newConfig = config->load(); newConfig != currentConfig) {
+                currentConfig = std::move(newConfig);
+                controller.setBrightness(currentConfig->brightness);
+            }
+            controller.updateServers();
+            if (controller.isAnimating()) {
+                // one frame: handle all queued commands, update and sleep until the next frame starts
+                q.popAll(commands);
+                handleCommands();
+                controller.update();
+                nextFrame += rgbUpdateDuration;
+                auto now = std::chrono::steady_clock::now();
+                if (nextFrame < now) {
+                    // frame took too long: skip the missed frames instead of catching up
+                    nextFrame = now;
+                }
+                sleepUntil(nextFrame);
+            }
+            else {
+                // nothing to animate: block until a command arrives or a server connects
+                if (q.waitPop(command)) {
+                    commands.push_back(command);
+                    q.popAll(commands);
+                    handleCommands();
+                }
+                nextFrame = std::chrono::steady_clock::now();
+            }
+            // the servers interrupt the queue when the frame was sent
+            if (suspendPending and controller.isSuspendSent()) {
+                suspendPending = false;
+                uint64_t one = 1;
+                write(suspendFd, &one, sizeof(one));
+            }
+            stats.wakeups++;
+        }
+        notifyExit(0);
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "command_queue.hpp"
+#include "config.hpp"
+#include "frame_batch.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace rgb {
+    /// Counters of the rgb controller thread, read by the main thread for the statistics
+    struct ControllerStats {
+        /// number of times the thread woke up
+        std::atomic<uint64_t> wakeups = 0;
+        /// commands taken from the queue
+        std::atomic<uint64_t> commandsReceived = 0;
+        /// commands dropped because later commands superseded them
+        std::atomic<uint64_t> commandsCoalesced = 0;
+        /// CHANGE_SETTING commands passed to the controller, after coalescing. Other commands are not counted
+        std::atomic<uint64_t> commandsApplied = 0;
+        /// updates sent to the OpenRGB server
+        UpdateStats updates;
+    };
+
+
+    /**
+     * @brief The rgb controller thread: creates a RGBController and waits for commands
+     * @details
+     *  While the controller is animating, it is updated every rgbUpdateDuration (absolute deadlines, so the frame rate does not drift).
+     *  Otherwise the thread blocks until a command arrives.
+     *  Waiting for commands is cut short by new commands and a frame is never longer than rgbUpdateDuration,
+     *  so a command (including QUIT) is handled within one frame.
+     *  Every time the thread wakes up, it takes all queued commands and coalesces them (see coalesceCommands()),
+     *  so that only the net state of superseded settings is sent to the OpenRGB server.
+     */
+    class ControllerThread {
+        public:
+            /**
+             * @brief Start the thread
+             * @param config the current config, for the servers and the brightness. A new config is picked up every time the thread wakes up
+             */
+            ControllerThread(const std::atomic<std::shared_ptr<const Config>>* config);
+            /// Stops the thread without changing the lights if stop() was not called
+            ~ControllerThread();
+            ControllerThread(const ControllerThread&) = delete;
+            ControllerThread& operator=(const ControllerThread&) = delete;
+            /// The queue with the commands for the controller
+            CommandQueue& getQueue() { return q; }
+            const CommandQueue& getQueue() const { return q; }
+            /// eventfd that becomes readable when the thread exits
+            int getExitFd() const { return exitFd; }
+            /// eventfd that becomes readable when the lights are off after a SUSPEND command (see RGBController::isSuspendSent())
+            int getSuspendFd() const { return suspendFd; }
+            /// @returns a code that is >= 0 when the thread has exited, and -1 while it is running
+            int getReturnCode() const { return returnCode; }
+            const ControllerStats& getStats() const { return stats; }
+            /**
+             * @brief Turn the lights off and join the thread
+             * @details
+             *  Pushes clearSetting and QUIT, which the thread handles in the same wakeup.
+             *  Does nothing if the thread was already stopped.
+             */
+            void stop(const RGBSetting& clearSetting);
+
+        private:
+            const std::atomic<std::shared_ptr<const Config>>* config;
+            CommandQueue q;
+            std::atomic<int> returnCode = -1;
+            ControllerStats stats;
+            int exitFd;
+            int suspendFd;
+            std::thread thread;
+
+            void run();
+            /// Push QUIT and join the thread, or detach it if the queue stays full
+            void quit();
+    };
+}
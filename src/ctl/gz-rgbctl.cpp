@@ -0,0 +1,93 @@
+/**
+ * @file
+ * @brief Command line client for the gz-rgb command socket
+ * @details
+ *  Usage: gz-rgbctl COMMAND...
+ *  Sends every COMMAND over one connection and prints the responses.
+ *  If COMMAND is "-", the commands are read line by line from stdin.
+ *  Returns 0 if all commands were accepted, 1 if at least one was rejected and 2 on connection errors.
+ */
+#include "../command_protocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace protocol = rgb::protocol;
+
+/**
+ * @brief Send command and print the response
+ * @returns false if the command was rejected
+ * @throws std::runtime_error on connection errors
+ */
+bool sendCommand(int fd, const std::string& command) {
+    if (command.empty()) { return true; }
+    if (command.size() > protocol::MAX_MESSAGE_SIZE) {
+        std::cerr << "Command too long: " << command << '\n';
+        return false;
+    }
+    if (send(fd, command.data(), command.size(), MSG_NOSIGNAL) < 0) {
+        throw std::runtime_error("send: " + std::string(std::strerror(errno)));
+    }
+    char buffer[protocol::MAX_MESSAGE_SIZE];
+    ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+    if (length <= 0) {
+        throw std::runtime_error(length == 0 ? "Connection closed by gz-rgb" : "recv: " + std::string(std::strerror(errno)));
+    }
+    std::string message(buffer + 1, length - 1);
+    if (buffer[0] == protocol::OK) {
+        std::cout << message << '\n';
+        return true;
+    }
+    std::cerr << command << ": " << message << '\n';
+    return false;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " COMMAND...\n"
+                  << "  Commands: colorHexRRGGBB, rainbow, clear, process_watching, quit, stats or a setting like 'Motherboard,DRAM|FADE|STATIC|#ff0000'\n"
+                  << "  Use - to read commands from stdin, one per line\n";
+        return 2;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, protocol::SOCKET_PATH.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 or connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        const int error = errno;
+        std::cerr << "Could not connect to " << protocol::SOCKET_PATH << ": " << std::strerror(error)
+                  << (error == EACCES ? " - only root and the group " + protocol::SOCKET_GROUP + " can send commands\n" : " - is gz-rgb running?\n");
+        return 2;
+    }
+
+    bool accepted = true;
+    try {
+        for (int i = 1; i < argc; i++) {
+            if (std::strcmp(argv[i], "-") == 0) {
+                std::string line;
+                while (std::getline(std::cin, line)) {
+                    accepted = sendCommand(fd, line) and accepted;
+                }
+            }
+            else {
+                accepted = sendCommand(fd, argv[i]) and accepted;
+            }
+        }
+    }
+    catch (std::runtime_error& e) {
+        std::cerr << e.what() << '\n';
+        close(fd);
+        return 2;
+    }
+    close(fd);
+    return accepted ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include "device_inventory.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rgb {
+    DeviceInfo::DeviceInfo(const orgb::Device& device)
+        : idx(device.idx), type(device.type), name(device.name), ledCount(static_cast<uint32_t>(device.leds.size()))
+    {
+        for (const orgb::Zone& zone : device.zones) {
+            zones.push_back({ zone.idx, zone.numLeds });
+        }
+    }
+
+
+    uint64_t getDeviceFingerprint(uint32_t controllerCount, const DeviceTypeMask& targetDevices) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (uint32_t value : { DEVICE_CACHE_VERSION, controllerCount, targetDevices.getBits() }) {
+            for (size_t i = 0; i < sizeof(value); i++) {
+                hash ^= (value >> (8 * i)) & 0xff;
+                hash *= 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+
+    std::string getDeviceCachePath(const std::string& server, const std::string& cacheDir) {
+        return cacheDir + "/" + server + ".devices";
+    }
+
+
+    //
+    // FILE FORMAT
+    // host byte order
+    // header: magic, version, fingerprint, device count
+    // device: idx, type, led count, name length, name, zone count, zones (idx, led count)
+    //
+    static constexpr std::array<char, 8> CACHE_MAGIC = { 'G', 'Z', 'R', 'G', 'B', 'D', 'E', 'V' };
+
+    /// Reads values from a buffer, fails instead of reading past its end
+    class CacheReader {
+        public:
+            CacheReader(const std::vector<uint8_t>& buffer) : buffer(buffer) {};
+            template<typename T>
+            bool read(T& value) {
+                if (buffer.size() - pos < sizeof(T)) { return false; }
+                std::memcpy(&value, buffer.data() + pos, sizeof(T));
+                pos += sizeof(T);
+                return true;
+            }
+            bool read(std::string& s, size_t length) {
+                if (buffer.size() - pos < length) { return false; }
+                s.assign(reinterpret_cast<const char*>(buffer.data() + pos), length);
+                pos += length;
+                return true;
+            }
+            bool atEnd() const { return pos == buffer.size(); }
+        private:
+            const std::vector<uint8_t>& buffer;
+            size_t pos = 0;
+    };
+
+
+    template<typename T>
+    static void append(std::vector<uint8_t>& buffer, const T& value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    }
+
+
+    std::optional<std::vector<DeviceInfo>> loadDeviceCache(const std::string& path, uint64_t fingerprint) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { return std::nullopt; }
+        std::vector<uint8_t> buffer;
+        uint8_t chunk[4096];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0 or (n < 0 and errno == EINTR)) {
+            if (n > 0) { buffer.insert(buffer.end(), chunk, chunk + n); }
+        }
+        close(fd);
+        if (n < 0) { return std::nullopt; }
+
+        CacheReader reader(buffer);
+        std::array<char, CACHE_MAGIC.size()> magic;
+        uint32_t version;
+        uint64_t cachedFingerprint;
+        uint32_t deviceCount;
+        if (!reader.read(magic) or magic != CACHE_MAGIC) { return std::nullopt; }
+        if (!reader.read(version) or version != DEVICE_CACHE_VERSION) { return std::nullopt; }
+        if (!reader.read(cachedFingerprint) or cachedFingerprint != fingerprint) { return std::nullopt; }
+        if (!reader.read(deviceCount)) { return std::nullopt; }
+        std::vector<DeviceInfo> devices;
+        for (uint32_t d = 0; d < deviceCount; d++) {
+            DeviceInfo& device = devices.emplace_back();
+            uint32_t type, nameLength, zoneCount;
+            if (!(reader.read(device.idx) and reader.read(type) and reader.read(device.ledCount)
+                  and reader.read(nameLength) and reader.read(device.name, nameLength) and reader.read(zoneCount))) {
+                return std::nullopt;
+            }
+            if (type > static_cast<uint32_t>(orgb::DeviceType::Unknown)) { return std::nullopt; }
+            device.type = static_cast<orgb::DeviceType>(type);
+            for (uint32_t z = 0; z < zoneCount; z++) {
+                ZoneInfo& zone = device.zones.emplace_back();
+                if (!(reader.read(zone.idx) and reader.read(zone.ledCount))) { return std::nullopt; }
+            }
+        }
+        if (!reader.atEnd()) { return std::nullopt; }
+        return devices;
+    }
+
+
+    void saveDeviceCache(const std::string& path, uint64_t fingerprint, const std::vector<DeviceInfo>& devices) {
+        std::vector<uint8_t> buffer;
+        append(buffer, CACHE_MAGIC);
+        append(buffer, DEVICE_CACHE_VERSION);
+        append(buffer, fingerprint);
+        append(buffer, static_cast<uint32_t>(devices.size()));
+        for (const DeviceInfo& device : devices) {
+            append(buffer, device.idx);
+            append(buffer, static_cast<uint32_t>(device.type));
+            append(buffer, device.ledCount);
+            append(buffer, static_cast<uint32_t>(device.name.size()));
+            buffer.insert(buffer.end(), device.name.begin(), device.name.end());
+            append(buffer, static_cast<uint32_t>(device.zones.size()));
+            for (const ZoneInfo& zone : device.zones) {
+                append(buffer, zone.idx);
+                append(buffer, zone.ledCount);
+            }
+        }
+
+        const std::string cacheDir = path.substr(0, path.rfind('/'));
+        if (mkdir(cacheDir.c_str(), 0755) < 0 and errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), "saveDeviceCache: mkdir " + cacheDir);
+        }
+        // write to a temporary file and rename it, so that a crash never leaves a partial cache
+        const std::string tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "saveDeviceCache: open " + tmpPath);
+        }
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t n = write(fd, buffer.data() + written, buffer.size() - written);
+            if (n < 0) {
+                if (errno == EINTR) { continue; }
+                int error = errno;
+                close(fd);
+                unlink(tmpPath.c_str());
+                throw std::system_error(error, std::generic_category(), "saveDeviceCache: write " + tmpPath);
+            }
+            written += n;
+        }
+        close(fd);
+        if (rename(tmpPath.c_str(), path.c_str()) < 0) {
+            int error = errno;
+            unlink(tmpPath.c_str());
+            throw std::system_error(error, std::generic_category(), "saveDeviceCache: rename " + tmpPath);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "rgb_command.hpp"
+
+#include "OpenRGB/DeviceInfo.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace rgb {
+    /// Directory for the cached device lists of the OpenRGB servers
+    const std::string DEVICE_CACHE_DIR = "/var/cache/gz-rgb";
+    /// Must be increased when the format of the cache files changes
+    constexpr uint32_t DEVICE_CACHE_VERSION = 2;
+
+    struct ZoneInfo {
+        uint32_t idx;
+        uint32_t ledCount;
+        bool operator==(const ZoneInfo& other) const = default;
+    };
+
+    /**
+     * @brief The parts of an orgb::Device that are needed to send colors to it
+     * @details
+     *  Unlike the orgb::Device, which holds all modes, zones and leds with their names, this can be stored in the device cache.
+     *  The leds are addressed by their index in the device.
+     *  The mode is not stored: a device from the cache is set to direct mode with SETCUSTOMMODE, which needs no mode data.
+     */
+    struct DeviceInfo {
+        uint32_t idx = 0;
+        orgb::DeviceType type = orgb::DeviceType::Unknown;
+        std::string name;
+        uint32_t ledCount = 0;
+        std::vector<ZoneInfo> zones;
+        DeviceInfo() = default;
+        DeviceInfo(const orgb::Device& device);
+        bool operator==(const DeviceInfo& other) const = default;
+    };
+
+    /**
+     * @brief Get a value that changes when the target devices of a server might be different
+     * @details
+     *  Only uses what the server can tell without sending the device list, so a device that was replaced by one
+     *  of the same type is not noticed. The cached devices must therefore be compared to the device list after connecting.
+     */
+    uint64_t getDeviceFingerprint(uint32_t controllerCount, const DeviceTypeMask& targetDevices);
+    /**
+     * @returns path of the cache file for server (host:port)
+     * @param cacheDir another directory than DEVICE_CACHE_DIR only for tests
+     */
+    std::string getDeviceCachePath(const std::string& server, const std::string& cacheDir=DEVICE_CACHE_DIR);
+    /**
+     * @brief Load the cached target devices of a server
+     * @returns std::nullopt if the file does not exist, is invalid or was written with a different fingerprint
+     */
+    std::optional<std::vector<DeviceInfo>> loadDeviceCache(const std::string& path, uint64_t fingerprint);
+    /**
+     * @brief Write the target devices of a server to the cache
+     * @details The file is replaced atomically, its directory is created if it does not exist.
+     * @throws std::system_error
+     */
+    void saveDeviceCache(const std::string& path, uint64_t fingerprint, const std::vector<DeviceInfo>& devices);
+}
@@ -0,0 +1,90 @@
+#include "device_table.hpp"
+
+#include <algorithm>
+
+namespace rgb {
+    size_t DeviceTable::add(const DeviceInfo& device, size_t server) {
+        devices.push_back(device);
+        types.push_back(device.type);
+        servers.push_back(server);
+        modes.push_back(AnimationMode::NONE);
+        fadeTimings.push_back({});
+        rainbowTimings.push_back({});
+        sentValid.push_back(false);
+        colors.resize(colors.size() + device.ledCount);
+        fadeStarts.resize(colors.size());
+        fadeTargets.resize(colors.size());
+        sentColors.resize(colors.size());
+        ledOffsets.push_back(colors.size());
+        return devices.size() - 1;
+    }
+
+
+    void DeviceTable::removeServer(size_t server) {
+        size_t kept = 0;
+        size_t keptLEDs = 0;
+        for (size_t i = 0; i < devices.size(); i++) {
+            if (servers[i] == server) {
+                if (modes[i] != AnimationMode::NONE) { animatedCount--; }
+                continue;
+            }
+            // move entry i to kept, kept <= i so nothing that is still needed is overwritten
+            const size_t offset = ledOffsets[i];
+            const size_t ledCount = getLEDCount(i);
+            if (kept != i) { devices[kept] = std::move(devices[i]); }
+            types[kept] = types[i];
+            servers[kept] = servers[i];
+            modes[kept] = modes[i];
+            fadeTimings[kept] = fadeTimings[i];
+            rainbowTimings[kept] = rainbowTimings[i];
+            sentValid[kept] = sentValid[i];
+            ledOffsets[kept] = keptLEDs;
+            for (std::vector<orgb::Color>* leds : { &colors, &fadeStarts, &fadeTargets, &sentColors }) {
+                std::copy(leds->begin() + offset, leds->begin() + offset + ledCount, leds->begin() + keptLEDs);
+            }
+            keptLEDs += ledCount;
+            kept++;
+        }
+        devices.resize(kept);
+        types.resize(kept);
+        servers.resize(kept);
+        modes.resize(kept);
+        fadeTimings.resize(kept);
+        rainbowTimings.resize(kept);
+        sentValid.resize(kept);
+        ledOffsets.resize(kept + 1);
+        ledOffsets[kept] = keptLEDs;
+        for (std::vector<orgb::Color>* leds : { &colors, &fadeStarts, &fadeTargets, &sentColors }) {
+            leds->resize(keptLEDs);
+        }
+    }
+
+
+    void DeviceTable::clear() {
+        devices.clear();
+        types.clear();
+        servers.clear();
+        ledOffsets.assign(1, 0);
+        modes.clear();
+        fadeTimings.clear();
+        rainbowTimings.clear();
+        fadeStarts.clear();
+        fadeTargets.clear();
+        sentValid.clear();
+        colors.clear();
+        sentColors.clear();
+        animatedCount = 0;
+    }
+
+
+    void DeviceTable::invalidateSent() {
+        std::fill(sentValid.begin(), sentValid.end(), false);
+    }
+
+
+    void DeviceTable::setMode(size_t i, AnimationMode mode) {
+        if (modes[i] != AnimationMode::NONE) { animatedCount--; }
+        if (mode != AnimationMode::NONE) { animatedCount++; }
+        modes[i] = mode;
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "device_inventory.hpp"
+#include "rgb_command.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace rgb {
+    /// What RGBController::update() does with a device
+    enum class AnimationMode : uint8_t {
+        NONE, FADE, RAINBOW,
+    };
+
+    /// When and how a device fades from its start to its target colors
+    struct FadeTiming {
+        std::chrono::steady_clock::time_point start;
+        std::chrono::milliseconds duration;
+        FadeCurve curve;
+    };
+
+    /// How the rainbow of a device moves
+    struct RainbowTiming {
+        std::chrono::steady_clock::time_point start;
+        /// time for one full cycle through the palette, 0 for a still rainbow
+        std::chrono::milliseconds cycle;
+        /// hue difference between neighbouring leds
+        uint8_t spread;
+        RainbowDirection direction;
+    };
+
+    /**
+     * @brief State of the target devices as structure of arrays
+     * @details
+     *  Devices are addressed by a dense index in [0, size()).
+     *  The colors of all leds are stored in one contiguous buffer, the leds of device i are at
+     *  [ledOffsets[i], ledOffsets[i + 1]). The same layout is used for the fade start and target colors and the colors last sent to the server.
+     *  Nothing is allocated after the devices were added, so update() can scan the arrays every frame.
+     */
+    class DeviceTable {
+        public:
+            /**
+             * @brief Add device, its leds start black
+             * @param server Index of the server the device belongs to
+             * @returns the index of the device
+             */
+            size_t add(const DeviceInfo& device, size_t server);
+            /**
+             * @brief Remove all devices of server
+             * @details The remaining devices keep their state and order, but their indices change.
+             */
+            void removeServer(size_t server);
+            void clear();
+            size_t size() const { return devices.size(); }
+
+            const DeviceInfo& getDevice(size_t i) const { return devices[i]; }
+            orgb::DeviceType getType(size_t i) const { return types[i]; }
+            size_t getServer(size_t i) const { return servers[i]; }
+            size_t getLEDCount(size_t i) const { return ledOffsets[i + 1] - ledOffsets[i]; }
+            /// Colors that should be shown on device i
+            std::span<orgb::Color> getColors(size_t i) { return { colors.data() + ledOffsets[i], getLEDCount(i) }; }
+            /// Colors last sent to device i, only meaningful if isSentValid(i)
+            std::span<orgb::Color> getSentColors(size_t i) { return { sentColors.data() + ledOffsets[i], getLEDCount(i) }; }
+            bool isSentValid(size_t i) const { return sentValid[i] != 0; }
+            void setSentValid(size_t i, bool valid) { sentValid[i] = valid; }
+            /// Forget the sent colors of all devices
+            void invalidateSent();
+
+            AnimationMode getMode(size_t i) const { return modes[i]; }
+            void setMode(size_t i, AnimationMode mode);
+            /// Colors of the leds of device i when the fade started
+            std::span<orgb::Color> getFadeStarts(size_t i) { return { fadeStarts.data() + ledOffsets[i], getLEDCount(i) }; }
+            /// Target colors of the leds of device i while fading
+            std::span<orgb::Color> getFadeTargets(size_t i) { return { fadeTargets.data() + ledOffsets[i], getLEDCount(i) }; }
+            FadeTiming& getFadeTiming(size_t i) { return fadeTimings[i]; }
+            RainbowTiming& getRainbowTiming(size_t i) { return rainbowTimings[i]; }
+            /// @returns number of devices with a mode other than AnimationMode::NONE
+            size_t getAnimatedCount() const { return animatedCount; }
+
+        private:
+            std::vector<DeviceInfo> devices;
+            std::vector<orgb::DeviceType> types;
+            std::vector<uint32_t> servers;
+            /// size() + 1 entries, the last one is the total number of leds
+            std::vector<uint32_t> ledOffsets = { 0 };
+            std::vector<AnimationMode> modes;
+            std::vector<FadeTiming> fadeTimings;
+            std::vector<RainbowTiming> rainbowTimings;
+            std::vector<uint8_t> sentValid;
+            std::vector<orgb::Color> colors;
+            std::vector<orgb::Color> fadeStarts;
+            std::vector<orgb::Color> fadeTargets;
+            std::vector<orgb::Color> sentColors;
+            size_t animatedCount = 0;
+    };
+}
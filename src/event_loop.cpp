@@ -0,0 +1,147 @@
+#include "event_loop.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace rgb {
+    //
+    // EVENT LOOP
+    //
+    EventLoop::EventLoop() : eventTime(std::chrono::steady_clock::now()) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+        }
+    }
+
+
+    EventLoop::~EventLoop() {
+        close(epollFd);
+    }
+
+
+    void EventLoop::add(int fd, std::function<void()> callback) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        }
+        callbacks[fd] = std::move(callback);
+        std::erase(removedFds, fd);
+        std::erase(disabledFds, fd);
+    }
+
+
+    void EventLoop::remove(int fd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        removedFds.push_back(fd);
+        std::erase(disabledFds, fd);
+    }
+
+
+    void EventLoop::setEnabled(int fd, bool enabled) {
+        // a registered fd always reports EPOLLERR and EPOLLHUP, even with an empty event mask, so it is taken out of the epoll set
+        if (enabled) {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0) {
+                std::erase(disabledFds, fd);
+            }
+        }
+        else if (epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr) == 0) {
+            disabledFds.push_back(fd);
+        }
+    }
+
+
+    void EventLoop::run() {
+        epoll_event events[MAX_EVENTS_PER_WAKEUP];
+        running = true;
+        while (running) {
+            int eventCount = epoll_wait(epollFd, events, MAX_EVENTS_PER_WAKEUP, -1);
+            if (eventCount < 0) {
+                if (errno == EINTR) { continue; }
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            const auto wakeupTime = std::chrono::steady_clock::now();
+            for (int i = 0; i < eventCount and running; i++) {
+                int fd = events[i].data.fd;
+                if (std::find(removedFds.begin(), removedFds.end(), fd) != removedFds.end()) { continue; }
+                // disabled by an earlier callback of this epoll_wait call
+                if (std::find(disabledFds.begin(), disabledFds.end(), fd) != disabledFds.end()) { continue; }
+                auto it = callbacks.find(fd);
+                if (it != callbacks.end()) {
+                    eventTime = wakeupTime;
+                    it->second();
+                }
+            }
+            for (int fd : removedFds) {
+                callbacks.erase(fd);
+            }
+            removedFds.clear();
+        }
+    }
+
+
+    //
+    // TIMER
+    //
+    Timer::Timer(clockid_t clock) {
+        fd = timerfd_create(clock, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "timerfd_create");
+        }
+    }
+
+
+    Timer::~Timer() {
+        close(fd);
+    }
+
+
+    void Timer::set(std::chrono::nanoseconds value, std::chrono::nanoseconds interval, int flags) {
+        using std::chrono::duration_cast;
+        itimerspec spec{};
+        spec.it_value.tv_sec = duration_cast<std::chrono::seconds>(value).count();
+        spec.it_value.tv_nsec = (value - std::chrono::seconds(spec.it_value.tv_sec)).count();
+        spec.it_interval.tv_sec = duration_cast<std::chrono::seconds>(interval).count();
+        spec.it_interval.tv_nsec = (interval - std::chrono::seconds(spec.it_interval.tv_sec)).count();
+        timerfd_settime(fd, flags, &spec, nullptr);
+    }
+
+
+    void Timer::setInterval(std::chrono::nanoseconds interval) {
+        set(interval, interval, 0);
+    }
+
+
+    void Timer::setTimeout(std::chrono::nanoseconds timeout) {
+        // a zero value would disarm the timer
+        set(std::max(timeout, std::chrono::nanoseconds(1)), std::chrono::nanoseconds(0), 0);
+    }
+
+
+    void Timer::setTime(std::chrono::system_clock::time_point time) {
+        set(std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()), std::chrono::nanoseconds(1)), std::chrono::nanoseconds(0), TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET);
+    }
+
+
+    void Timer::disarm() {
+        set(std::chrono::nanoseconds(0), std::chrono::nanoseconds(0), 0);
+    }
+
+
+    bool Timer::read() {
+        uint64_t expirations = 0;
+        // fails with ECANCELED if the realtime clock was changed
+        return ::read(fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+    }
+}
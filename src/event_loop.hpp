@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <time.h>
+
+namespace rgb {
+    /// Maximum number of events handled per epoll_wait call
+    const int MAX_EVENTS_PER_WAKEUP = 16;
+
+    /**
+     * @brief Single threaded epoll reactor
+     * @details
+     *  Calls the callback of a file descriptor when it becomes readable.
+     *  Callbacks must read from the fd, otherwise they are called again right away.
+     */
+    class EventLoop {
+        public:
+            EventLoop();
+            ~EventLoop();
+            EventLoop(const EventLoop&) = delete;
+            EventLoop& operator=(const EventLoop&) = delete;
+            /**
+             * @brief Call callback when fd becomes readable
+             * @throws std::system_error if the fd can not be added
+             */
+            void add(int fd, std::function<void()> callback);
+            /**
+             * @brief Stop watching fd and remove the callback
+             * @details Can be used inside a callback, also the callback of fd itself. Does not close fd.
+             */
+            void remove(int fd);
+            /**
+             * @brief Stop or resume watching fd without removing the callback
+             * @details
+             *  Can be used inside a callback. A disabled fd is not in the epoll set, so errors on it do not call the callback either.
+             */
+            void setEnabled(int fd, bool enabled);
+            /**
+             * @brief Dispatch events until stop() is called
+             */
+            void run();
+            void stop() { running = false; }
+            /**
+             * @returns the time at which the current event happened
+             * @details The epoll wakeup, unless the callback set a more exact time with setEventTime()
+             */
+            std::chrono::steady_clock::time_point getEventTime() const { return eventTime; }
+            /// Set the time of the current event, eg. from a kernel timestamp or a timer deadline. Only valid until the callback returns
+            void setEventTime(std::chrono::steady_clock::time_point time) { eventTime = time; }
+
+        private:
+            int epollFd;
+            bool running = false;
+            std::unordered_map<int, std::function<void()>> callbacks;
+            // callbacks are erased after all events of an epoll_wait call were dispatched
+            std::vector<int> removedFds;
+            // fds with a callback that are not in the epoll set
+            std::vector<int> disabledFds;
+            std::chrono::steady_clock::time_point eventTime;
+    };
+
+
+    /**
+     * @brief RAII wrapper for a timerfd
+     */
+    class Timer {
+        public:
+            /**
+             * @param clock CLOCK_MONOTONIC for intervals or CLOCK_REALTIME for wall clock times
+             * @throws std::system_error if the timerfd can not be created
+             */
+            Timer(clockid_t clock=CLOCK_MONOTONIC);
+            ~Timer();
+            Timer(const Timer&) = delete;
+            Timer& operator=(const Timer&) = delete;
+            /// Expire every interval, starting after interval
+            void setInterval(std::chrono::nanoseconds interval);
+            /// Expire once after timeout
+            void setTimeout(std::chrono::nanoseconds timeout);
+            /**
+             * @brief Expire once at time
+             * @details
+             *  Only for CLOCK_REALTIME timers. The timer also expires when the system clock is changed,
+             *  in which case read() returns false. The kernel treats a resume from suspend as such a change.
+             *  With time_point::max() the timer only expires for clock changes.
+             */
+            void setTime(std::chrono::system_clock::time_point time);
+            void disarm();
+            /**
+             * @brief Acknowledge the expiration
+             * @returns false if the timer did not expire or was canceled by a change of the system clock
+             */
+            bool read();
+            int getFd() const { return fd; }
+
+        private:
+            int fd;
+            void set(std::chrono::nanoseconds value, std::chrono::nanoseconds interval, int flags);
+    };
+}
@@ -0,0 +1,261 @@
+#include "focus_watcher.hpp"
+
+#include <gz-util/exceptions.hpp>
+#include <gz-util/log.hpp>
+
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+
+extern gz::Log rgblog;
+
+namespace rgb {
+    std::string FocusSource::toString() const {
+        switch (type) {
+            case X11: return argument.empty() ? "x11" : "x11:" + argument;
+            case FIFO: return "fifo:" + argument;
+            default: return "off";
+        }
+    }
+
+
+    FocusSource parseFocusSource(const std::string& s) {
+        FocusSource source;
+        if (s.empty() or s == "off") { return source; }
+        const size_t colon = s.find(':');
+        const std::string type = s.substr(0, colon);
+        const std::string argument = colon == std::string::npos ? "" : s.substr(colon + 1);
+        if (type == "x11") {
+            source.type = FocusSource::X11;
+            source.argument = argument;
+        }
+        else if (type == "fifo") {
+            source.type = FocusSource::FIFO;
+            source.argument = argument.empty() ? FOCUS_FIFO_PATH : argument;
+        }
+        else {
+            throw gz::InvalidArgument("Invalid focus source '" + s + "', must be off, x11[:display] or fifo[:path]", "parseFocusSource");
+        }
+        return source;
+    }
+
+
+    std::unique_ptr<FocusWatcher> createFocusWatcher(const FocusSource& source) {
+        switch (source.type) {
+            case FocusSource::X11: return std::make_unique<X11FocusWatcher>(source.argument);
+            case FocusSource::FIFO: return std::make_unique<FifoFocusWatcher>(source.argument);
+            default: return nullptr;
+        }
+    }
+
+
+    //
+    // X11
+    //
+    /// @returns the atom or 0
+    static uint32_t getAtomReply(xcb_connection_t* connection, xcb_intern_atom_cookie_t cookie) {
+        xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(connection, cookie, nullptr);
+        if (reply == nullptr) { return 0; }
+        uint32_t atom = reply->atom;
+        std::free(reply);
+        return atom;
+    }
+
+
+    /// @returns the first 32 bit value of the property or 0
+    static uint32_t getProperty32(xcb_connection_t* connection, uint32_t window, uint32_t property, uint32_t type) {
+        xcb_get_property_reply_t* reply = xcb_get_property_reply(connection, xcb_get_property(connection, 0, window, property, type, 0, 1), nullptr);
+        if (reply == nullptr) { return 0; }
+        uint32_t value = 0;
+        if (reply->format == 32 and xcb_get_property_value_length(reply) >= static_cast<int>(sizeof(value))) {
+            std::memcpy(&value, xcb_get_property_value(reply), sizeof(value));
+        }
+        std::free(reply);
+        return value;
+    }
+
+
+    X11FocusWatcher::X11FocusWatcher(const std::string& display) {
+        int screenNumber = 0;
+        connection = xcb_connect(display.empty() ? nullptr : display.c_str(), &screenNumber);
+        auto fail = [this, &display](const std::string& message) {
+            xcb_disconnect(connection);
+            connection = nullptr;
+            throw std::runtime_error(message + " (display '" + (display.empty() ? "$DISPLAY" : display) + "')");
+        };
+        if (xcb_connection_has_error(connection)) { fail("Can not connect to the X server"); }
+
+        xcb_screen_iterator_t screen = xcb_setup_roots_iterator(xcb_get_setup(connection));
+        for (int i = 0; i < screenNumber and screen.rem > 0; i++) {
+            xcb_screen_next(&screen);
+        }
+        if (screen.rem == 0) { fail("Invalid screen"); }
+        root = screen.data->root;
+
+        // send both requests before waiting for the replies
+        auto activeWindowCookie = xcb_intern_atom(connection, 0, std::strlen("_NET_ACTIVE_WINDOW"), "_NET_ACTIVE_WINDOW");
+        auto wmPidCookie = xcb_intern_atom(connection, 0, std::strlen("_NET_WM_PID"), "_NET_WM_PID");
+        activeWindowAtom = getAtomReply(connection, activeWindowCookie);
+        wmPidAtom = getAtomReply(connection, wmPidCookie);
+        if (activeWindowAtom == 0 or wmPidAtom == 0) { fail("Can not get the _NET_ACTIVE_WINDOW and _NET_WM_PID atoms"); }
+
+        const uint32_t eventMask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+        xcb_change_window_attributes(connection, root, XCB_CW_EVENT_MASK, &eventMask);
+        xcb_flush(connection);
+        fd = xcb_get_file_descriptor(connection);
+    }
+
+
+    X11FocusWatcher::~X11FocusWatcher() {
+        if (connection != nullptr) {
+            xcb_disconnect(connection);
+        }
+    }
+
+
+    bool X11FocusWatcher::readEvents(bool queuedOnly) {
+        bool changed = false;
+        while (xcb_generic_event_t* event = queuedOnly ? xcb_poll_for_queued_event(connection) : xcb_poll_for_event(connection)) {
+            // the high bit is set for events sent by other clients
+            if ((event->response_type & 0x7f) == XCB_PROPERTY_NOTIFY) {
+                const auto* notify = reinterpret_cast<const xcb_property_notify_event_t*>(event);
+                if (notify->window == root and notify->atom == activeWindowAtom) {
+                    changed = true;
+                }
+            }
+            std::free(event);
+        }
+        if (xcb_connection_has_error(connection)) {
+            throw std::runtime_error("Lost the connection to the X server");
+        }
+        return changed;
+    }
+
+
+    std::optional<int> X11FocusWatcher::readFocus() {
+        const bool changed = readEvents(false);
+        if (!changed and initialFocusSent) { return std::nullopt; }
+        initialFocusSent = true;
+        int pid;
+        do {
+            uint32_t window = getActiveWindow();
+            pid = window == 0 ? 0 : getWindowPID(window);
+            // events that arrived with the replies were read from the socket into the queue of xcb, so they do not make the fd readable
+        } while (readEvents(true));
+        return pid;
+    }
+
+
+    uint32_t X11FocusWatcher::getActiveWindow() {
+        return getProperty32(connection, root, activeWindowAtom, XCB_ATOM_WINDOW);
+    }
+
+
+    int X11FocusWatcher::getWindowPID(uint32_t window) {
+        return static_cast<int>(getProperty32(connection, window, wmPidAtom, XCB_ATOM_CARDINAL));
+    }
+
+
+    //
+    // FIFO
+    //
+    /**
+     * @brief Open the FIFO without following symlinks and check that it is the expected file
+     * @param expected the FIFO that was opened first, or nullptr
+     * @throws std::system_error
+     */
+    static int openFifo(const std::string& path, int flags, const struct stat* expected) {
+        int fd = open(path.c_str(), flags | O_NONBLOCK | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "FifoFocusWatcher: open " + path);
+        }
+        struct stat status;
+        if (fstat(fd, &status) < 0) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "FifoFocusWatcher: fstat " + path);
+        }
+        std::string problem;
+        if (!S_ISFIFO(status.st_mode)) { problem = " is not a FIFO"; }
+        else if (status.st_uid != geteuid()) { problem = " is owned by another user"; }
+        else if (expected != nullptr and (status.st_dev != expected->st_dev or status.st_ino != expected->st_ino)) { problem = " was replaced"; }
+        if (!problem.empty()) {
+            close(fd);
+            throw std::system_error(EEXIST, std::generic_category(), "FifoFocusWatcher: " + path + problem);
+        }
+        return fd;
+    }
+
+
+    FifoFocusWatcher::FifoFocusWatcher(const std::string& path) : path(path) {
+        if (path == FOCUS_FIFO_PATH and mkdir(FOCUS_FIFO_DIR.c_str(), 0755) < 0 and errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), "FifoFocusWatcher: mkdir " + FOCUS_FIFO_DIR);
+        }
+        if (mkfifo(path.c_str(), 0666) < 0 and errno != EEXIST) {
+            throw std::system_error(errno, std::generic_category(), "FifoFocusWatcher: mkfifo " + path);
+        }
+        // opening a FIFO for reading does not block with O_NONBLOCK
+        fd = openFifo(path, O_RDONLY, nullptr);
+        // through the fd, so that a file that replaced the FIFO in the meantime is not changed
+        // (the umask may have removed the write permission for other users)
+        struct stat status;
+        if (fchmod(fd, 0666) < 0 or fstat(fd, &status) < 0) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "FifoFocusWatcher: fchmod " + path);
+        }
+        try {
+            writeFd = openFifo(path, O_WRONLY, &status);
+        }
+        catch (std::system_error&) {
+            close(fd);
+            throw;
+        }
+    }
+
+
+    FifoFocusWatcher::~FifoFocusWatcher() {
+        close(fd);
+        close(writeFd);
+    }
+
+
+    std::optional<int> FifoFocusWatcher::readFocus() {
+        std::optional<int> focus;
+        char buffer[FOCUS_FIFO_BUFFER_SIZE];
+        ssize_t length;
+        while ((length = read(fd, buffer, sizeof(buffer))) > 0 or (length < 0 and errno == EINTR)) {
+            for (ssize_t i = 0; i < length; i++) {
+                if (buffer[i] != '\n') {
+                    if (line.size() < FOCUS_FIFO_BUFFER_SIZE) { line += buffer[i]; }
+                    continue;
+                }
+                size_t begin = line.find_first_not_of(" \t\r");
+                size_t end = line.find_last_not_of(" \t\r");
+                int pid;
+                if (begin != std::string::npos) {
+                    auto [ptr, ec] = std::from_chars(line.data() + begin, line.data() + end + 1, pid);
+                    if (ec == std::errc() and ptr == line.data() + end + 1 and pid >= 0) {
+                        focus = pid;
+                    }
+                    else {
+                        rgblog.warning("Focus Watcher: Invalid pid '" + line + "' in " + path);
+                    }
+                }
+                line.clear();
+            }
+        }
+        if (length < 0 and errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "FifoFocusWatcher: read " + path);
+        }
+        return focus;
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+struct xcb_connection_t;
+
+namespace rgb {
+    /// A focus change is applied when the focus did not change again for this long, so that switching through windows does not send a setting for each of them
+    constexpr auto FOCUS_DEBOUNCE_DURATION = std::chrono::milliseconds(150);
+    /// Directory of the default FIFO, created if it does not exist. Only writable by root, so the FIFO can not be replaced by other users
+    const std::string FOCUS_FIFO_DIR = "/run/gz-rgb";
+    /// Default path of the FIFO for the fifo focus source
+    const std::string FOCUS_FIFO_PATH = FOCUS_FIFO_DIR + "/focus";
+    /// Size of the buffer for reading the FIFO
+    const size_t FOCUS_FIFO_BUFFER_SIZE = 256;
+
+    /// Where the pid of the focused window comes from, "focus" in the config file
+    struct FocusSource {
+        enum Type : uint8_t {
+            /// focus mode is disabled
+            NONE,
+            /// _NET_ACTIVE_WINDOW of an X11 server, argument is the display or empty for $DISPLAY
+            X11,
+            /// pids written to a FIFO, argument is the path
+            FIFO,
+        };
+        Type type = NONE;
+        std::string argument;
+        bool operator==(const FocusSource& other) const = default;
+        /// @returns the string representation, as in the config file
+        std::string toString() const;
+    };
+
+    /**
+     * @brief Parse the focus source
+     * @param s "off", "x11", "x11:<display>", "fifo" or "fifo:<path>"
+     * @throws gz::InvalidArgument if s is not valid
+     */
+    FocusSource parseFocusSource(const std::string& s);
+
+
+    /**
+     * @brief Reports the pid of the process that owns the focused window
+     * @details
+     *  getFd() becomes readable when the focus might have changed, readFocus() then reads the new focus without blocking.
+     */
+    class FocusWatcher {
+        public:
+            virtual ~FocusWatcher() = default;
+            virtual int getFd() const = 0;
+            /**
+             * @brief Handle the pending events
+             * @returns the pid of the focused window, 0 if there is no focused window or its pid is unknown, std::nullopt if the focus did not change
+             * @throws std::runtime_error if the source is gone, eg the X server was closed
+             */
+            virtual std::optional<int> readFocus() = 0;
+    };
+
+    /**
+     * @brief Create the watcher for source
+     * @returns nullptr if source is NONE
+     * @throws std::runtime_error or std::system_error if the source can not be opened
+     */
+    std::unique_ptr<FocusWatcher> createFocusWatcher(const FocusSource& source);
+
+
+    /**
+     * @brief Follows _NET_ACTIVE_WINDOW on the root window of an X11 server
+     * @details
+     *  Subscribes to PropertyNotify events of the root window, so the focus is not polled.
+     *  The pid of the window is its _NET_WM_PID property.
+     *  The first readFocus() always reports the current focus. A change that arrives while the properties are read is
+     *  picked up before readFocus() returns, because xcb queues it without the fd becoming readable again.
+     */
+    class X11FocusWatcher : public FocusWatcher {
+        public:
+            /// @param display eg ":0", or empty for $DISPLAY
+            X11FocusWatcher(const std::string& display);
+            ~X11FocusWatcher();
+            X11FocusWatcher(const X11FocusWatcher&) = delete;
+            X11FocusWatcher& operator=(const X11FocusWatcher&) = delete;
+            int getFd() const override { return fd; }
+            std::optional<int> readFocus() override;
+
+        private:
+            xcb_connection_t* connection = nullptr;
+            int fd = -1;
+            uint32_t root = 0;
+            uint32_t activeWindowAtom = 0;
+            uint32_t wmPidAtom = 0;
+            bool initialFocusSent = false;
+            /**
+             * @brief Handle the events of the connection
+             * @param queuedOnly only the events that xcb already read from the socket
+             * @returns true if _NET_ACTIVE_WINDOW changed
+             * @throws std::runtime_error if the connection was lost
+             */
+            bool readEvents(bool queuedOnly);
+            /// @returns the window in _NET_ACTIVE_WINDOW or 0
+            uint32_t getActiveWindow();
+            /// @returns _NET_WM_PID of window or 0
+            int getWindowPID(uint32_t window);
+    };
+
+
+    /**
+     * @brief Reads pids from a FIFO, for Wayland compositors or window managers without _NET_ACTIVE_WINDOW
+     * @details
+     *  A script that follows the focus of the compositor writes the pid of the focused window followed by a newline,
+     *  or 0 if no window is focused. Eg for sway:
+     *  `swaymsg -mt subscribe '["window"]' | jq --unbuffered '.container.pid // 0' > /run/gz-rgb/focus`
+     *  The FIFO is created if it does not exist and can be written by all users.
+     *  It is opened without following symlinks and must be owned by the user of the daemon, its permissions are only changed through the fd.
+     *  When several lines are pending, only the last complete one is used.
+     */
+    class FifoFocusWatcher : public FocusWatcher {
+        public:
+            /// @throws std::system_error if the FIFO can not be created or opened, or path is not a FIFO of this user
+            FifoFocusWatcher(const std::string& path);
+            ~FifoFocusWatcher();
+            FifoFocusWatcher(const FifoFocusWatcher&) = delete;
+            FifoFocusWatcher& operator=(const FifoFocusWatcher&) = delete;
+            int getFd() const override { return fd; }
+            std::optional<int> readFocus() override;
+
+        private:
+            std::string path;
+            int fd = -1;
+            /// kept open so that the FIFO does not report EOF when the last writer closes it
+            int writeFd = -1;
+            /// incomplete line from the last read
+            std::string line;
+    };
+}
@@ -0,0 +1,335 @@
+#include "frame_batch.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace rgb {
+    std::string UpdateStats::toString() const {
+        const uint64_t commitCount = commits;
+        return "unchanged: " + std::to_string(unchanged) + ", single led: " + std::to_string(singleLED)
+            + ", zone: " + std::to_string(zone) + ", device color: " + std::to_string(deviceColor)
+            + ", full: " + std::to_string(deviceLEDs) + ", " + std::to_string(bytes / 1024) + "KiB"
+            + "\nFrame commits: " + std::to_string(commitCount)
+            + ", avg: " + std::to_string(commitTimeTotalNs / std::max<uint64_t>(commitCount, 1) / 1000) + "us"
+            + ", max: " + std::to_string(commitTimeMaxNs / 1000) + "us"
+            + "\nServer connects: " + std::to_string(connects) + ", failed: " + std::to_string(connectFailures);
+    }
+
+
+    FrameBatch::~FrameBatch() {
+        disconnect();
+    }
+
+
+    void FrameBatch::connect(const std::string& host, uint16_t port, const std::string& clientName) {
+        disconnect();
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        int r = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+        if (r != 0) {
+            throw std::system_error(r == EAI_SYSTEM ? errno : EHOSTUNREACH, std::generic_category(), "FrameBatch: Can not resolve '" + host + "': " + gai_strerror(r));
+        }
+        // the first address that accepts the connection, eg ::1 or 127.0.0.1 for localhost. All attempts together take at most CONNECT_TIMEOUT
+        const auto deadline = std::chrono::steady_clock::now() + CONNECT_TIMEOUT;
+        int error = ETIMEDOUT;
+        for (addrinfo* address = addresses; address != nullptr and fd < 0; address = address->ai_next) {
+            error = connectAddress(address->ai_addr, address->ai_addrlen, address->ai_family, deadline);
+            if (error != 0) { continue; }
+            char numericHost[NI_MAXHOST];
+            if (getnameinfo(address->ai_addr, address->ai_addrlen, numericHost, sizeof(numericHost), nullptr, 0, NI_NUMERICHOST) == 0) {
+                peerAddress = numericHost;
+            }
+            else {
+                peerAddress = host;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0) {
+            throw std::system_error(error, std::generic_category(), "FrameBatch: connect to '" + host + "'");
+        }
+        try {
+            negotiateProtocolVersion(deadline);
+        }
+        catch (...) {
+            buffer.clear();
+            throw;
+        }
+        // name is sent with the terminating null character
+        buffer.clear();
+        appendHeader(0, NET_PACKET_ID_SET_CLIENT_NAME, clientName.size() + 1);
+        buffer.insert(buffer.end(), clientName.c_str(), clientName.c_str() + clientName.size() + 1);
+        sendAll(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+
+    int FrameBatch::connectAddress(const sockaddr* address, socklen_t addressLength, int family, std::chrono::steady_clock::time_point deadline) {
+        // non blocking, so that a server that does not answer can not block the worker
+        fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) { return errno; }
+        int error = 0;
+        if (::connect(fd, address, addressLength) < 0) {
+            error = errno;
+            pollfd pfd { .fd = fd, .events = POLLOUT, .revents = 0 };
+            while (error == EINPROGRESS or error == EINTR) {
+                const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                const int ready = remaining.count() > 0 ? poll(&pfd, 1, static_cast<int>(remaining.count())) : 0;
+                if (ready == 0) { error = ETIMEDOUT; }
+                else if (ready < 0) { error = errno == EINTR ? EINPROGRESS : errno; }
+                else {
+                    // the result of the connect
+                    socklen_t errorLength = sizeof(error);
+                    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) < 0) { error = errno; }
+                }
+            }
+        }
+        if (error != 0) {
+            disconnect();
+            return error;
+        }
+        // sending blocks again, at most FRAME_SEND_TIMEOUT
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        timeval timeout { .tv_sec = std::chrono::duration_cast<std::chrono::seconds>(FRAME_SEND_TIMEOUT).count(), .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        return 0;
+    }
+
+
+    void FrameBatch::disconnect() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        protocolVersion = 0;
+    }
+
+
+    static uint32_t readUInt32(const uint8_t* data) {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+
+    void FrameBatch::negotiateProtocolVersion(std::chrono::steady_clock::time_point deadline) {
+        buffer.clear();
+        appendHeader(0, NET_PACKET_ID_REQUEST_PROTOCOL_VERSION, sizeof(ORGB_PROTOCOL_VERSION));
+        append(ORGB_PROTOCOL_VERSION);
+        sendAll(buffer.data(), buffer.size());
+        buffer.clear();
+        uint8_t header[ORGB_HEADER_SIZE];
+        std::vector<uint8_t> data;
+        // notifications that were sent before the answer are skipped
+        while (receiveAll(header, sizeof(header), deadline)) {
+            const uint32_t packetId = readUInt32(header + 8);
+            const uint32_t dataSize = readUInt32(header + 12);
+            if (std::memcmp(header, "ORGB", 4) != 0 or dataSize > ORGB_MAX_RECEIVE_SIZE) {
+                disconnect();
+                throw std::system_error(EPROTO, std::generic_category(), "FrameBatch: invalid packet from server");
+            }
+            data.resize(dataSize);
+            if (!receiveAll(data.data(), data.size(), deadline)) { break; }
+            if (packetId == NET_PACKET_ID_REQUEST_PROTOCOL_VERSION and dataSize >= sizeof(uint32_t)) {
+                protocolVersion = std::min(readUInt32(data.data()), ORGB_PROTOCOL_VERSION);
+                return;
+            }
+        }
+        protocolVersion = 0;
+    }
+
+
+    bool FrameBatch::receiveAll(uint8_t* data, size_t size, std::chrono::steady_clock::time_point deadline) {
+        while (size > 0) {
+            const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            pollfd pfd { .fd = fd, .events = POLLIN, .revents = 0 };
+            const int ready = remaining.count() > 0 ? poll(&pfd, 1, static_cast<int>(remaining.count())) : 0;
+            if (ready == 0) { return false; }
+            ssize_t n = ready < 0 ? -1 : recv(fd, data, size, MSG_DONTWAIT);
+            if (n < 0 and (errno == EINTR or errno == EAGAIN)) { continue; }
+            if (n <= 0) {
+                int error = n == 0 ? ECONNRESET : errno;
+                disconnect();
+                throw std::system_error(error, std::generic_category(), n == 0 ? "FrameBatch: connection closed by server" : "FrameBatch: recv");
+            }
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+
+    void FrameBatch::drain() {
+        uint8_t discard[1 << 12];
+        while (true) {
+            ssize_t n = recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+            if (n > 0) { continue; }
+            if (n < 0 and errno == EINTR) { continue; }
+            if (n < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) { return; }
+            int error = n == 0 ? ECONNRESET : errno;
+            disconnect();
+            throw std::system_error(error, std::generic_category(), n == 0 ? "FrameBatch: connection closed by server" : "FrameBatch: recv");
+        }
+    }
+
+
+    void FrameBatch::merge(FrameBatch& other) {
+        if (buffer.empty()) {
+            // no copy, and the buffers keep their capacity
+            std::swap(buffer, other.buffer);
+        }
+        else {
+            buffer.insert(buffer.end(), other.buffer.begin(), other.buffer.end());
+        }
+        other.buffer.clear();
+    }
+
+
+    void FrameBatch::appendHeader(uint32_t deviceIdx, NetPacketId packetId, uint32_t dataSize) {
+        buffer.insert(buffer.end(), { 'O', 'R', 'G', 'B' });
+        append(deviceIdx);
+        append(static_cast<uint32_t>(packetId));
+        append(dataSize);
+    }
+
+
+    template<typename T>
+    void FrameBatch::append(T value) {
+        static_assert(std::is_integral_v<T>, "FrameBatch::append only writes integers");
+        const auto bits = static_cast<std::make_unsigned_t<T>>(value);
+        size_t offset = buffer.size();
+        buffer.resize(offset + sizeof(T));
+        // compiles to a single store on little-endian hosts
+        for (size_t i = 0; i < sizeof(T); i++) {
+            buffer[offset + i] = static_cast<uint8_t>(bits >> (8 * i));
+        }
+    }
+
+
+    uint8_t* FrameBatch::appendColors(size_t count) {
+        size_t offset = buffer.size();
+        buffer.resize(offset + ORGB_COLOR_SIZE * count);
+        return buffer.data() + offset;
+    }
+
+
+    static inline uint8_t* writeColor(uint8_t* out, const orgb::Color& color) {
+        out[0] = color.r;
+        out[1] = color.g;
+        out[2] = color.b;
+        out[3] = 0;
+        return out + ORGB_COLOR_SIZE;
+    }
+
+
+    void FrameBatch::updateLEDs(uint32_t deviceIdx, std::span<const orgb::Color> colors) {
+        const uint32_t dataSize = devicePacketSize(colors.size()) - ORGB_HEADER_SIZE;
+        appendHeader(deviceIdx, NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS, dataSize);
+        append(dataSize);
+        append(static_cast<uint16_t>(colors.size()));
+        uint8_t* out = appendColors(colors.size());
+        for (const orgb::Color& color : colors) { out = writeColor(out, color); }
+        stats.deviceLEDs++;
+    }
+
+
+    void FrameBatch::updateLEDs(uint32_t deviceIdx, const orgb::Color& color, size_t ledCount) {
+        const uint32_t dataSize = devicePacketSize(ledCount) - ORGB_HEADER_SIZE;
+        appendHeader(deviceIdx, NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS, dataSize);
+        append(dataSize);
+        append(static_cast<uint16_t>(ledCount));
+        uint8_t* out = appendColors(ledCount);
+        for (size_t i = 0; i < ledCount; i++) { out = writeColor(out, color); }
+        stats.deviceColor++;
+    }
+
+
+    void FrameBatch::updateZoneLEDs(uint32_t deviceIdx, uint32_t zoneIdx, const orgb::Color& color, size_t ledCount) {
+        const uint32_t dataSize = zonePacketSize(ledCount) - ORGB_HEADER_SIZE;
+        appendHeader(deviceIdx, NET_PACKET_ID_RGBCONTROLLER_UPDATEZONELEDS, dataSize);
+        append(dataSize);
+        append(zoneIdx);
+        append(static_cast<uint16_t>(ledCount));
+        uint8_t* out = appendColors(ledCount);
+        for (size_t i = 0; i < ledCount; i++) { out = writeColor(out, color); }
+        stats.zone++;
+    }
+
+
+    void FrameBatch::updateSingleLED(uint32_t deviceIdx, uint32_t ledIdx, const orgb::Color& color) {
+        appendHeader(deviceIdx, NET_PACKET_ID_RGBCONTROLLER_UPDATESINGLELED, singleLEDPacketSize() - ORGB_HEADER_SIZE);
+        append(static_cast<int32_t>(ledIdx));
+        writeColor(appendColors(1), color);
+        stats.singleLED++;
+    }
+
+
+    void FrameBatch::setCustomMode(uint32_t deviceIdx) {
+        appendHeader(deviceIdx, NET_PACKET_ID_RGBCONTROLLER_SETCUSTOMMODE, 0);
+    }
+
+
+    void FrameBatch::sendAll(const uint8_t* data, size_t size, std::chrono::steady_clock::time_point deadline) {
+        const bool bounded = deadline != std::chrono::steady_clock::time_point::max();
+        while (size > 0) {
+            iovec iov { .iov_base = const_cast<uint8_t*>(data), .iov_len = size };
+            msghdr msg{};
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL | (bounded ? MSG_DONTWAIT : 0));
+            if (sent < 0 and bounded and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+                const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                pollfd pfd { .fd = fd, .events = POLLOUT, .revents = 0 };
+                if (remaining.count() > 0 and poll(&pfd, 1, static_cast<int>(remaining.count())) != 0) { continue; }
+                errno = ETIMEDOUT;
+            }
+            if (sent < 0) {
+                if (errno == EINTR) { continue; }
+                int error = errno;
+                disconnect();
+                throw std::system_error(error, std::generic_category(), "FrameBatch: sendmsg");
+            }
+            data += sent;
+            size -= sent;
+        }
+    }
+
+
+    void FrameBatch::commit(std::chrono::steady_clock::time_point deadline) {
+        if (buffer.empty()) { return; }
+        if (fd < 0) {
+            buffer.clear();
+            throw std::system_error(ENOTCONN, std::generic_category(), "FrameBatch: commit");
+        }
+        auto start = std::chrono::steady_clock::now();
+        try {
+            drain();
+            sendAll(buffer.data(), buffer.size(), deadline);
+        }
+        catch (...) {
+            buffer.clear();
+            throw;
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        stats.bytes += buffer.size();
+        stats.commits++;
+        stats.commitTimeTotalNs += ns;
+        // the worker threads of several servers commit concurrently
+        uint64_t maxNs = stats.commitTimeMaxNs;
+        while (ns > maxNs and !stats.commitTimeMaxNs.compare_exchange_weak(maxNs, ns));
+        buffer.clear();
+    }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "OpenRGB/Color.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace rgb {
+    //
+    // OPENRGB PROTOCOL
+    //
+    /// Packet ids of the OpenRGB SDK protocol, as in OpenRGB's NetworkProtocol.h
+    enum NetPacketId : uint32_t {
+        NET_PACKET_ID_REQUEST_PROTOCOL_VERSION = 40,
+        NET_PACKET_ID_SET_CLIENT_NAME = 50,
+        NET_PACKET_ID_RGBCONTROLLER_UPDATELEDS = 1050,
+        NET_PACKET_ID_RGBCONTROLLER_UPDATEZONELEDS = 1051,
+        NET_PACKET_ID_RGBCONTROLLER_UPDATESINGLELED = 1052,
+        NET_PACKET_ID_RGBCONTROLLER_SETCUSTOMMODE = 1100,
+    };
+    /// Header of every OpenRGB packet: magic, device index, packet id, data size
+    constexpr size_t ORGB_HEADER_SIZE = 16;
+    /// Highest protocol version FrameBatch requests, the packets it writes did not change up to this version
+    constexpr uint32_t ORGB_PROTOCOL_VERSION = 4;
+    /// Packets from the server that are larger are treated as a protocol error
+    constexpr uint32_t ORGB_MAX_RECEIVE_SIZE = 1 << 20;
+    /// Colors are sent as r, g, b, padding
+    constexpr size_t ORGB_COLOR_SIZE = 4;
+    /// Sending a frame fails after this time, so that a hung server can not block forever
+    constexpr auto FRAME_SEND_TIMEOUT = std::chrono::seconds(1);
+    /// Connecting to a server fails after this time, for all of its addresses together
+    constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(1);
+
+    //
+    // PACKET COSTS
+    // bytes on the wire, used to pick the cheapest update
+    //
+    /// Fixed cost per packet in addition to its size (parsing and locking in the server)
+    constexpr size_t PACKET_OVERHEAD = 64;
+    /// UPDATESINGLELED: led index + color
+    constexpr size_t singleLEDPacketSize() { return ORGB_HEADER_SIZE + 4 + ORGB_COLOR_SIZE; }
+    /// UPDATEZONELEDS: data size + zone index + color count + colors
+    constexpr size_t zonePacketSize(size_t ledCount) { return ORGB_HEADER_SIZE + 10 + ORGB_COLOR_SIZE * ledCount; }
+    /// UPDATELEDS: data size + color count + colors
+    constexpr size_t devicePacketSize(size_t ledCount) { return ORGB_HEADER_SIZE + 6 + ORGB_COLOR_SIZE * ledCount; }
+    constexpr size_t singleLEDPacketCost() { return PACKET_OVERHEAD + singleLEDPacketSize(); }
+    constexpr size_t zonePacketCost(size_t ledCount) { return PACKET_OVERHEAD + zonePacketSize(ledCount); }
+    constexpr size_t devicePacketCost(size_t ledCount) { return PACKET_OVERHEAD + devicePacketSize(ledCount); }
+
+    /// Updates sent to the OpenRGB servers, written by the rgb controller thread and the server worker threads
+    struct UpdateStats {
+        /// device frames that were identical to the last one sent
+        std::atomic<uint64_t> unchanged = 0;
+        std::atomic<uint64_t> singleLED = 0;
+        std::atomic<uint64_t> zone = 0;
+        std::atomic<uint64_t> deviceColor = 0;
+        std::atomic<uint64_t> deviceLEDs = 0;
+        std::atomic<uint64_t> bytes = 0;
+        /// number of FrameBatch::commit() calls that sent something
+        std::atomic<uint64_t> commits = 0;
+        std::atomic<uint64_t> commitTimeTotalNs = 0;
+        std::atomic<uint64_t> commitTimeMaxNs = 0;
+        /// successful and failed attempts to connect to a server
+        std::atomic<uint64_t> connects = 0;
+        std::atomic<uint64_t> connectFailures = 0;
+        std::string toString() const;
+    };
+
+
+    /**
+     * @brief Collects the led updates of one frame and sends them to the OpenRGB server at once
+     * @details
+     *  Uses its own TCP connection with Nagle's algorithm disabled. The update packets have no reply,
+     *  so the whole frame goes out with a single sendmsg and all devices change at the same time.
+     *  All integers are written little-endian, which is what the OpenRGB server reads on every platform it runs on,
+     *  independent of the byte order of this host.
+     *  The server sends notifications like DEVICE_LIST_UPDATED to every client, commit() reads and discards them
+     *  so that the server never blocks on a full socket buffer.
+     */
+    class FrameBatch {
+        public:
+            FrameBatch(UpdateStats& stats) : stats(stats) {};
+            ~FrameBatch();
+            FrameBatch(const FrameBatch&) = delete;
+            FrameBatch& operator=(const FrameBatch&) = delete;
+            /**
+             * @brief Connect to the server, negotiate the protocol version and send the client name
+             * @param host ip address or host name, all its addresses are tried in the order of getaddrinfo()
+             * @details
+             *  Servers that are older than the version request do not answer it, they are treated as version 0
+             *  when no answer arrived within CONNECT_TIMEOUT.
+             * @throws std::system_error if host can not be resolved, none of its addresses accepts the connection
+             *  or the server breaks the protocol
+             */
+            void connect(const std::string& host, uint16_t port, const std::string& clientName);
+            void disconnect();
+            bool isConnected() const { return fd >= 0; }
+            /// @returns the ip address that connect() connected to
+            const std::string& getPeerAddress() const { return peerAddress; }
+            /// @returns the lower of ORGB_PROTOCOL_VERSION and the version of the server
+            uint32_t getProtocolVersion() const { return protocolVersion; }
+
+            /// UPDATELEDS with colors
+            void updateLEDs(uint32_t deviceIdx, std::span<const orgb::Color> colors);
+            /// UPDATELEDS with ledCount times color
+            void updateLEDs(uint32_t deviceIdx, const orgb::Color& color, size_t ledCount);
+            /// UPDATEZONELEDS with ledCount times color
+            void updateZoneLEDs(uint32_t deviceIdx, uint32_t zoneIdx, const orgb::Color& color, size_t ledCount);
+            void updateSingleLED(uint32_t deviceIdx, uint32_t ledIdx, const orgb::Color& color);
+            void setCustomMode(uint32_t deviceIdx);
+
+            bool empty() const { return buffer.empty(); }
+            /// @returns size of the collected packets in bytes
+            size_t size() const { return buffer.size(); }
+            /// Discard the collected packets
+            void clear() { buffer.clear(); }
+            /// Move the packets of other to the end of this batch
+            void merge(FrameBatch& other);
+            /**
+             * @brief Discard what the server sent, then send the collected packets and clear them
+             * @param deadline sending fails with ETIMEDOUT when it is not done at deadline,
+             *  otherwise each write may block for FRAME_SEND_TIMEOUT
+             * @throws std::system_error when sending fails or the server closed the connection,
+             *  the connection is closed and the packets are discarded
+             */
+            void commit(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+        private:
+            void appendHeader(uint32_t deviceIdx, NetPacketId packetId, uint32_t dataSize);
+            /// Append an integer in little-endian
+            template<typename T>
+            void append(T value);
+            /// @returns pointer to space for count colors at the end of buffer
+            uint8_t* appendColors(size_t count);
+            void sendAll(const uint8_t* data, size_t size, std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+            /**
+             * @brief Read size bytes
+             * @returns false if they did not arrive before deadline
+             * @throws std::system_error if reading fails or the server closed the connection
+             */
+            bool receiveAll(uint8_t* data, size_t size, std::chrono::steady_clock::time_point deadline);
+            /// Send REQUEST_PROTOCOL_VERSION and wait for the answer until deadline
+            void negotiateProtocolVersion(std::chrono::steady_clock::time_point deadline);
+            /// Read and discard everything the server sent, without blocking
+            void drain();
+            /**
+             * @brief Connect fd to address with a non-blocking connect() that is given up at deadline
+             * @returns 0 on success, otherwise the error and fd is closed
+             */
+            int connectAddress(const sockaddr* address, socklen_t addressLength, int family, std::chrono::steady_clock::time_point deadline);
+            UpdateStats& stats;
+            int fd = -1;
+            std::string peerAddress;
+            uint32_t protocolVersion = 0;
+            std::vector<uint8_t> buffer;
+    };
+}
@@ -0,0 +1,123 @@
+#include "frame_diff.hpp"
+#include "color_kernels.hpp"
+
+#include <algorithm>
+
+namespace rgb {
+    bool isSameColor(const orgb::Color& color1, const orgb::Color& color2) {
+        return color1.r == color2.r and color1.g == color2.g and color1.b == color2.b;
+    }
+
+
+    bool FrameDiff::zonesCoverLEDs(const DeviceInfo& device, size_t ledCount) {
+        size_t zoneLEDs = 0;
+        for (const ZoneInfo& zone : device.zones) { zoneLEDs += zone.ledCount; }
+        return zoneLEDs == ledCount and device.ledCount == ledCount;
+    }
+
+
+    std::span<const orgb::Color> FrameDiff::applyBrightness(std::span<const orgb::Color> colors) {
+        if (brightness == 255) { return colors; }
+        scaledColors.resize(colors.size());
+        scaleBrightness(colors, scaledColors, brightness);
+        return scaledColors;
+    }
+
+
+    void FrameDiff::sendColors(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors) {
+        const orgb::Color& first = colors.front();
+        bool uniform = std::all_of(colors.begin(), colors.end(), [&first](const orgb::Color& c) { return isSameColor(c, first); });
+        if (uniform) {
+            batch.updateLEDs(device.idx, first, colors.size());
+        }
+        else {
+            batch.updateLEDs(device.idx, colors);
+        }
+    }
+
+
+    void FrameDiff::sendAll(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors, std::span<orgb::Color> sent) {
+        sendColors(batch, device, colors);
+        std::ranges::copy(colors, sent.begin());
+    }
+
+
+    void FrameDiff::sendFull(FrameBatch& batch, DeviceTable& table, size_t i) {
+        sendFull(batch, table.getDevice(i), table.getColors(i));
+        // the next send() compares against nothing and sends all leds, which saves recording them every frame
+        table.setSentValid(i, false);
+    }
+
+
+    void FrameDiff::sendFull(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors) {
+        if (colors.empty()) { return; }
+        sendColors(batch, device, applyBrightness(colors));
+    }
+
+
+    void FrameDiff::send(FrameBatch& batch, DeviceTable& table, size_t i) {
+        if (table.getColors(i).empty()) { return; }
+        send(batch, table.getDevice(i), table.getColors(i), table.getSentColors(i), table.isSentValid(i));
+        table.setSentValid(i, true);
+    }
+
+
+    void FrameDiff::send(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors, std::span<orgb::Color> sent, bool sentValid) {
+        if (colors.empty()) { return; }
+        colors = applyBrightness(colors);
+        if (!sentValid or device.ledCount != colors.size()) {
+            sendAll(batch, device, colors, sent);
+            return;
+        }
+
+        // find changed leds per zone. without usable zones, all leds are treated as one zone that can not be sent as a whole
+        const bool useZones = zonesCoverLEDs(device, colors.size());
+        const size_t zoneCount = useZones ? device.zones.size() : 1;
+        auto zoneLEDCount = [&](size_t z) -> size_t { return useZones ? device.zones[z].ledCount : colors.size(); };
+        zoneDiffs.assign(zoneCount, ZoneDiff{});
+        size_t changed = 0;
+        size_t partialCost = 0;
+        size_t ledIdx = 0;
+        for (size_t z = 0; z < zoneCount; z++) {
+            const size_t zoneEnd = ledIdx + zoneLEDCount(z);
+            ZoneDiff& diff = zoneDiffs[z];
+            diff.uniform = useZones;
+            for (size_t i = ledIdx; i < zoneEnd; i++) {
+                if (!isSameColor(colors[i], sent[i])) { diff.changed++; }
+                if (!isSameColor(colors[i], colors[ledIdx])) { diff.uniform = false; }
+            }
+            if (diff.changed > 0) {
+                size_t ledsCost = diff.changed * singleLEDPacketCost();
+                partialCost += diff.uniform ? std::min(ledsCost, zonePacketCost(zoneLEDCount(z))) : ledsCost;
+            }
+            changed += diff.changed;
+            ledIdx = zoneEnd;
+        }
+        if (changed == 0) {
+            stats.unchanged++;
+            return;
+        }
+        if (partialCost >= devicePacketCost(colors.size())) {
+            sendAll(batch, device, colors, sent);
+            return;
+        }
+
+        ledIdx = 0;
+        for (size_t z = 0; z < zoneCount; z++) {
+            const ZoneDiff& diff = zoneDiffs[z];
+            const size_t zoneLEDs = zoneLEDCount(z);
+            if (diff.changed > 0 and diff.uniform and zonePacketCost(zoneLEDs) < diff.changed * singleLEDPacketCost()) {
+                batch.updateZoneLEDs(device.idx, device.zones[z].idx, colors[ledIdx], zoneLEDs);
+                std::copy_n(colors.begin() + ledIdx, zoneLEDs, sent.begin() + ledIdx);
+            }
+            else if (diff.changed > 0) {
+                for (size_t i = ledIdx; i < ledIdx + zoneLEDs; i++) {
+                    if (isSameColor(colors[i], sent[i])) { continue; }
+                    batch.updateSingleLED(device.idx, i, colors[i]);
+                    sent[i] = colors[i];
+                }
+            }
+            ledIdx += zoneLEDs;
+        }
+    }
+}
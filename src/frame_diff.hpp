@@ -0,0 +1,74 @@
+#pragma once
+
+#include "device_inventory.hpp"
+#include "device_table.hpp"
+#include "frame_batch.hpp"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace rgb {
+    bool isSameColor(const orgb::Color& color1, const orgb::Color& color2);
+
+    /**
+     * @brief Adds only the LEDs that changed since the last frame to a FrameBatch
+     * @details
+     *  Compares the colors of a device with the colors last sent to it (both stored in a DeviceTable)
+     *  and chooses the cheapest of:
+     *  - nothing, if the frame is identical
+     *  - one UPDATESINGLELED per changed led
+     *  - one UPDATEZONELEDS per changed zone, if all leds of the zone have the same color
+     *  - a single color for the whole device
+     *  - the full led list
+     *  Single led and zone updates can be mixed, the full update is used when it is cheaper than the sum of them.
+     *  Zones must cover the leds of the device in order, otherwise only single led and full updates are used.
+     *  The brightness is applied before comparing, so the sent colors are the scaled ones.
+     */
+    class FrameDiff {
+        public:
+            FrameDiff(UpdateStats& stats) : stats(stats) {};
+            /**
+             * @brief Add the updates for the colors of device i in table to batch
+             * @details
+             *  The colors count as sent. If the batch is not committed successfully, DeviceTable::invalidateSent() must be called.
+             */
+            void send(FrameBatch& batch, DeviceTable& table, size_t i);
+            /**
+             * @brief Add all colors of device i to batch without comparing them
+             * @details
+             *  For animations that change every led in every frame, where comparing and recording the sent colors is wasted work.
+             *  The sent colors of the device become invalid.
+             */
+            void sendFull(FrameBatch& batch, DeviceTable& table, size_t i);
+            /**
+             * @brief send() for colors that are not stored in a DeviceTable
+             * @param sent the colors last sent to device, same size as colors. Set to the colors that were sent
+             * @param sentValid false if the content of sent is unknown, then all leds are sent
+             */
+            void send(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors, std::span<orgb::Color> sent, bool sentValid);
+            /// sendFull() for colors that are not stored in a DeviceTable
+            void sendFull(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors);
+            /// Scale all colors by brightness / 255 before sending them
+            void setBrightness(uint8_t brightness) { this->brightness = brightness; }
+
+        private:
+            struct ZoneDiff {
+                size_t changed = 0;
+                bool uniform = true;
+            };
+            /// @returns colors scaled by brightness, in scaledColors unless the brightness is 255
+            std::span<const orgb::Color> applyBrightness(std::span<const orgb::Color> colors);
+            /// Add a device color or the full led list to batch
+            void sendColors(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors);
+            /// Send colors and record them in sent
+            void sendAll(FrameBatch& batch, const DeviceInfo& device, std::span<const orgb::Color> colors, std::span<orgb::Color> sent);
+            /// @returns true if the zones of device cover its leds
+            static bool zonesCoverLEDs(const DeviceInfo& device, size_t ledCount);
+            UpdateStats& stats;
+            uint8_t brightness = 255;
+            /// reused for every frame
+            std::vector<ZoneDiff> zoneDiffs;
+            std::vector<orgb::Color> scaledColors;
+    };
+}
@@ -3,16 +3,27 @@
 #include "OpenRGB/Exceptions.hpp"
 #include "rgb_command.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <system_error>
 #include <csignal>
+#include <gz-util/exceptions.hpp>
 #include <gz-util/file_io.hpp>
-#include <gz-util/settings_manager.hpp>
 #include <gz-util/string/utility.hpp>
 #include <unordered_map>
 
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
 
-using std::this_thread::sleep_for;
 namespace fs = std::filesystem;
 
 gz::Log rgblog(gz::LogCreateInfo{
@@ -29,89 +40,33 @@ namespace rgb {
     // 
     // TIME
     //
-    bool timeInWindow() {
-        auto now = std::chrono::system_clock::now();
-        auto days = std::chrono::time_point_cast<std::chrono::days>(now);
-        auto dayTimeInMinutes = std::chrono::duration_cast<std::chrono::minutes>(now - days);
-        auto untilStart = rgb::startAt - dayTimeInMinutes;
-        auto untilStop = rgb::stopAt - dayTimeInMinutes;
-
-        // 0---start----------stop------------24
-        if (startAt <= stopAt) {
-            return untilStart.count() < 0 and untilStop.count() > 0;
-        }
-        // 0---stop------------start---------24
-        else {
-            return untilStart.count() < 0 or untilStop.count() > 0;
-        }
-    }
-
-
-    void waitForStart() {
-        bool waitForStart = true;
-        while (waitForStart) {
-            if (timeInWindow()) {
-                waitForStart = false;
-            } else {
-                sleep_for(waitForTimeWindow);
-            }
-        }
+    std::chrono::nanoseconds getSuspendedTime() {
+        timespec boottime, monotonic;
+        clock_gettime(CLOCK_BOOTTIME, &boottime);
+        clock_gettime(CLOCK_MONOTONIC, &monotonic);
+        return std::chrono::seconds(boottime.tv_sec - monotonic.tv_sec) + std::chrono::nanoseconds(boottime.tv_nsec - monotonic.tv_nsec);
     }
 
 
     //
-    // PROCESS WATCHER
+    // COMMANDS
     //
-    ProcessWatcher::ProcessWatcher(const std::vector<std::pair<std::string, std::string>>& settings) {
-        size_t i = 0;
-        for (auto it = settings.begin(); it != settings.end(); it++) {
-            process2index[it->first] = i;
-            i++;
-        }
-    }
-
-
-    std::unordered_map<std::string, int>::const_iterator ProcessWatcher::processRunning() {
-        fs::path proc("/proc");
-        fs::path status("status");
-        std::string name;
-        name.reserve(16);
-        std::unordered_map<std::string, int>::const_iterator it = process2index.end();
-        int pid;
-        int processIndex = -1;
-        for (const auto& entry : fs::directory_iterator(proc)) {
-            if (!fs::is_directory(entry)) { continue; }
-            try {
-                pid = std::stoi(entry.path().filename().c_str());
-            } 
-            catch (std::invalid_argument& e) { continue; }
-            if (checkedPIDs.contains(pid)) { continue; }
-            if (!fs::is_regular_file(entry.path() / status)) {
-                checkedPIDs.insert(pid);
-                continue;
+    int getCommandIndex(const std::string& command, orgb::Color& color) {
+        const std::string colorHex = "colorHex";
+        if (command.compare(0, colorHex.size(), colorHex) == 0) {
+            std::string hex = command.substr(colorHex.size());
+            if (hex.size() != 6 or hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+                return -1;
             }
-            std::ifstream cmdlineFile(entry.path() / status);
-            getline(cmdlineFile, name);
-            if (name.empty()) {
-                checkedPIDs.insert(pid);
-                continue;
-            }
-
-            name.erase(0, 6);
-            if (process2index.contains(name)) {
-                /* rgblog("processRunning: Found process", name); */
-                // check priorities
-                if (processIndex < 0 or (process2index[name] > processIndex)) {
-                    processIndex = process2index[name];
-                    it = process2index.find(name);
-                }
-            }
-            else {
-                checkedPIDs.insert(pid);
+            color.fromString(hex);
+            return 0;
+        }
+        for (size_t i = 0; i < externalCommandSettingVec.size(); i++) {
+            if (command == externalCommandSettingVec[i].first) {
+                return i;
             }
         }
-        /* rgblog("processRunning: Returning", processIndex, process2SettingVec[processIndex].first); */
-        return it;
+        return -1;
     }
 
 
@@ -123,86 +78,66 @@ namespace rgb {
             fs::create_directory(cmdDir);
             fs::permissions(cmdDir, fs::perms::owner_all | fs::perms::group_all | fs::perms::others_all);
         }
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0 and inotify_add_watch(inotifyFd, cmdDir.c_str(), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+            close(inotifyFd);
+            inotifyFd = -1;
+        }
+        if (inotifyFd < 0) {
+            rgblog.warning("File Watcher: Could not watch " + cmdDir.string() + " with inotify: '" + std::string(std::strerror(errno)) + "'. Falling back to scanning the directory.");
+        }
     }
 
 
-    int FileWatcher::fileCommandReceived() {
-        int cmdIndex = -1;
-        for (const auto& entry : fs::directory_iterator(cmdDir)) {
-            if (fs::is_regular_file(entry)) {
-                if (entry.path().filename().string().compare(0, colorHex.size(), colorHex) == 0) {
-                    rgblog(entry.path().filename().string().substr(colorHex.size()));
-                    color.fromString(entry.path().filename().string().substr(colorHex.size()));
-                    cmdIndex = 0;
-                }
-                else {
-                    for (size_t i = 0; i < externalCommandSettingVec.size(); i++) {
-                        if (entry.path().filename().c_str() == externalCommandSettingVec[i].first) {
-                            cmdIndex = i;
-                        }
-                    }
-                }
-                fs::remove(entry);
-            }
+    FileWatcher::~FileWatcher() {
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
         }
-        return cmdIndex;
     }
 
 
-    // 
-    // RGB THREAD
-    //
-    void App::rgbControllerThreadFunction(gz::Queue<RGBCommand>* q, std::atomic<int>* returnCode) {
-        *returnCode = -1;
-        unsigned int tries = 1;
-        RGBController controller;
-        while (tries <= MAX_TRY_TO_CONNCET) {
-            try {
-                controller.init(targetDeviceTypes);
-                break;
-            }
-            catch (orgb::Exception& e) {
-                if (tries == MAX_TRY_TO_CONNCET) {
-                    rgblog.error("Could not connect to OpenRGB server. Try [", tries, "/", MAX_TRY_TO_CONNCET, "], giving up.");
-                    *returnCode = 1;
-                    return;
-                }
-                else {
-                    rgblog.error("Could not connect to OpenRGB server. Is it running? Retrying in " + std::to_string(retryConnectDelay.count()) + "s. [", tries, "/", MAX_TRY_TO_CONNCET, "]");
-                    sleep_for(retryConnectDelay);
+    bool FileWatcher::consumeFile(const std::string& filename) {
+        std::error_code ec;
+        return fs::remove(cmdDir / filename, ec);
+    }
+
+
+    int FileWatcher::fileCommandReceived() {
+        int cmdIndex = -1;
+        if (inotifyFd >= 0) {
+            alignas(inotify_event) char buffer[FILE_EVENT_BUFFER_SIZE];
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (ssize_t offset = 0; offset < length;) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+                    offset += sizeof(inotify_event) + event->len;
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        scanRequired = true;
+                        continue;
+                    }
+                    if (event->len == 0 or event->mask & IN_ISDIR) { continue; }
+                    // touch creates IN_CREATE and IN_CLOSE_WRITE, only the first one finds the file
+                    std::string filename(event->name);
+                    if (consumeFile(filename)) {
+                        int index = getCommandIndex(filename, color);
+                        if (index >= 0) { cmdIndex = index; }
+                    }
                 }
             }
-            tries++;
-        }
-        bool running = true;
-        while (running) {
-            if (q->hasElement()) {
-                /* auto vec = q->getInternalBuffer(); */
-                /* for (size_t i = 0; i < vec.size(); i++) { */
-                /*     std::cout << i << " - " << to_string(vec[i].setting.color) << '\n'; */
-                /* } */
-
-                RGBCommand command = q->getCopy();
-                switch (command.type) {
-                    case RGBCommandType::CHANGE_SETTING:
-                        controller.changeSetting(command.setting);
-                        break;
-                    case RGBCommandType::RESUME_FROM_HIBERNATE:
-                        controller.reSetSettings();
-                        break;
-                    case RGBCommandType::SLEEP:
-                        /* rgblog("controllerThread sleeping for", rgbSleepCmdDuration.count()); */
-                        sleep_for(rgbSleepCmdDuration);
-                        break;
-                    case RGBCommandType::QUIT:
-                        running = false;
-                        break;
+        }
+        if (scanRequired or inotifyFd < 0) {
+            for (const auto& entry : fs::directory_iterator(cmdDir)) {
+                if (fs::is_regular_file(entry)) {
+                    std::string filename = entry.path().filename().string();
+                    if (consumeFile(filename)) {
+                        int index = getCommandIndex(filename, color);
+                        if (index >= 0) { cmdIndex = index; }
+                    }
                 }
             }
-            controller.update();
-            sleep_for(rgbUpdateDuration);
+            scanRequired = false;
         }
-        *returnCode = 0;
+        return cmdIndex;
     }
 
 
@@ -211,24 +146,28 @@ namespace rgb {
     //
     App* App::app = nullptr;
 
-    void App::handleSignal(int sig) {
-        rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Signal handler:", "Received signal", sig);
-        if (app != nullptr) {
-            app->q.emplace_back(RGBCommand{ RGBCommandType::CHANGE_SETTING, clearSetting });
-            rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Signal handler:", "Joining thread. This might take up to", std::chrono::duration_cast<std::chrono::seconds>(rgbSleepCmdDuration).count(), "seconds.");
-            app->q.emplace_back(RGBCommand{ RGBCommandType::QUIT, idleSetting });
-            app->rgbControllerThread.join();
-            rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Signal handler:", "Thread joined. Exiting");
-            std::exit(0);
-        } 
-        else {
-            rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Signal handler:", "Error: Could not find running instance of App");
-            std::exit(1);
-        }
+    /**
+     * @brief Block the signals handled by App in the calling thread and all threads created afterwards
+     * @returns a signalfd for the signals
+     */
+    static int createSignalFd() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGUSR1);
+        sigaddset(&signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        return signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
     }
 
 
-    App::App(gz::SettingsManagerCreateInfo<RGBSetting>& smCI) : settings(smCI), q(4, 10), rgbControllerThread(rgbControllerThreadFunction, &q, &rgbControllerThreadReturnCode) {
+    App::App() 
+        : config(loadInitialConfig()), 
+          configWatcher(CONFIG_FILE),
+          signalFd(createSignalFd()), 
+          controllerThread(&config) 
+    {
         rgblog("Started gz-rgb");
         /* rgblog("Settings:", settings); */
         if (app != nullptr) {
@@ -242,156 +181,507 @@ namespace rgb {
         app = nullptr;
     }
 
-    void App::run() {
-        std::signal(SIGTERM, &App::handleSignal);
-        std::signal(SIGINT, &App::handleSignal);
-        q.emplace_back(RGBCommand{ RGBCommandType::CHANGE_SETTING, settings.getOr<RGBSetting>("clearSetting", clearSetting) });
 
-        std::vector<std::pair<std::string, std::string>> settingsVector;
+    Config App::getDefaultConfig() {
+        Config defaults;
+        defaults.clearSetting = clearSetting;
+        defaults.idleSetting = idleSetting;
+        defaults.schedule = Schedule(parseTimeWindows(defaultSchedule), {}, getTimeZone(""));
+        defaults.brightness = brightnessFromPercent(defaultBrightness);
+        defaults.servers = parseServerAddresses(defaultServers);
+        return defaults;
+    }
+
+
+    std::shared_ptr<const Config> App::loadInitialConfig() {
+        Config defaults = getDefaultConfig();
+        std::vector<std::string> errors;
+        std::shared_ptr<const Config> loaded;
         try {
-            settingsVector = gz::readKeyValueFile<std::vector<std::pair<std::string, std::string>>>(CONFIG_FILE);
+            loaded = loadConfig(CONFIG_FILE, defaults, errors);
         }
         catch (gz::FileIOError& e) {
-            rgblog.error("Could not read settings, an error occured: '" + std::string(e.what()) + "'.");
+            rgblog.error("Could not read settings, an error occured: '" + std::string(e.what()) + "'. Using the defaults.");
+            return std::make_shared<const Config>(std::move(defaults));
         }
-        rgb::ProcessWatcher processWatcher(settingsVector);
+        for (const std::string& error : errors) {
+            rgblog.error(error);
+        }
+        return loaded;
+    }
 
-        auto currentProcessNameIt = processWatcher.end();
-        auto processNameIt = processWatcher.end();
-        bool watchProcesses = false;
 
-        rgb::FileWatcher fileWatcher;
-        int cmdIndex = -1;
+    void App::reloadConfig() {
+        std::vector<std::string> errors;
+        std::shared_ptr<const Config> newConfig;
+        try {
+            newConfig = loadConfig(CONFIG_FILE, getDefaultConfig(), errors);
+        }
+        catch (gz::FileIOError& e) {
+            rgblog.error("Could not reload settings, keeping the current ones. Error: '" + std::string(e.what()) + "'.");
+            return;
+        }
+        if (!errors.empty()) {
+            for (const std::string& error : errors) {
+                rgblog.error(error);
+            }
+            rgblog.error("Config file has invalid settings, keeping the current ones.");
+            return;
+        }
+
+        std::shared_ptr<const Config> oldConfig = config.exchange(newConfig);
+        auto serversToString = [](const Config& c) {
+            std::string s;
+            for (const ServerAddress& server : c.servers) { s += server.toString() + ","; }
+            return s;
+        };
+        if (serversToString(*oldConfig) != serversToString(*newConfig)) {
+            rgblog.warning("The servers were changed, restart gz-rgb to use them.");
+        }
+        if (oldConfig->focus != newConfig->focus) {
+            rgblog.warning("The focus source was changed, restart gz-rgb to use it.");
+        }
+        rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Config", "Reloaded", CONFIG_FILE, "with", newConfig->processSettings.size(), "process settings");
+        // the controller thread sets the new brightness when it wakes up
+        controllerThread.getQueue().interrupt();
+
+        // the iterators into the old process names are invalid
+        processWatcher->setProcessNames(newConfig->getProcessNames());
+        currentProcessNameIt = processWatcher->end();
+        processSettingSent = false;
+        scheduledSettingIndex = newConfig->schedule.getActiveSetting(std::chrono::system_clock::now());
+        armScheduleTimer();
+        if (watchProcesses) {
+            // only send the setting if it changed, so that a running animation continues
+            auto processNameIt = getActiveProcess();
+            const RGBSetting& setting = getProcessSetting(*newConfig, processNameIt);
+            currentProcessNameIt = processNameIt;
+            processSettingSent = true;
+            if (setting.toString() != currentSetting.toString()) {
+                pushCommand(RGBCommand{ RGBCommandType::CHANGE_SETTING, setting });
+            }
+        }
+        // the time window might have changed
+        checkTimeWindow();
+    }
+
+
+    const RGBSetting& App::getProcessSetting(const Config& config, std::unordered_map<std::string, int>::const_iterator processNameIt) const {
+        if (processNameIt == processWatcher->end()) {
+            if (scheduledSettingIndex >= 0) { return config.scheduledSettings.at(scheduledSettingIndex); }
+            return config.idleSetting;
+        }
+        return config.processSettings.at(processNameIt->second).second;
+    }
+
+
+    void App::pushCommand(RGBCommand&& command) {
+        auto latency = std::chrono::steady_clock::now() - eventLoop.getEventTime();
+        rgblog.clog({ gz::Color::BLUE, gz::Color::RESET }, "Command", ::toString(command.type), "queued", std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), "us after event");
+        if (command.type == RGBCommandType::CHANGE_SETTING) {
+            currentSetting = command.setting;
+        }
+        if (!controllerThread.getQueue().push(command)) {
+            rgblog.error("Command queue is full, dropping", ::toString(command.type), "command. Is the rgb controller thread stuck?");
+        }
+    }
+
+
+    void App::setWatchProcesses(bool watch) {
+        watchProcesses = watch;
+        currentProcessNameIt = processWatcher->end();
+        processSettingSent = false;
+        if (processWatcher->isEventDriven()) {
+            eventLoop.setEnabled(processWatcher->getFd(), watch);
+        }
+        if (watch) {
+            // the events that arrived while disabled are not read, and the socket buffer might have overrun
+            if (processWatcher->isEventDriven()) { processWatcher->resync(); }
+            checkProcesses();
+        }
+    }
+
+
+    std::unordered_map<std::string, int>::const_iterator App::getActiveProcess() const {
+        if (focusWatcher) {
+            return processWatcher->processRunningUnder(focusedPID);
+        }
+        return processWatcher->processRunning();
+    }
+
+
+    void App::checkProcesses() {
+        processWatcher->update();
+        // measure the latency from the process event instead of the epoll wakeup
+        if (auto changeTime = processWatcher->getChangeTime(); changeTime != std::chrono::steady_clock::time_point()) {
+            eventLoop.setEventTime(changeTime);
+        }
+        auto processNameIt = getActiveProcess();
+        if (processNameIt == currentProcessNameIt and processSettingSent) { return; }
+        processSettingSent = true;
+
+        if (processNameIt != processWatcher->end()) {
+            rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Process Watcher", "Found new running process:", processNameIt->first);
+        }
+        else {
+            rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Process Watcher", "No wanted process found: Resetting color.");
+        }
+        pushCommand(RGBCommand{ RGBCommandType::CHANGE_SETTING, getProcessSetting(*config.load(), processNameIt) });
+        currentProcessNameIt = processNameIt;
+    }
+
+
+    void App::handleFocusEvents(Timer& debounceTimer) {
+        std::optional<int> pid;
+        try {
+            pid = focusWatcher->readFocus();
+        }
+        catch (std::exception& e) {
+            rgblog.error("Focus Watcher: " + std::string(e.what()) + ". Following all running processes.");
+            eventLoop.remove(focusWatcher->getFd());
+            focusWatcher.reset();
+            debounceTimer.disarm();
+            if (watchProcesses) { checkProcesses(); }
+            return;
+        }
+        if (!pid) { return; }
+        focusEvents++;
+        pendingFocusedPID = *pid;
+        // every change restarts the timer, only the focus that stays is applied
+        debounceTimer.setTimeout(FOCUS_DEBOUNCE_DURATION);
+    }
 
-        bool checkTime = true;
 
-        // for hibernation check
-        std::chrono::time_point<std::chrono::system_clock> timeAtLastExecution = std::chrono::system_clock::now();
-        
-        bool running = true;
-        while (running) {
+    void App::handleSleepEvents(Timer& releaseTimer) {
+        std::optional<bool> sleeping;
+        try {
+            sleeping = sleepWatcher->readSleep();
+        }
+        catch (std::exception& e) {
+            rgblog.error("Sleep Watcher: " + std::string(e.what()) + ". Only checking the clocks for resume.");
+            eventLoop.remove(sleepWatcher->getFd());
+            sleepWatcher.reset();
+            releaseTimer.disarm();
+            return;
+        }
+        if (!sleeping) { return; }
+        sleepAnnounced = *sleeping;
+        if (*sleeping) {
+            rgblog("Sleep Watcher: Preparing for sleep");
+            sleepCount++;
+            pushCommand(RGBCommand{ RGBCommandType::SUSPEND, idleSetting });
+            // upper bound, the lock is released earlier when the controller reports that black was sent
+            releaseTimer.setTimeout(SLEEP_INHIBIT_RELEASE_DELAY);
+        }
+        else {
+            rgblog("Sleep Watcher: Resumed from sleep");
+            resumeCount++;
+            // the lock might still be held if the sleep was canceled
+            releaseTimer.disarm();
+            pushCommand(RGBCommand{ RGBCommandType::RESUME_FROM_HIBERNATE, idleSetting });
+            // already handled, checkHibernate() would resume again
+            suspendedTimeAtLastCheck = getSuspendedTime();
+            sleepWatcher->takeInhibitor();
+        }
+    }
+
+
+    void App::handleCommand(int cmdIndex, const orgb::Color& color, const std::string& source) {
+        if (cmdIndex < 0) { return; }
+        checkTime = false;
+        if (cmdIndex == 0) {
+            rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, source, "Setting color from hex.");
+            setWatchProcesses(false);
+            RGBCommand command { RGBCommandType::CHANGE_SETTING, externalCommandSettingVec[cmdIndex].second };
+            command.setting.color = color;
+            pushCommand(std::move(command));
+        }
+        else if (cmdIndex == 1) {
+            rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, source, "Starting process watching.");
+            setWatchProcesses(true);
+        }
+        else if (cmdIndex == 2) {
+            rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, source, "Quit command received");
+            eventLoop.stop();
+        }
+        else {
+            rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, source, externalCommandSettingVec[cmdIndex].first);
+            setWatchProcesses(false);
+            pushCommand(RGBCommand{ RGBCommandType::CHANGE_SETTING, externalCommandSettingVec[cmdIndex].second });
+        }
+    }
+
+
+    protocol::Response App::handleRequest(const std::string& request) {
+        if (request == "stats") {
+            return { protocol::OK, getStats() };
+        }
+        orgb::Color color;
+        int cmdIndex = getCommandIndex(request, color);
+        if (cmdIndex >= 0) {
+            handleCommand(cmdIndex, color, "Command Socket");
+            return { protocol::OK, currentSetting.toString() };
+        }
+        try {
+            RGBSetting setting = fromString<RGBSetting>(request);
+            rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, "Command Socket", "Setting", request);
+            checkTime = false;
+            setWatchProcesses(false);
+            pushCommand(RGBCommand{ RGBCommandType::CHANGE_SETTING, setting });
+            return { protocol::OK, currentSetting.toString() };
+        }
+        catch (gz::InvalidArgument& e) {
+            return { protocol::ERROR, "Invalid command: '" + request + "'" };
+        }
+    }
+
+
+    void App::checkTimeWindow() {
+        std::shared_ptr<const Config> currentConfig = config.load();
+        const auto now = std::chrono::system_clock::now();
+        const int scheduled = currentConfig->schedule.getActiveSetting(now);
+        if (scheduled != scheduledSettingIndex) {
+            scheduledSettingIndex = scheduled;
+            if (scheduled >= 0) {
+                rgblog("Schedule: Using the setting from", currentConfig->schedule.getSettingTimes().at(scheduled).toString(), "when no process is running");
+            }
+            else {
+                rgblog("Schedule: Using the idle setting when no process is running");
+            }
+            // the setting of a running process stays
+            if (currentProcessNameIt == processWatcher->end()) { processSettingSent = false; }
+        }
+        if (!checkTime) { return; }
+        if (currentConfig->schedule.isInWindow(now)) {
+            if (!watchProcesses) {
+                rgblog("Now in time window - enabling process watching");
+                setWatchProcesses(true);
+            }
+            else if (!processSettingSent) {
+                checkProcesses();
+            }
+        }
+        else {
             if (watchProcesses) {
-                processNameIt = processWatcher.processRunning();
-                if (processNameIt != currentProcessNameIt) {
-                    if (processNameIt != processWatcher.end()) {
-                        rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Process Watcher", "Found new running process:", processNameIt->first);
-                        RGBCommand command;
-                        try {
-                            command = { RGBCommandType::CHANGE_SETTING, settings.get<RGBSetting>(processNameIt->first) };
-                        }
-                        catch(gz::InvalidArgument& e) {
-                            rgblog.error("Could not find setting for process: '" + processNameIt->first + "'. Using idleSetting.");
-                            command = { RGBCommandType::CHANGE_SETTING, settings.getOr<RGBSetting>("idleSetting", idleSetting) };
-                        }
-                        catch(gz::InvalidType& e) {
-                            rgblog.error("An error occured while trying to get setting for process: '" + processNameIt->first + "'. Using idleSetting. Error:", e.what());
-                            command = { RGBCommandType::CHANGE_SETTING, settings.getOr<RGBSetting>("idleSetting", idleSetting) };
-                        }
-
-                        q.push_back(command);
-                        currentProcessNameIt = processNameIt;
-                    }
-                    else {
-                        rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Process Watcher", "No wanted process found: Resetting color.");
-                        RGBCommand command { RGBCommandType::CHANGE_SETTING, settings.getOr<RGBSetting>("idleSetting", idleSetting) };
-                        q.push_back(command);
-                        currentProcessNameIt = processWatcher.end();
-                    }
-                }
+                // the lights are off outside of the time window, like before the first window starts.
+                // a command that was sent through the socket or a file stays, because it disables checkTime
+                rgblog("Time window ended - disabling process watching");
+                setWatchProcesses(false);
+                pushCommand(RGBCommand{ RGBCommandType::CHANGE_SETTING, config.load()->clearSetting });
             }
+        }
+    }
 
-            // watch files
-            cmdIndex = fileWatcher.fileCommandReceived();
-            if (cmdIndex >= 0) {
-                checkTime = false;
-                if (cmdIndex == 0) {
-                    rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, "File Watcher", "Setting color from hex.");
-                    watchProcesses = false;
-                    RGBCommand command { RGBCommandType::CHANGE_SETTING, externalCommandSettingVec[cmdIndex].second };
-                    command.setting.color = fileWatcher.getColor();
-                    q.emplace_back(std::move(command));
-                }
-                else if (cmdIndex == 1) {
-                    rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, "File Watcher", "Starting process watching.");
-                    watchProcesses = true;
-                    currentProcessNameIt = processWatcher.end();
-                }
-                else if (cmdIndex == 2) {
-                    rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, "File Watcher", "Quit command received");
-                    running = false;
-                }
-                else {
-                    rgblog.clog({ gz::Color::CYAN, gz::Color::RESET }, "File Watcher", externalCommandSettingVec[cmdIndex].first);
-                    watchProcesses = false;
-                    RGBCommand command { RGBCommandType::CHANGE_SETTING, externalCommandSettingVec[cmdIndex].second };
-                    q.emplace_back(std::move(command));
-                }
-            }
 
-            // check time
-            if (checkTime) {
-                if (timeInWindow()) {
-                    rgblog("Now in time window - enabling process watching");
-                    checkTime = false;
-                    watchProcesses = true;
-                }
-                else {
-                    q.emplace_back(RGBCommand { RGBCommandType::SLEEP });
-                    std::this_thread::sleep_for(waitForTimeWindow);
-                }
-            }
+    void App::armScheduleTimer() {
+        // time_point::max() if there is no transition, a disarmed timer would not be canceled by a clock change
+        scheduleTimerTime = config.load()->schedule.getNextTransition(std::chrono::system_clock::now());
+        scheduleTimer.setTime(scheduleTimerTime);
+    }
 
-            // check if system was suspended or hibernated
-            if (checkForHibernate) {
-                auto now = std::chrono::system_clock::now();
-                if (now - timeAtLastExecution > hibernateTimeThreshold) {
-                    rgblog("Resume from hibernation detected.");
-                    q.emplace_back(RGBCommand { RGBCommandType::RESUME_FROM_HIBERNATE });
-                }
-                timeAtLastExecution = std::move(now);
+
+    void App::checkHibernate() {
+        auto suspendedTime = getSuspendedTime();
+        // after waking up, the timer might fire before the signal of logind is read, which then resumes
+        if (suspendedTime - suspendedTimeAtLastCheck > hibernateTimeThreshold and !(sleepWatcher and sleepAnnounced)) {
+            rgblog("Resume from hibernation detected.");
+            driftResumeCount++;
+            pushCommand(RGBCommand{ RGBCommandType::RESUME_FROM_HIBERNATE, idleSetting });
+        }
+        suspendedTimeAtLastCheck = suspendedTime;
+    }
+
+
+    void App::handleSignal() {
+        signalfd_siginfo info;
+        while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+            rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Signal handler:", "Received signal", info.ssi_signo);
+            if (info.ssi_signo == SIGUSR1) {
+                logStats();
+            }
+            else if (info.ssi_signo == SIGHUP) {
+                reloadConfig();
+            }
+            else {
+                exit(0);
             }
+        }
+    }
+
+
+    void App::logStats() {
+        rgblog.clog({ gz::Color::YELLOW, gz::Color::RESET }, "Statistics", "\n" + getStats());
+    }
+
+
+    std::string App::getStats() const {
+        std::string stats;
+        auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - startTime);
+        stats += "Uptime: " + std::to_string(uptime.count()) + "s";
+        const ControllerStats& controllerStats = controllerThread.getStats();
+        const uint64_t wakeups = controllerStats.wakeups;
+        // the rate is well below 1/s while nothing is animated
+        std::stringstream wakeupRate;
+        wakeupRate << std::fixed << std::setprecision(2) << static_cast<double>(wakeups) / std::max<int64_t>(uptime.count(), 1);
+        stats += "\nController wakeups: " + std::to_string(wakeups) + " (" + wakeupRate.str() + "/s)";
+        stats += "\nCommands: received: " + std::to_string(controllerStats.commandsReceived)
+            + ", coalesced: " + std::to_string(controllerStats.commandsCoalesced)
+            + ", settings applied: " + std::to_string(controllerStats.commandsApplied);
+        stats += "\nUpdates: " + controllerStats.updates.toString();
+        stats += "\nDropped commands: " + std::to_string(controllerThread.getQueue().getDroppedCount());
+        if (processWatcher) {
+            stats += "\nPID cache: " + processWatcher->getPIDCacheStats();
+        }
+        if (focusWatcher) {
+            stats += "\nFocus: events: " + std::to_string(focusEvents) + ", applied: " + std::to_string(focusChanges) + ", focused pid: " + std::to_string(focusedPID);
+        }
+        stats += "\nSleep: suspends: " + std::to_string(sleepCount) + ", resumes: " + std::to_string(resumeCount)
+            + ", detected by clock drift: " + std::to_string(driftResumeCount) + ", logind: " + (sleepWatcher ? "yes" : "no");
+        return stats;
+    }
+
+
+    void App::run() {
+        pushCommand(RGBCommand{ RGBCommandType::CHANGE_SETTING, config.load()->clearSetting });
+
+        processWatcher = std::make_unique<ProcessWatcher>(config.load()->getProcessNames());
+        currentProcessNameIt = processWatcher->end();
+
+        eventLoop.add(signalFd, [this]() { handleSignal(); });
+        if (configWatcher.getFd() >= 0) {
+            eventLoop.add(configWatcher.getFd(), [this]() {
+                if (configWatcher.fileChanged()) { reloadConfig(); }
+            });
+        }
+        else {
+            rgblog.warning("Can not watch", CONFIG_FILE, "for changes, send SIGHUP to reload it.");
+        }
+        eventLoop.add(controllerThread.getExitFd(), [this]() {
+            rgblog.error("The rgb controller thread has exited with code", controllerThread.getReturnCode(), "- Exiting.");
+            exit(1);
+        });
+
+        // process watching
+        Timer processScanTimer;
+        if (processWatcher->isEventDriven()) {
+            eventLoop.add(processWatcher->getFd(), [this]() {
+                if (watchProcesses) { checkProcesses(); }
+            });
+            eventLoop.setEnabled(processWatcher->getFd(), false);
+        }
+        else {
+            processScanTimer.setInterval(manageRGBDuration);
+            eventLoop.add(processScanTimer.getFd(), [this, &processScanTimer]() {
+                processScanTimer.read();
+                if (watchProcesses) { checkProcesses(); }
+            });
+        }
+
+        // focus watching
+        Timer focusDebounceTimer;
+        const FocusSource focusSource = config.load()->focus;
+        try {
+            focusWatcher = createFocusWatcher(focusSource);
+        }
+        catch (std::exception& e) {
+            rgblog.error("Focus Watcher: Can not follow the focus from " + focusSource.toString() + ": '" + std::string(e.what()) + "'. Following all running processes.");
+        }
+        if (focusWatcher) {
+            rgblog("Focus Watcher: Following the focused window from", focusSource.toString());
+            eventLoop.add(focusWatcher->getFd(), [this, &focusDebounceTimer]() { handleFocusEvents(focusDebounceTimer); });
+            eventLoop.add(focusDebounceTimer.getFd(), [this, &focusDebounceTimer]() {
+                focusDebounceTimer.read();
+                if (pendingFocusedPID == focusedPID) { return; }
+                focusedPID = pendingFocusedPID;
+                focusChanges++;
+                if (watchProcesses) { checkProcesses(); }
+            });
+            // the current focus
+            handleFocusEvents(focusDebounceTimer);
+        }
+
+        // file watching
+        Timer fileScanTimer;
+        if (fileWatcher.isEventDriven()) {
+            eventLoop.add(fileWatcher.getFd(), [this]() { handleCommand(fileWatcher.fileCommandReceived(), fileWatcher.getColor(), "File Watcher"); });
+        }
+        else {
+            fileScanTimer.setInterval(manageRGBDuration);
+            eventLoop.add(fileScanTimer.getFd(), [this, &fileScanTimer]() {
+                fileScanTimer.read();
+                handleCommand(fileWatcher.fileCommandReceived(), fileWatcher.getColor(), "File Watcher");
+            });
+        }
 
-            // check if the rgbControllerThread exited
-            if (rgbControllerThreadReturnCode >= 0) {
-                rgblog.error("rgbControllerThread has exited with code", rgbControllerThreadReturnCode, "- Exiting.");
-                exit(1);
+        commandSocket = std::make_unique<CommandSocket>(eventLoop, [this](const std::string& request) { return handleRequest(request); });
+
+        // schedule
+        // the resume check runs when the schedule timer wakes up, in case logind is not available or a signal was missed
+        suspendedTimeAtLastCheck = getSuspendedTime();
+        armScheduleTimer();
+        eventLoop.add(scheduleTimer.getFd(), [this]() {
+            // also expires when the system clock was changed, which the kernel does after every resume.
+            // the timer might have expired during the suspend, so the clocks are checked regardless of read()
+            if (scheduleTimer.read()) {
+                // measure the latency from the transition instead of the epoll wakeup
+                eventLoop.setEventTime(std::chrono::steady_clock::now() - (std::chrono::system_clock::now() - scheduleTimerTime));
+            }
+            if (checkForHibernate) { checkHibernate(); }
+            armScheduleTimer();
+            checkTimeWindow();
+        });
+        // sleep
+        Timer inhibitReleaseTimer;
+        if (watchSleep) {
+            try {
+                sleepWatcher = std::make_unique<SleepWatcher>();
             }
+            catch (std::exception& e) {
+                rgblog.warning("Sleep Watcher: Can not follow logind: '" + std::string(e.what()) + "'. Only checking the clocks for resume.");
+            }
+        }
+        if (sleepWatcher) {
+            sleepWatcher->takeInhibitor();
+            eventLoop.add(sleepWatcher->getFd(), [this, &inhibitReleaseTimer]() { handleSleepEvents(inhibitReleaseTimer); });
+            eventLoop.add(inhibitReleaseTimer.getFd(), [this, &inhibitReleaseTimer]() {
+                inhibitReleaseTimer.read();
+                if (sleepWatcher) {
+                    rgblog.warning("Sleep Watcher: Black was not sent within", SLEEP_INHIBIT_RELEASE_DELAY.count(), "ms, allowing sleep anyway");
+                    sleepWatcher->releaseInhibitor();
+                }
+            });
+            eventLoop.add(controllerThread.getSuspendFd(), [this, &inhibitReleaseTimer]() {
+                uint64_t count;
+                while (read(controllerThread.getSuspendFd(), &count, sizeof(count)) < 0 and errno == EINTR);
+                // a late report after waking up must not release the new lock
+                if (sleepWatcher and sleepAnnounced) {
+                    inhibitReleaseTimer.disarm();
+                    sleepWatcher->releaseInhibitor();
+                }
+            });
+        }
 
-            std::this_thread::sleep_for(manageRGBDuration);
-        }  // while
+        // files created before the start
+        handleCommand(fileWatcher.fileCommandReceived(), fileWatcher.getColor(), "File Watcher");
+        checkTimeWindow();
 
+        eventLoop.run();
+        // quit command
         exit(0);
     }
 
 
     void App::exit(int exitcode) {
-        q.emplace_back(RGBCommand{ RGBCommandType::CHANGE_SETTING, clearSetting });
-        q.emplace_back(RGBCommand{ RGBCommandType::QUIT, idleSetting });
-        rgbControllerThread.join();
+        logStats();
+        commandSocket.reset();
+        controllerThread.stop(config.load()->clearSetting);
         std::exit(exitcode);
     }
 }
 
 
 int main(int argc, char* argv[]) {
-    /* rgb::waitForStart(); */
-    gz::SettingsManagerCreateInfo<rgb::RGBSetting> smCI{};
-    smCI.initialValues = {
-        // rgb stuff
-        { "clearSetting", gz::toString(rgb::clearSetting) },
-        { "idleSetting", gz::toString(rgb::idleSetting) },
-        /* { "FILE_COMMAND_DIR", rgb::FILE_COMMAND_DIR }, */
-    };
-    smCI.filepath = rgb::CONFIG_FILE;
-    smCI.readFileOnCreation = true;
-
-    rgb::App app(smCI);
+    rgb::App app;
     app.run();
-
-    /* std::chrono::duration minute { 1min }; */
-    /* for (int i = 0; i < 23; i++) { */
-    /*     auto minutes = minute * 60 * i; */
-    /*     std::cout << i << " - " << rgb::timeInWindow(minutes) << '\n'; */
-    /* } */
     return 2;
 }
@@ -1,19 +1,26 @@
 #pragma once
 
+#include "command_queue.hpp"
+#include "command_socket.hpp"
+#include "config.hpp"
+#include "controller_thread.hpp"
+#include "event_loop.hpp"
+#include "focus_watcher.hpp"
+#include "process_watcher.hpp"
 #include "rgb_command.hpp"
 #include "rgb_controller.hpp"
+#include "sleep_watcher.hpp"
 
-#include <gz-util/container/queue.hpp>
-#include <gz-util/settings_manager.hpp>
 #include <gz-util/log.hpp>
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <filesystem>
 #include <functional>
 #include <gz-util/string/utility.hpp>
-#include <thread>
+#include <memory>
 #include <unordered_map>
-#include <set>
 
 using namespace std::chrono_literals;
 
@@ -22,7 +29,7 @@ namespace rgb {
     // SETTINGS
     //
     /// The default device types affected by this program
-    const std::set<orgb::DeviceType> targetDeviceTypes { 
+    const DeviceTypeMask targetDeviceTypes { 
         orgb::DeviceType::Motherboard, 
         orgb::DeviceType::DRAM, 
         orgb::DeviceType::Mouse,
@@ -30,9 +37,8 @@ namespace rgb {
     };
 
     // START TIME
-    /// when to start and stop the rgb lighting. these must be in utc-0
-    const std::chrono::duration startAt {18h + 30min};
-    const std::chrono::duration stopAt {8h + 25min};
+    /// when process watching is enabled, in local time, "schedule" in the config file (see parseTimeWindows())
+    const std::string defaultSchedule = "18:30-08:25";
 
     /// rgb settings for when no targetet process is running
     const RGBSetting clearSetting { targetDeviceTypes, INSTANT, RGBMode::CLEAR, orgb::Color::Black };
@@ -61,113 +67,224 @@ namespace rgb {
     const std::string CONFIG_FILE = "/etc/gz-rgb.conf";
 
     // ENERGY CONSUMPTION vs RESPONSIVENESS
-    /// How long to sleep while waiting for the time window (main thread)
-    const auto waitForTimeWindow = 15s;
-    /// How long to sleep while active (main thread)
+    /// Interval for scanning /proc and FILE_COMMAND_DIR when netlink or inotify are not available (main thread)
     const auto manageRGBDuration = 3s;
-    /// How long to sleep between updates to rgb lighting (rgb controller thread)
+    /// How long to sleep between updates to rgb lighting while fading or in rainbow mode (rgb controller thread)
     const auto rgbUpdateDuration = 33ms;  // ca 30 updates per second
-    const auto rgbSleepCmdDuration = waitForTimeWindow - manageRGBDuration - rgbUpdateDuration;
+    /// How long ControllerThread::stop() waits for space in the command queue, other commands are dropped right away when it is full
+    const auto commandQueuePushTimeout = 100ms;
+
+    // BRIGHTNESS
+    /// Brightness of all leds in percent, "brightness" in the config file
+    const int defaultBrightness = 100;
 
     // HIBERNATION
-    // resend the last command when coming out of hibernate
+    /// turn the lights off before sleep and on after waking up, through the PrepareForSleep signal of systemd-logind
+    const bool watchSleep = true;
+    // resend the last command when coming out of hibernate, fallback if logind is not available or a signal was missed.
+    // Checked whenever the scheduleTimer wakes up, which includes every change of the realtime clock and thus every resume
     const bool checkForHibernate = true;
-    const auto hibernateTimeThreshold = (manageRGBDuration + waitForTimeWindow) * 1.1;
+    /// Minimum time the system has to be suspended before colors are re-set. 
+    /// The time is measured as drift between CLOCK_BOOTTIME and CLOCK_MONOTONIC, which does not advance during suspend
+    const auto hibernateTimeThreshold = 1s;
 
     // LOG
     const std::string logfile = "/var/log/gzrgb.log";
     const bool storeLog = true;
     const bool showLog = true;
 
-    // ERROR
-    const unsigned int MAX_TRY_TO_CONNCET = 5;
-    const auto retryConnectDelay = 5s;
-
     //
     // TIME
     //
-    bool timeInWindow();
-    void waitForStart();
-
-    // 
-    // PROCESS WATCHER
-    //
-    class ProcessWatcher {
-        public:
-            /**
-             * @brief Get the name and priority of the processes to watch for
-             * @param settings A map containing process names as keys
-             */
-            ProcessWatcher(const std::vector<std::pair<std::string, std::string>>& settings);
-            /**
-             * @returns iterator to process-name - index pair with the highest priority that is running or end()
-             */ 
-            std::unordered_map<std::string, int>::const_iterator processRunning();
-            std::unordered_map<std::string, int>::const_iterator end() const { return process2index.end(); };
-
-        private:
-            // index is the priority of the process
-            std::unordered_map<std::string, int> process2index;
-            // store pids that did not match the name to reduce file reading
-            std::set<int> checkedPIDs;
-    };
+    /// @returns the total time the system has been suspended since boot
+    std::chrono::nanoseconds getSuspendedTime();
 
+    /**
+     * @brief Look up an external command
+     * @param color Set to the color of a colorHexRRGGBB command
+     * @returns index of the command in externalCommandSettingVec or -1 if command is invalid
+     */
+    int getCommandIndex(const std::string& command, orgb::Color& color);
 
     //
     // FILE WATCHER
     //
+    /// Size of the buffer for reading inotify events
+    const size_t FILE_EVENT_BUFFER_SIZE = 4096;
+
     class FileWatcher {
         public:
+            /**
+             * @brief Watch FILE_COMMAND_DIR for created files
+             * @details
+             *  Uses inotify if possible, otherwise the directory is scanned on every call to fileCommandReceived().
+             *  Files that already exist are processed by the first call to fileCommandReceived().
+             */
             FileWatcher();
+            ~FileWatcher();
+            FileWatcher(const FileWatcher&) = delete;
+            FileWatcher& operator=(const FileWatcher&) = delete;
+            /**
+             * @brief Process all pending commands, does not block
+             * @returns index of the last received command in externalCommandSettingVec or -1
+             */
             int fileCommandReceived();
             orgb::Color getColor() { return color; }
+            /**
+             * @brief File descriptor that becomes readable when a file was created in cmdDir
+             * @returns the inotify fd or -1 when cmdDir is scanned
+             */
+            int getFd() const { return inotifyFd; }
+            bool isEventDriven() const { return inotifyFd >= 0; }
             
             std::filesystem::path cmdDir;
-            std::string colorHex = "colorHex";
             orgb::Color color;
+
+        private:
+            int inotifyFd = -1;
+            bool scanRequired = true;
+            /// Remove the command file, @returns false if it did not exist (anymore)
+            bool consumeFile(const std::string& filename);
     };
 
 
     class App {
         public:
             /**
-             * @brief Creates the rgbControllerThread.
+             * @brief Loads the config file and starts the controllerThread.
              * @details
+             *  Blocks SIGTERM, SIGINT, SIGUSR1 and SIGHUP before the thread is created, they are received through a signalfd in run()
              */
-            App(gz::SettingsManagerCreateInfo<RGBSetting>& smCI);
+            App();
             ~App();
             App(const App& app) = delete;
             App& operator=(const App&) = delete;
             /**
              * @brief Run gz-rgb
              * @details
-             *  It does:
-             *  - Time checking: check if the time is between startAt and stopAt, if true enable process watching
+             *  Waits for events in an epoll loop and handles:
+             *  - Schedule: one timer at the next transition of the schedule, enables or disables process watching and applies scheduled settings
              *  - File Watching: check if a command is sent through a created file in FILE_COMMAND_DIR
              *  - Process Watching: check if a wanted process from process2SettingVec is running
+             *  - Focus Watching: if enabled, only the processes of the focused window count, changes are debounced with FOCUS_DEBOUNCE_DURATION
+             *  - Sleep: logind PrepareForSleep turns the lights off before sleep and on after waking up, the clock drift check on the schedule timer is the fallback
+             *  - Command Socket: requests through the unix socket at protocol::SOCKET_PATH
+             *  - Config file: reload when it was written (inotify)
+             *  - Signals: SIGTERM and SIGINT exit, SIGUSR1 logs statistics, SIGHUP reloads the config file
              *  - When necessary through one of the above, send RGBCommand through the q to the RGBController thread
              */
             void run();
         private:
-            gz::SettingsManager<RGBSetting> settings;
-            gz::Queue<RGBCommand> q;
-            std::thread rgbControllerThread;
+            /// the current config, replaced as a whole when the config file is reloaded
+            std::atomic<std::shared_ptr<const Config>> config;
+            ConfigWatcher configWatcher;
+            int signalFd;
+            std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            ControllerThread controllerThread;
 
-            /// join rgbControllerThread ans exit
-            void exit(int exitcode);
-
-            std::atomic<int> rgbControllerThreadReturnCode = 0;
+            EventLoop eventLoop;
+            std::unique_ptr<ProcessWatcher> processWatcher;
+            std::unordered_map<std::string, int>::const_iterator currentProcessNameIt;
+            bool watchProcesses = false;
+            /// false when the setting of the current process still needs to be sent
+            bool processSettingSent = false;
+            /// nullptr unless focus mode is enabled
+            std::unique_ptr<FocusWatcher> focusWatcher;
+            /// pid of the focused window, 0 if unknown
+            int focusedPID = 0;
+            /// focused pid that is applied when the debounce timer expires
+            int pendingFocusedPID = 0;
+            uint64_t focusEvents = 0;
+            uint64_t focusChanges = 0;
+            /// nullptr if logind is not available
+            std::unique_ptr<SleepWatcher> sleepWatcher;
+            /// true between the PrepareForSleep signals before sleep and after waking up
+            bool sleepAnnounced = false;
+            uint64_t sleepCount = 0;
+            uint64_t resumeCount = 0;
+            /// resumes that were only detected by checkHibernate()
+            uint64_t driftResumeCount = 0;
+            FileWatcher fileWatcher;
+            std::unique_ptr<CommandSocket> commandSocket;
+            /// last setting sent to the controller
+            RGBSetting currentSetting;
+            /// true until a command takes over, then the time window is ignored
+            bool checkTime = true;
+            /// expires at the next transition of the schedule
+            Timer scheduleTimer { CLOCK_REALTIME };
+            /// the time scheduleTimer is set to
+            std::chrono::system_clock::time_point scheduleTimerTime;
+            /// index of the scheduled setting that replaces the idleSetting, -1 for none
+            int scheduledSettingIndex = -1;
+            std::chrono::nanoseconds suspendedTimeAtLastCheck;
 
-            static App* app;
+            /// @returns the values used for the keys that are not in the config file
+            static Config getDefaultConfig();
+            /// @returns the config from CONFIG_FILE, or the default config if it can not be read
+            static std::shared_ptr<const Config> loadInitialConfig();
+            /**
+             * @brief Load CONFIG_FILE and swap it in
+             * @details
+             *  If the file can not be read or has invalid entries, the current config is kept.
+             *  The ProcessWatcher gets the new process names, and the setting for the running process is only sent
+             *  if it changed, so that animations continue. The rgb controller thread picks up the new brightness.
+             *  Changed servers are only used after a restart.
+             */
+            void reloadConfig();
+            /// @returns the setting for processNameIt from the processWatcher, or the scheduled or idle setting if it is end()
+            const RGBSetting& getProcessSetting(const Config& config, std::unordered_map<std::string, int>::const_iterator processNameIt) const;
+            /// Push command to q and log the latency since the event that caused it (see EventLoop::getEventTime())
+            void pushCommand(RGBCommand&& command);
+            void setWatchProcesses(bool watch);
+            /**
+             * @returns iterator to the process rule with the highest priority that is running or end()
+             * @details In focus mode, only the focused process and the processes it started are considered
+             */
+            std::unordered_map<std::string, int>::const_iterator getActiveProcess() const;
+            /// Send the setting of the running process with the highest priority if it changed
+            void checkProcesses();
+            /**
+             * @brief Read the focus and (re)start the debounce timer if it changed
+             * @details If the focus source fails, focus mode is disabled
+             */
+            void handleFocusEvents(Timer& debounceTimer);
             /**
-             * @brief Send QUIT command and join other thread before exiting
+             * @brief Turn the lights off before sleep and on after waking up
+             * @details
+             *  Before sleep, the inhibitor lock is released when the controller reports that black was sent (see ControllerThread::getSuspendFd()),
+             *  or at the latest when releaseTimer expires. If the bus connection fails, only checkHibernate() is left.
+             */
+            void handleSleepEvents(Timer& releaseTimer);
+            /**
+             * @brief Execute an external command
+             * @param cmdIndex Index in externalCommandSettingVec, nothing happens if it is < 0
+             * @param color Color for colorHex
+             * @param source Name of the command source for the log
+             */
+            void handleCommand(int cmdIndex, const orgb::Color& color, const std::string& source);
+            /// Handle a request from the command socket
+            protocol::Response handleRequest(const std::string& request);
+            /**
+             * @brief Enable or disable process watching when the time window starts or ends
+             * @details
+             *  When the window ends, the clearSetting is sent, unless a command disabled checkTime.
+             *  Also sends the scheduled setting when it changed and no process is running
              */
-            static void handleSignal(int sig);
+            void checkTimeWindow();
             /**
-             * @brief Creates a RGBController and waits for commands
-             * @param q: The q with commands to send to the controller
-             * @param returnCode: A code that is >= 0 when the function exits, and -1 while running 
+             * @brief Set scheduleTimer to the next transition of the schedule
+             * @details The timer stays armed without a transition, so that it still wakes up when the realtime clock jumps
              */
-            static void rgbControllerThreadFunction(gz::Queue<RGBCommand>* q, std::atomic<int>* returnCode);
+            void armScheduleTimer();
+            /// Resend the settings if the system was suspended since the last check, unless logind will report the resume
+            void checkHibernate();
+            void handleSignal();
+            void logStats();
+            std::string getStats() const;
+
+            /// turn the lights off, stop the controllerThread and exit
+            void exit(int exitcode);
+
+            static App* app;
     };
 }
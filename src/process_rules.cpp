@@ -0,0 +1,332 @@
+#include "process_rules.hpp"
+
+#include <gz-util/exceptions.hpp>
+
+#include <algorithm>
+#include <cctype>
+
+#include <fnmatch.h>
+
+namespace rgb {
+    ProcessRule parseProcessRule(const std::string& s) {
+        static constexpr std::array<std::pair<std::string_view, ProcessField>, PROCESS_FIELD_COUNT> fieldPrefixes {{
+            { "comm:", ProcessField::COMM },
+            { "cmdline:", ProcessField::CMDLINE },
+            { "exe:", ProcessField::EXE },
+            { "cgroup:", ProcessField::CGROUP },
+        }};
+        ProcessRule rule;
+        std::string_view pattern(s);
+        for (const auto& [prefix, field] : fieldPrefixes) {
+            if (pattern.starts_with(prefix)) {
+                rule.field = field;
+                pattern.remove_prefix(prefix.size());
+                break;
+            }
+        }
+        if (pattern.starts_with("re:")) {
+            rule.type = PatternType::REGEX;
+            pattern.remove_prefix(3);
+        }
+        else if (pattern.find_first_of("*?[") != std::string_view::npos) {
+            rule.type = PatternType::GLOB;
+        }
+        rule.pattern = pattern;
+        if (rule.type != PatternType::REGEX) {
+            for (size_t pos = rule.pattern.find(PROCESS_RULE_EQUALS_ESCAPE); pos != std::string::npos; pos = rule.pattern.find(PROCESS_RULE_EQUALS_ESCAPE, pos + 1)) {
+                rule.pattern.replace(pos, PROCESS_RULE_EQUALS_ESCAPE.size(), "=");
+            }
+        }
+
+        if (rule.pattern.empty()) {
+            throw gz::InvalidArgument("Empty pattern in process rule '" + s + "'", "parseProcessRule");
+        }
+        if (rule.type == PatternType::REGEX) {
+            try {
+                std::regex regex(rule.pattern);
+            }
+            catch (std::regex_error& e) {
+                throw gz::InvalidArgument("Invalid regex in process rule '" + s + "': " + e.what(), "parseProcessRule");
+            }
+        }
+        return rule;
+    }
+
+
+    std::string getGlobLiteral(const std::string& pattern) {
+        std::string longest;
+        std::string current;
+        auto endLiteral = [&longest, &current]() {
+            if (current.size() > longest.size()) { longest = current; }
+            current.clear();
+        };
+        for (size_t i = 0; i < pattern.size(); i++) {
+            char c = pattern[i];
+            if (c == '*' or c == '?') {
+                endLiteral();
+            }
+            else if (c == '[') {
+                // find the end of the bracket expression, a ] right after [ or [! belongs to it, as do [:class:], [.x.] and [=x=]
+                size_t end = i + 1;
+                if (end < pattern.size() and (pattern[end] == '!' or pattern[end] == '^')) { end++; }
+                if (end < pattern.size() and pattern[end] == ']') { end++; }
+                while (end < pattern.size() and pattern[end] != ']') {
+                    if (pattern[end] == '[' and end + 1 < pattern.size() and (pattern[end + 1] == ':' or pattern[end + 1] == '.' or pattern[end + 1] == '=')) {
+                        size_t close = pattern.find(std::string{ pattern[end + 1], ']' }, end + 2);
+                        if (close != std::string::npos) {
+                            end = close + 2;
+                            continue;
+                        }
+                    }
+                    end++;
+                }
+                if (end >= pattern.size()) {
+                    // not closed: fnmatch matches the [ itself
+                    current += c;
+                }
+                else {
+                    endLiteral();
+                    i = end;
+                }
+            }
+            else if (c == '\\' and i + 1 < pattern.size()) {
+                current += pattern[++i];
+            }
+            else {
+                current += c;
+            }
+        }
+        endLiteral();
+        return longest;
+    }
+
+
+    /**
+     * @brief Get the length of the rest of an ECMAScript escape sequence
+     * @param i index of the character after the backslash
+     * @returns the number of characters after pattern[i] that belong to the escape: the digits of \xHH, \uHHHH and backreferences, the letter of \cX
+     */
+    static size_t getEscapeArgumentLength(const std::string& pattern, size_t i) {
+        auto countWhile = [&pattern, i](size_t maxLength, int (*isArgument)(int)) {
+            size_t length = 0;
+            while (length < maxLength and i + 1 + length < pattern.size() and isArgument(static_cast<unsigned char>(pattern[i + 1 + length]))) { length++; }
+            return length;
+        };
+        // the address of a standard library function can not be taken
+        auto isHex = [](int c) { return std::isxdigit(c); };
+        switch (pattern[i]) {
+            case 'x': return countWhile(2, isHex);
+            case 'u': return countWhile(4, isHex);
+            case 'c': return countWhile(1, [](int c) { return std::isalpha(c); });
+            // a backreference takes all following digits
+            case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+                return countWhile(pattern.size(), [](int c) { return std::isdigit(c); });
+            default: return 0;
+        }
+    }
+
+
+    std::string getRegexLiteral(const std::string& pattern) {
+        // an alternative might not contain the literal
+        if (pattern.find('|') != std::string::npos) { return ""; }
+        std::string longest;
+        std::string current;
+        auto endLiteral = [&longest, &current]() {
+            if (current.size() > longest.size()) { longest = current; }
+            current.clear();
+        };
+        // groups are skipped, they might be optional
+        int depth = 0;
+        for (size_t i = 0; i < pattern.size(); i++) {
+            char c = pattern[i];
+            if (c == '\\' and i + 1 < pattern.size()) {
+                char escaped = pattern[++i];
+                // \d, \b, \x41... are not literals
+                if (depth == 0 and !std::isalnum(static_cast<unsigned char>(escaped))) { current += escaped; }
+                else {
+                    endLiteral();
+                    i += getEscapeArgumentLength(pattern, i);
+                }
+            }
+            else if (c == '[') {
+                endLiteral();
+                size_t end = i + 1;
+                if (end < pattern.size() and pattern[end] == '^') { end++; }
+                if (end < pattern.size() and pattern[end] == ']') { end++; }
+                while (end < pattern.size() and pattern[end] != ']') {
+                    end += pattern[end] == '\\' ? 2 : 1;
+                }
+                i = end;
+            }
+            else if (c == '(') {
+                endLiteral();
+                depth++;
+            }
+            else if (c == ')') {
+                depth--;
+            }
+            else if (depth > 0) {
+                continue;
+            }
+            else if (c == '*' or c == '?' or c == '{') {
+                // the quantified character is optional
+                if (!current.empty()) { current.pop_back(); }
+                endLiteral();
+                if (c == '{') {
+                    size_t end = pattern.find('}', i);
+                    i = end == std::string::npos ? pattern.size() : end;
+                }
+            }
+            else if (c == '+' or c == '.' or c == '^' or c == '$') {
+                endLiteral();
+            }
+            else {
+                current += c;
+            }
+        }
+        endLiteral();
+        return longest;
+    }
+
+
+    //
+    // LITERAL AUTOMATON
+    //
+    void LiteralAutomaton::build(const std::vector<std::string>& literals) {
+        byteClass.fill(0);
+        classCount = 1;
+        for (const std::string& literal : literals) {
+            for (char c : literal) {
+                uint8_t& cls = byteClass[static_cast<uint8_t>(c)];
+                if (cls == 0) { cls = static_cast<uint8_t>(classCount++); }
+            }
+        }
+
+        // trie, state 0 is the root and a transition to 0 means there is none yet
+        transitions.assign(classCount, 0);
+        std::vector<std::vector<uint32_t>> stateOutputs(1);
+        for (uint32_t id = 0; id < literals.size(); id++) {
+            uint32_t state = 0;
+            for (char c : literals[id]) {
+                size_t t = state * classCount + byteClass[static_cast<uint8_t>(c)];
+                if (transitions[t] == 0) {
+                    transitions[t] = static_cast<uint32_t>(stateOutputs.size());
+                    stateOutputs.emplace_back();
+                    transitions.resize(transitions.size() + classCount, 0);
+                }
+                state = transitions[t];
+            }
+            stateOutputs[state].push_back(id);
+        }
+
+        // breadth first, the fail state is closer to the root so its transitions and outputs are already complete
+        std::vector<uint32_t> fail(stateOutputs.size(), 0);
+        std::vector<uint32_t> queue;
+        for (size_t c = 0; c < classCount; c++) {
+            if (transitions[c] != 0) { queue.push_back(transitions[c]); }
+        }
+        for (size_t q = 0; q < queue.size(); q++) {
+            const uint32_t state = queue[q];
+            const std::vector<uint32_t>& failOutputs = stateOutputs[fail[state]];
+            stateOutputs[state].insert(stateOutputs[state].end(), failOutputs.begin(), failOutputs.end());
+            for (size_t c = 0; c < classCount; c++) {
+                const size_t t = state * classCount + c;
+                const uint32_t failNext = transitions[fail[state] * classCount + c];
+                if (transitions[t] != 0) {
+                    fail[transitions[t]] = failNext;
+                    queue.push_back(transitions[t]);
+                }
+                else {
+                    transitions[t] = failNext;
+                }
+            }
+        }
+
+        outputBegin.clear();
+        outputs.clear();
+        for (const std::vector<uint32_t>& stateOutput : stateOutputs) {
+            outputBegin.push_back(static_cast<uint32_t>(outputs.size()));
+            outputs.insert(outputs.end(), stateOutput.begin(), stateOutput.end());
+        }
+        outputBegin.push_back(static_cast<uint32_t>(outputs.size()));
+    }
+
+
+    //
+    // PROCESS RULE SET
+    //
+    ProcessRuleSet::ProcessRuleSet(const std::vector<std::string>& rules) {
+        std::array<std::vector<std::string>, PROCESS_FIELD_COUNT> literals;
+        for (size_t i = 0; i < rules.size(); i++) {
+            const int index = static_cast<int>(i);
+            ProcessRule rule = parseProcessRule(rules[i]);
+            FieldRules& fieldRules = fields[static_cast<size_t>(rule.field)];
+            fieldRules.maxIndex = index;
+            if (rule.type == PatternType::EXACT) {
+                if (rule.field == ProcessField::COMM and rule.pattern.size() > PROCESS_COMM_MAX_LENGTH) {
+                    // the kernel truncates the name as well
+                    rule.pattern.resize(PROCESS_COMM_MAX_LENGTH);
+                }
+                fieldRules.exact[rule.pattern] = index;
+                continue;
+            }
+            Pattern pattern{ index, rule.type, {}, {} };
+            std::string literal;
+            if (rule.type == PatternType::GLOB) {
+                literal = getGlobLiteral(rule.pattern);
+                pattern.glob = std::move(rule.pattern);
+            }
+            else {
+                literal = getRegexLiteral(rule.pattern);
+                pattern.regex = std::regex(rule.pattern, std::regex::ECMAScript | std::regex::optimize);
+            }
+            if (literal.empty()) {
+                fieldRules.patternsWithoutLiteral.push_back(std::move(pattern));
+            }
+            else {
+                fieldRules.patterns.push_back(std::move(pattern));
+                literals[static_cast<size_t>(rule.field)].push_back(std::move(literal));
+            }
+        }
+        for (size_t field = 0; field < PROCESS_FIELD_COUNT; field++) {
+            fields[field].automaton.build(literals[field]);
+        }
+    }
+
+
+    bool ProcessRuleSet::Pattern::matches(const std::string& value) const {
+        if (type == PatternType::GLOB) {
+            return fnmatch(glob.c_str(), value.c_str(), 0) == 0;
+        }
+        return std::regex_search(value, regex);
+    }
+
+
+    int ProcessRuleSet::match(ProcessField field, const std::string& value, int best) const {
+        const FieldRules& fieldRules = fields[static_cast<size_t>(field)];
+        if (fieldRules.maxIndex <= best) { return best; }
+
+        auto exactIt = fieldRules.exact.find(value);
+        if (exactIt != fieldRules.exact.end() and exactIt->second > best) {
+            best = exactIt->second;
+        }
+
+        candidates.clear();
+        fieldRules.automaton.forEachMatch(value, [this, &fieldRules, best](uint32_t id) {
+            if (fieldRules.patterns[id].index > best) { candidates.push_back(&fieldRules.patterns[id]); }
+        });
+        for (const Pattern& pattern : fieldRules.patternsWithoutLiteral) {
+            if (pattern.index > best) { candidates.push_back(&pattern); }
+        }
+        // highest index first, a literal that was found several times is only tested once
+        std::sort(candidates.begin(), candidates.end(), [](const Pattern* a, const Pattern* b) { return a->index > b->index; });
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        for (const Pattern* pattern : candidates) {
+            if (pattern->matches(value)) {
+                best = pattern->index;
+                break;
+            }
+        }
+        return best;
+    }
+}
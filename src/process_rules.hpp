@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace rgb {
+    /// The kernel keeps this many characters of the process name (TASK_COMM_LEN - 1)
+    const size_t PROCESS_COMM_MAX_LENGTH = 15;
+
+    /// The part of a process that a rule is matched against
+    enum class ProcessField : uint8_t {
+        /// process name from /proc/<pid>/stat, at most PROCESS_COMM_MAX_LENGTH characters
+        COMM,
+        /// /proc/<pid>/cmdline, the arguments separated by spaces
+        CMDLINE,
+        /// path of the executable, /proc/<pid>/exe
+        EXE,
+        /// cgroup v2 path from /proc/<pid>/cgroup, eg /user.slice/user-1000.slice/user@1000.service/app.slice/app-steam@1234.scope
+        CGROUP,
+    };
+    constexpr size_t PROCESS_FIELD_COUNT = 4;
+
+    enum class PatternType : uint8_t {
+        EXACT,
+        /// fnmatch(3) pattern that has to match the whole value, * also matches /
+        GLOB,
+        /// ECMAScript regex that has to match a part of the value
+        REGEX,
+    };
+
+    /**
+     * @brief Stands for `=` in a process rule
+     * @details The config file is split at the first `=`, so a rule key can not contain it. Regexes understand the escape themselves.
+     */
+    const std::string_view PROCESS_RULE_EQUALS_ESCAPE = "\\x3d";
+
+    struct ProcessRule {
+        ProcessField field = ProcessField::COMM;
+        PatternType type = PatternType::EXACT;
+        std::string pattern;
+    };
+
+    /**
+     * @brief Parse a process rule from the config file
+     * @param s `[comm:|cmdline:|exe:|cgroup:][re:]pattern`. Without re:, the pattern is a glob if it contains *, ? or [ and exact otherwise.
+     *  PROCESS_RULE_EQUALS_ESCAPE in an exact or glob pattern is replaced by `=`.
+     * @throws gz::InvalidArgument if the pattern is empty or not a valid regex
+     */
+    ProcessRule parseProcessRule(const std::string& s);
+    /// @returns the longest part of the glob pattern that every match contains, with escapes removed
+    std::string getGlobLiteral(const std::string& pattern);
+    /**
+     * @brief Get a string that every match of the regex contains
+     * @returns the longest literal outside of groups and brackets, or "" if the regex has alternatives (|) or no literal
+     */
+    std::string getRegexLiteral(const std::string& pattern);
+
+
+    /**
+     * @brief Finds all occurrences of a set of strings in a single pass (Aho-Corasick)
+     * @details
+     *  The trie is turned into a DFA: every state has a transition for every byte class, so matching is one table lookup per byte.
+     *  Bytes that do not occur in any of the strings share one class, which keeps the table small.
+     */
+    class LiteralAutomaton {
+        public:
+            /// @param literals non-empty strings, the index is the id passed to forEachMatch()
+            void build(const std::vector<std::string>& literals);
+            /// Call f(id) for each occurrence of a literal in s
+            template<typename F>
+            void forEachMatch(std::string_view s, F&& f) const {
+                if (transitions.empty()) { return; }
+                uint32_t state = 0;
+                for (char c : s) {
+                    state = transitions[state * classCount + byteClass[static_cast<uint8_t>(c)]];
+                    for (uint32_t i = outputBegin[state]; i < outputBegin[state + 1]; i++) {
+                        f(outputs[i]);
+                    }
+                }
+            }
+            size_t getStateCount() const { return outputBegin.empty() ? 0 : outputBegin.size() - 1; }
+
+        private:
+            std::array<uint8_t, 256> byteClass{};
+            size_t classCount = 1;
+            /// next state for state * classCount + class
+            std::vector<uint32_t> transitions;
+            /// the literals ending in state are outputs[outputBegin[state]] to outputs[outputBegin[state + 1] - 1]
+            std::vector<uint32_t> outputBegin;
+            std::vector<uint32_t> outputs;
+    };
+
+
+    /**
+     * @brief The process rules, compiled for matching all of them at once
+     * @details
+     *  The index of a rule is its priority, only the matching rule with the highest index is of interest.
+     *  For each field:
+     *  - exact rules are looked up in a hash table
+     *  - the literals that every match of a glob or regex contains (see getGlobLiteral() and getRegexLiteral()) are searched for
+     *    with one LiteralAutomaton. Only the rules whose literal was found, and those without one, are tested with fnmatch(3)
+     *    or std::regex_search, from the highest index down
+     *  Rules with a lower index than the best match so far are not tested at all.
+     */
+    class ProcessRuleSet {
+        public:
+            ProcessRuleSet() = default;
+            /// @throws gz::InvalidArgument if a rule is invalid
+            ProcessRuleSet(const std::vector<std::string>& rules);
+            /// @returns true if field has to be read to find a match with an index greater than best
+            bool needsField(ProcessField field, int best) const { return fields[static_cast<size_t>(field)].maxIndex > best; }
+            /**
+             * @brief Match one field of a process
+             * @param best Index of the best match so far or -1, only rules with a greater index are tested
+             * @returns the index of the best match
+             * @details Not thread safe
+             */
+            int match(ProcessField field, const std::string& value, int best) const;
+
+        private:
+            /// a glob or regex rule
+            struct Pattern {
+                int index;
+                PatternType type;
+                std::string glob;
+                std::regex regex;
+                bool matches(const std::string& value) const;
+            };
+            struct FieldRules {
+                /// pattern -> highest index
+                std::unordered_map<std::string, int> exact;
+                /// ids are indices into patterns
+                LiteralAutomaton automaton;
+                std::vector<Pattern> patterns;
+                /// patterns without a literal, like "*", are always tested
+                std::vector<Pattern> patternsWithoutLiteral;
+                int maxIndex = -1;
+            };
+            std::array<FieldRules, PROCESS_FIELD_COUNT> fields;
+            /// patterns to test in match(), kept to avoid allocations
+            mutable std::vector<const Pattern*> candidates;
+    };
+}
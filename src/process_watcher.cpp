@@ -0,0 +1,555 @@
+#include "process_watcher.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace rgb {
+    //
+    // PID CACHE
+    //
+    PIDCache::PIDCache() {
+        size_t pidMax = PID_CACHE_MAX_CAPACITY;
+        std::ifstream pidMaxFile("/proc/sys/kernel/pid_max");
+        if (pidMaxFile >> pidMax) {
+            pidMax = std::min(pidMax, PID_CACHE_MAX_CAPACITY);
+        }
+        size_t bucketCount = std::bit_ceil(std::max(pidMax / PID_CACHE_BUCKET_SIZE, size_t(1)));
+        entries.resize(bucketCount * PID_CACHE_BUCKET_SIZE);
+        bucketMask = bucketCount - 1;
+    }
+
+
+    PIDCache::Entry* PIDCache::getBucket(int pid) {
+        // fibonacci hashing, consecutive pids land in different buckets
+        size_t bucket = (static_cast<uint32_t>(pid) * 2654435769u) & bucketMask;
+        return &entries[bucket * PID_CACHE_BUCKET_SIZE];
+    }
+
+
+    bool PIDCache::contains(int pid, uint64_t startTime) {
+        Entry* bucket = getBucket(pid);
+        for (size_t i = 0; i < PID_CACHE_BUCKET_SIZE; i++) {
+            if (bucket[i].pid == pid) {
+                if (bucket[i].startTime == startTime) {
+                    return true;
+                }
+                // pid was recycled
+                bucket[i] = Entry{};
+                entryCount--;
+                staleEntries++;
+                break;
+            }
+        }
+        return false;
+    }
+
+
+    void PIDCache::insert(int pid, uint64_t startTime) {
+        Entry* bucket = getBucket(pid);
+        Entry* slot = nullptr;
+        for (size_t i = 0; i < PID_CACHE_BUCKET_SIZE; i++) {
+            if (bucket[i].pid == pid) {
+                slot = &bucket[i];
+                break;
+            }
+            if (slot == nullptr and bucket[i].pid == 0) {
+                slot = &bucket[i];
+            }
+        }
+        if (slot == nullptr) {
+            // bucket is full: evict the oldest entry
+            slot = bucket;
+            for (size_t i = 1; i < PID_CACHE_BUCKET_SIZE; i++) {
+                if (insertions - bucket[i].age > insertions - slot->age) {
+                    slot = &bucket[i];
+                }
+            }
+            evictions++;
+            entryCount--;
+        }
+        if (slot->pid != pid) {
+            entryCount++;
+        }
+        *slot = Entry{ pid, insertions++, startTime };
+    }
+
+
+    void PIDCache::erase(int pid) {
+        Entry* bucket = getBucket(pid);
+        for (size_t i = 0; i < PID_CACHE_BUCKET_SIZE; i++) {
+            if (bucket[i].pid == pid) {
+                bucket[i] = Entry{};
+                entryCount--;
+                return;
+            }
+        }
+    }
+
+
+    void PIDCache::clear() {
+        entries.assign(entries.size(), Entry{});
+        entryCount = 0;
+    }
+
+
+    std::string PIDCache::getStats() const {
+        std::stringstream ss;
+        ss << "size: " << entryCount << "/" << entries.size()
+           << ", stale: " << staleEntries << ", evicted: " << evictions;
+        return ss.str();
+    }
+
+
+    //
+    // PRIORITY BITSET
+    //
+    void PriorityBitset::resize(size_t size) {
+        bits.assign((size + 63) / 64, 0);
+        summary.assign((bits.size() + 63) / 64, 0);
+    }
+
+
+    void PriorityBitset::clear() {
+        std::fill(bits.begin(), bits.end(), 0);
+        std::fill(summary.begin(), summary.end(), 0);
+    }
+
+
+    int PriorityBitset::highest() const {
+        for (size_t s = summary.size(); s-- > 0;) {
+            if (summary[s] != 0) {
+                size_t word = s * 64 + 63 - std::countl_zero(summary[s]);
+                return static_cast<int>(word * 64 + 63 - std::countl_zero(bits[word]));
+            }
+        }
+        return -1;
+    }
+
+
+    //
+    // PROCESS WATCHER
+    //
+    ProcessWatcher::ProcessWatcher(const std::vector<std::string>& processNames, const std::string& procPath) {
+        setNames(processNames);
+        processName.reserve(PROC_STAT_BUFFER_SIZE);
+        fieldBuffer.resize(PROC_FIELD_BUFFER_SIZE);
+        fieldValue.reserve(PROC_FIELD_BUFFER_SIZE);
+        direntBuffer.resize(PROC_DIRENT_BUFFER_SIZE);
+        procFd = open(procPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (connectProcConnector()) {
+            rgblog("Process Watcher: Using netlink proc connector");
+        }
+        else {
+            rgblog.warning("Process Watcher: Could not subscribe to the netlink proc connector (missing CAP_NET_ADMIN?): '" + std::string(std::strerror(errno)) + "'. Falling back to scanning /proc.");
+        }
+        // subscribe first, then scan so that no process can be missed
+        scan();
+    }
+
+
+    void ProcessWatcher::setNames(const std::vector<std::string>& processNames) {
+        // compile first, so that nothing is changed if a rule is invalid
+        rules = ProcessRuleSet(processNames);
+        cacheNonMatching = !rules.needsField(ProcessField::CGROUP, -1);
+        process2index.clear();
+        for (size_t i = 0; i < processNames.size(); i++) {
+            process2index[processNames[i]] = i;
+        }
+        index2process.assign(processNames.size(), process2index.end());
+        for (auto it = process2index.begin(); it != process2index.end(); it++) {
+            index2process[it->second] = it;
+        }
+        runningCount.assign(processNames.size(), 0);
+        runningRules.resize(processNames.size());
+    }
+
+
+    void ProcessWatcher::setProcessNames(const std::vector<std::string>& processNames) {
+        setNames(processNames);
+        // the cached pids did not match the old names
+        checkedPIDs.clear();
+        scan();
+    }
+
+
+    ProcessWatcher::~ProcessWatcher() {
+        if (nlSocket >= 0) {
+            close(nlSocket);
+        }
+        if (procFd >= 0) {
+            close(procFd);
+        }
+    }
+
+
+    bool ProcessWatcher::connectProcConnector() {
+        nlSocket = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (nlSocket < 0) { return false; }
+
+        sockaddr_nl addr{};
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = CN_IDX_PROC;
+        addr.nl_pid = 0;
+        if (bind(nlSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+            int err = errno;
+            close(nlSocket);
+            nlSocket = -1;
+            errno = err;
+            return false;
+        }
+
+        // netlink header | connector message | listen operation
+        alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))]{};
+        nlmsghdr* header = reinterpret_cast<nlmsghdr*>(request);
+        header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+        header->nlmsg_type = NLMSG_DONE;
+        header->nlmsg_pid = 0;
+        cn_msg* message = reinterpret_cast<cn_msg*>(NLMSG_DATA(header));
+        message->id.idx = CN_IDX_PROC;
+        message->id.val = CN_VAL_PROC;
+        message->len = sizeof(proc_cn_mcast_op);
+        proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+        std::memcpy(message->data, &op, sizeof(op));
+        if (send(nlSocket, request, header->nlmsg_len, 0) < 0) {
+            int err = errno;
+            close(nlSocket);
+            nlSocket = -1;
+            errno = err;
+            return false;
+        }
+        return true;
+    }
+
+
+    void ProcessWatcher::update() {
+        changeTime = std::chrono::steady_clock::time_point();
+        if (nlSocket >= 0) {
+            if (!handleEvents()) {
+                rgblog.warning("Process Watcher: Lost process events, rescanning /proc");
+                changeTime = std::chrono::steady_clock::time_point();
+                scan();
+            }
+        }
+        else {
+            scan();
+        }
+    }
+
+
+    void ProcessWatcher::resync() {
+        if (nlSocket >= 0) {
+            alignas(nlmsghdr) char buffer[PROC_EVENT_BUFFER_SIZE];
+            // the events are older than the scan, ENOBUFS is reported once and then the remaining events can be read
+            while (recv(nlSocket, buffer, sizeof(buffer), 0) >= 0 or errno == EINTR or errno == ENOBUFS);
+        }
+        scan();
+    }
+
+
+    bool ProcessWatcher::handleEvents() {
+        alignas(nlmsghdr) char buffer[PROC_EVENT_BUFFER_SIZE];
+        while (true) {
+            ssize_t length = recv(nlSocket, buffer, sizeof(buffer), 0);
+            if (length < 0) {
+                if (errno == EINTR) { continue; }
+                // ENOBUFS: the socket buffer overran and events were dropped
+                return errno != ENOBUFS;
+            }
+            for (nlmsghdr* header = reinterpret_cast<nlmsghdr*>(buffer); NLMSG_OK(header, static_cast<size_t>(length)); header = NLMSG_NEXT(header, length)) {
+                if (header->nlmsg_type == NLMSG_NOOP) { continue; }
+                if (header->nlmsg_type == NLMSG_ERROR or header->nlmsg_type == NLMSG_OVERRUN) { return false; }
+
+                const cn_msg* message = reinterpret_cast<const cn_msg*>(NLMSG_DATA(header));
+                if (message->id.idx != CN_IDX_PROC or message->id.val != CN_VAL_PROC) { continue; }
+                const proc_event* event = reinterpret_cast<const proc_event*>(message->data);
+                const uint64_t changeCountBefore = changeCount;
+                switch (event->what) {
+                    case proc_event::PROC_EVENT_EXEC:
+                        handleExec(event->event_data.exec.process_tgid);
+                        break;
+                    case proc_event::PROC_EVENT_COMM:
+                        // only the name of the main thread is relevant
+                        if (event->event_data.comm.process_pid == event->event_data.comm.process_tgid) {
+                            handleExec(event->event_data.comm.process_tgid);
+                        }
+                        break;
+                    case proc_event::PROC_EVENT_EXIT:
+                        // exit events are also sent for threads
+                        if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+                            handleExit(event->event_data.exit.process_tgid);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                if (changeCount != changeCountBefore) {
+                    // timestamp_ns is CLOCK_MONOTONIC, like steady_clock
+                    changeTime = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(event->timestamp_ns));
+                }
+            }
+        }
+    }
+
+
+    void ProcessWatcher::handleExec(int pid) {
+        // the process might have been a non-matching one before exec
+        checkedPIDs.erase(pid);
+        uint64_t startTime;
+        if (!readProcessStat(pid, processName, startTime)) {
+            removeProcess(pid);
+            return;
+        }
+        int index = matchProcess(pid, processName);
+        if (index >= 0) {
+            addProcess(pid, index);
+        }
+        else {
+            removeProcess(pid);
+            if (cacheNonMatching) { checkedPIDs.insert(pid, startTime); }
+        }
+    }
+
+
+    void ProcessWatcher::handleExit(int pid) {
+        checkedPIDs.erase(pid);
+        removeProcess(pid);
+    }
+
+
+    /**
+     * @brief Parse a /proc directory name
+     * @returns the pid or -1 if name is not a number
+     */
+    static int parsePID(const char* name) {
+        int pid = 0;
+        for (; *name != '\0'; name++) {
+            if (*name < '0' or *name > '9') { return -1; }
+            pid = pid * 10 + (*name - '0');
+        }
+        return pid;
+    }
+
+
+    void ProcessWatcher::scan() {
+        int pid;
+        uint64_t startTime;
+        pid2index.clear();
+        changeCount++;
+        runningCount.assign(runningCount.size(), 0);
+        runningRules.clear();
+        if (procFd < 0 or lseek(procFd, 0, SEEK_SET) < 0) {
+            rgblog.error("Process Watcher: Can not read /proc: '" + std::string(std::strerror(errno)) + "'");
+            return;
+        }
+        while (true) {
+            long length = syscall(SYS_getdents64, procFd, direntBuffer.data(), direntBuffer.size());
+            if (length <= 0) { break; }
+            for (long offset = 0; offset < length;) {
+                const dirent64* entry = reinterpret_cast<const dirent64*>(direntBuffer.data() + offset);
+                offset += entry->d_reclen;
+                if (entry->d_type != DT_DIR) { continue; }
+                pid = parsePID(entry->d_name);
+                if (pid <= 0) { continue; }
+                if (!readProcessStat(pid, processName, startTime)) { continue; }
+                if (checkedPIDs.contains(pid, startTime)) { continue; }
+
+                int index = matchProcess(pid, processName);
+                if (index >= 0) {
+                    addProcess(pid, index);
+                }
+                else if (cacheNonMatching) {
+                    checkedPIDs.insert(pid, startTime);
+                }
+            }
+        }
+    }
+
+
+    /// Set path to "<pid><file>", relative to /proc
+    static void makeProcessPath(char (&path)[32], int pid, std::string_view file) {
+        char* pathEnd = std::to_chars(path, path + sizeof(path) - file.size() - 1, pid).ptr;
+        std::memcpy(pathEnd, file.data(), file.size());
+        pathEnd[file.size()] = '\0';
+    }
+
+
+    bool ProcessWatcher::readProcessStat(int pid, std::string& name, uint64_t& startTime) {
+        char path[32];
+        makeProcessPath(path, pid, "/stat");
+        int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { return false; }
+        // pid (comm) state ppid ... starttime(22) ...
+        char stat[PROC_STAT_BUFFER_SIZE];
+        ssize_t length = pread(fd, stat, sizeof(stat), 0);
+        close(fd);
+        if (length <= 0) { return false; }
+        const char* end = stat + length;
+
+        // comm may contain spaces and parentheses
+        const char* nameBegin = static_cast<const char*>(std::memchr(stat, '(', length));
+        const char* nameEnd = end;
+        while (nameEnd > stat and *(nameEnd - 1) != ')') { nameEnd--; }
+        if (nameBegin == nullptr or nameEnd <= nameBegin + 1) { return false; }
+        nameEnd--;
+        name.assign(nameBegin + 1, nameEnd);
+
+        // skip ") " and the fields 3 (state) to 21
+        const char* field = nameEnd + 2;
+        for (int i = 3; i < 22 and field < end; i++) {
+            const char* space = static_cast<const char*>(std::memchr(field, ' ', end - field));
+            if (space == nullptr) { return false; }
+            field = space + 1;
+        }
+        return std::from_chars(field, end, startTime).ec == std::errc();
+    }
+
+
+    int ProcessWatcher::readParentPID(int pid) const {
+        char path[32];
+        makeProcessPath(path, pid, "/stat");
+        int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { return -1; }
+        char stat[PROC_STAT_BUFFER_SIZE];
+        ssize_t length = pread(fd, stat, sizeof(stat), 0);
+        close(fd);
+        if (length <= 0) { return -1; }
+        // pid (comm) state ppid, comm may contain parentheses
+        const char* end = stat + length;
+        const char* field = end;
+        while (field > stat and *(field - 1) != ')') { field--; }
+        // skip ") S "
+        field += 3;
+        int parent;
+        if (field >= end or std::from_chars(field, end, parent).ec != std::errc()) { return -1; }
+        return parent;
+    }
+
+
+    bool ProcessWatcher::isDescendant(int pid, int ancestor) const {
+        for (int depth = 0; depth < PROC_MAX_ANCESTOR_DEPTH and pid > 0; depth++) {
+            if (pid == ancestor) { return true; }
+            pid = readParentPID(pid);
+        }
+        return false;
+    }
+
+
+    bool ProcessWatcher::readProcessField(int pid, ProcessField field, std::string& value) {
+        char path[32];
+        ssize_t length;
+        if (field == ProcessField::EXE) {
+            makeProcessPath(path, pid, "/exe");
+            length = readlinkat(procFd, path, fieldBuffer.data(), fieldBuffer.size());
+            if (length <= 0) { return false; }
+            value.assign(fieldBuffer.data(), length);
+            return true;
+        }
+
+        makeProcessPath(path, pid, field == ProcessField::CMDLINE ? "/cmdline" : "/cgroup");
+        int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { return false; }
+        length = pread(fd, fieldBuffer.data(), fieldBuffer.size(), 0);
+        close(fd);
+        if (length <= 0) { return false; }
+        std::string_view content(fieldBuffer.data(), length);
+
+        if (field == ProcessField::CMDLINE) {
+            // the arguments are terminated by '\0'
+            while (!content.empty() and content.back() == '\0') { content.remove_suffix(1); }
+            value.assign(content);
+            std::replace(value.begin(), value.end(), '\0', ' ');
+            return true;
+        }
+        // cgroup v2 is "0::<path>", with the hybrid hierarchy there are also v1 lines "<id>:<controllers>:<path>"
+        size_t begin = content.starts_with("0::") ? 0 : content.find("\n0::");
+        if (begin == std::string_view::npos) { return false; }
+        begin += content[begin] == '\n' ? 4 : 3;
+        size_t end = content.find('\n', begin);
+        value.assign(content.substr(begin, end == std::string_view::npos ? end : end - begin));
+        return true;
+    }
+
+
+    int ProcessWatcher::matchProcess(int pid, const std::string& name) {
+        int best = rules.match(ProcessField::COMM, name, -1);
+        // the other fields need another read, skip them when their rules can not beat the best match
+        for (ProcessField field : { ProcessField::CMDLINE, ProcessField::EXE, ProcessField::CGROUP }) {
+            if (rules.needsField(field, best) and readProcessField(pid, field, fieldValue)) {
+                best = rules.match(field, fieldValue, best);
+            }
+        }
+        return best;
+    }
+
+
+    void ProcessWatcher::addProcess(int pid, int index) {
+        auto [it, inserted] = pid2index.try_emplace(pid, index);
+        if (!inserted) {
+            if (it->second == index) { return; }
+            // the process matches another rule after exec
+            releaseRule(it->second);
+            it->second = index;
+        }
+        changeCount++;
+        if (runningCount[index]++ == 0) {
+            runningRules.set(index);
+        }
+        /* rgblog("Process Watcher: Found process", index2process[index]->first, pid); */
+    }
+
+
+    void ProcessWatcher::removeProcess(int pid) {
+        auto it = pid2index.find(pid);
+        if (it == pid2index.end()) { return; }
+        releaseRule(it->second);
+        pid2index.erase(it);
+        changeCount++;
+    }
+
+
+    void ProcessWatcher::releaseRule(int index) {
+        if (--runningCount[index] == 0) {
+            runningRules.reset(index);
+        }
+    }
+
+
+    std::unordered_map<std::string, int>::const_iterator ProcessWatcher::processRunningUnder(int pid) const {
+        if (pid <= 0) { return process2index.end(); }
+        if (pid != cachedFocusPID or changeCount != cachedChangeCount) {
+            cachedFocusPID = pid;
+            cachedChangeCount = changeCount;
+            cachedFocusIndex = -1;
+            for (const auto& [watchedPID, index] : pid2index) {
+                if (index > cachedFocusIndex and isDescendant(watchedPID, pid)) {
+                    cachedFocusIndex = index;
+                }
+            }
+        }
+        if (cachedFocusIndex < 0) { return process2index.end(); }
+        return index2process[cachedFocusIndex];
+    }
+
+
+    std::unordered_map<std::string, int>::const_iterator ProcessWatcher::processRunning() const {
+        // index is the priority
+        int index = runningRules.highest();
+        if (index < 0) { return process2index.end(); }
+        return index2process[index];
+    }
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include "process_rules.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern gz::Log rgblog;
+
+namespace rgb {
+    // 
+    // PROCESS WATCHER
+    //
+    /// Size of the receive buffer for the netlink proc connector
+    const size_t PROC_EVENT_BUFFER_SIZE = 4096;
+    /// Size of the buffer for reading the /proc directory entries
+    const size_t PROC_DIRENT_BUFFER_SIZE = 32768;
+    /// Size of the buffer for reading /proc/<pid>/stat, only the first 22 fields are needed
+    const size_t PROC_STAT_BUFFER_SIZE = 512;
+    /// Size of the buffer for reading /proc/<pid>/cmdline, /proc/<pid>/cgroup and /proc/<pid>/exe, longer command lines are truncated
+    const size_t PROC_FIELD_BUFFER_SIZE = 4096;
+    /// Number of parents that are followed when looking for the processes started by a focused process
+    const int PROC_MAX_ANCESTOR_DEPTH = 64;
+    /// Upper bound for the number of entries in the PIDCache, the actual size depends on /proc/sys/kernel/pid_max
+    const size_t PID_CACHE_MAX_CAPACITY = 32768;
+    /// Number of slots a pid can occupy in the PIDCache
+    const size_t PID_CACHE_BUCKET_SIZE = 8;
+
+    /**
+     * @brief Fixed size cache of pids that are known to not be watched
+     * @details
+     *  Open-addressed table where each pid hashes to a bucket of PID_CACHE_BUCKET_SIZE slots.
+     *  Each entry stores the start time of the process (field 22 of /proc/<pid>/stat), 
+     *  so that entries of recycled pids are detected and dropped.
+     *  The start time has to be read before every lookup, so a cached pid still costs one pread of the stat file.
+     *  The cache saves matching the process against the rules, which reads cmdline, exe or cgroup for some rules.
+     *  It is not used when there are cgroup rules: systemd might move a process into an app scope after its exec.
+     *  When a bucket is full, the oldest entry in it is overwritten.
+     */
+    class PIDCache {
+        public:
+            PIDCache();
+            /**
+             * @returns true if pid with startTime is in the cache
+             * @details
+             *  Removes the entry if pid is in the cache, but with another startTime
+             */
+            bool contains(int pid, uint64_t startTime);
+            void insert(int pid, uint64_t startTime);
+            void erase(int pid);
+            void clear();
+
+            size_t size() const { return entryCount; }
+            size_t capacity() const { return entries.size(); }
+            std::string getStats() const;
+
+        private:
+            struct Entry {
+                int pid = 0;  // 0 = empty
+                uint32_t age = 0;  // insertion counter, used for eviction
+                uint64_t startTime = 0;
+            };
+            std::vector<Entry> entries;
+            size_t bucketMask;
+            size_t entryCount = 0;
+            uint32_t insertions = 0;
+            Entry* getBucket(int pid);
+
+            uint64_t staleEntries = 0;
+            uint64_t evictions = 0;
+    };
+
+    /**
+     * @brief Set of rule indices that finds the highest one with count leading zeros
+     * @details
+     *  A bit in summary is set when the word of bits it stands for is not zero, so highest() only looks at
+     *  one summary word and one word of bits for up to 4096 indices.
+     */
+    class PriorityBitset {
+        public:
+            /// Resize to size indices and clear
+            void resize(size_t size);
+            void clear();
+            void set(size_t index) {
+                bits[index / 64] |= uint64_t(1) << (index % 64);
+                summary[index / 4096] |= uint64_t(1) << (index / 64 % 64);
+            }
+            void reset(size_t index) {
+                bits[index / 64] &= ~(uint64_t(1) << (index % 64));
+                if (bits[index / 64] == 0) {
+                    summary[index / 4096] &= ~(uint64_t(1) << (index / 64 % 64));
+                }
+            }
+            /// @returns the highest index in the set or -1 if it is empty
+            int highest() const;
+
+        private:
+            std::vector<uint64_t> bits;
+            std::vector<uint64_t> summary;
+    };
+
+    class ProcessWatcher {
+        public:
+            /**
+             * @brief Get the rules and priority of the processes to watch for
+             * @details
+             *  See parseProcessRule() for the format of the rules. Only the fields of a process that are used by a rule
+             *  with a higher priority than the best match so far are read.
+             *  Tries to subscribe to the netlink proc connector (requires CAP_NET_ADMIN). 
+             *  If that succeeds, the running watched processes are tracked through exec and exit events,
+             *  otherwise /proc is scanned on every update().
+             * @param processNames The process rules to watch for, the index is the priority
+             * @param procPath Directory with the process directories, another one than /proc only for benchmarks
+             * @throws gz::InvalidArgument if a rule is invalid
+             */
+            ProcessWatcher(const std::vector<std::string>& processNames, const std::string& procPath="/proc");
+            ~ProcessWatcher();
+            ProcessWatcher(const ProcessWatcher&) = delete;
+            ProcessWatcher& operator=(const ProcessWatcher&) = delete;
+            /**
+             * @brief Bring the table of running watched processes up to date
+             * @details
+             *  With the proc connector, all pending events are processed without blocking.
+             *  Without it, /proc is scanned.
+             */
+            void update();
+            /**
+             * @brief Discard the pending process events and rebuild the table of running processes from /proc
+             * @details For when the events were not read for a while, eg while process watching was disabled
+             */
+            void resync();
+            /**
+             * @brief Watch for other processes
+             * @details
+             *  Rebuilds the table of running processes from /proc. Iterators returned before become invalid.
+             * @throws gz::InvalidArgument if a rule is invalid
+             */
+            void setProcessNames(const std::vector<std::string>& processNames);
+            /**
+             * @returns iterator to process-name - index pair with the highest priority that is running or end()
+             * @details
+             *  Only looks at the set of running rules, call update() before.
+             */ 
+            std::unordered_map<std::string, int>::const_iterator processRunning() const;
+            /**
+             * @returns iterator to process-name - index pair with the highest priority that is running as pid or one of its descendants, or end()
+             * @details
+             *  For focus mode, where pid owns the focused window, eg a terminal emulator that runs a watched program.
+             *  Reads the parents of the running watched processes from /proc, call update() before.
+             *  The result is reused until pid or the running watched processes change.
+             */
+            std::unordered_map<std::string, int>::const_iterator processRunningUnder(int pid) const;
+            std::unordered_map<std::string, int>::const_iterator end() const { return process2index.end(); };
+            /**
+             * @brief File descriptor that becomes readable when process events are available
+             * @returns the netlink socket or -1 when /proc is polled
+             */
+            int getFd() const { return nlSocket; }
+            bool isEventDriven() const { return nlSocket >= 0; }
+            /**
+             * @returns the kernel timestamp of the last process event read by the last update() that changed the running watched processes
+             * @details time_point() if update() read no such event or scanned /proc
+             */
+            std::chrono::steady_clock::time_point getChangeTime() const { return changeTime; }
+            std::string getPIDCacheStats() const { return checkedPIDs.getStats(); }
+
+        private:
+            // index is the priority of the process
+            std::unordered_map<std::string, int> process2index;
+            std::vector<std::unordered_map<std::string, int>::const_iterator> index2process;
+            ProcessRuleSet rules;
+            // running watched processes
+            std::unordered_map<int, int> pid2index;
+            // number of running instances for each index
+            std::vector<unsigned int> runningCount;
+            // indices with runningCount > 0
+            PriorityBitset runningRules;
+            // incremented when pid2index changes
+            uint64_t changeCount = 0;
+            std::chrono::steady_clock::time_point changeTime;
+            // last result of processRunningUnder()
+            mutable int cachedFocusPID = 0;
+            mutable uint64_t cachedChangeCount = 0;
+            mutable int cachedFocusIndex = -1;
+            // store pids that did not match the name to skip them in the next scan
+            PIDCache checkedPIDs;
+            // false if there are cgroup rules, see PIDCache
+            bool cacheNonMatching = true;
+            /// Build process2index, index2process and the rules
+            void setNames(const std::vector<std::string>& processNames);
+
+            int nlSocket = -1;
+            bool connectProcConnector();
+            // scanning /proc without allocations: getdents64 into direntBuffer and one pread per process
+            int procFd = -1;
+            std::vector<char> direntBuffer;
+            std::string processName;
+            std::vector<char> fieldBuffer;
+            std::string fieldValue;
+            /// @returns false if events were lost and a scan is required
+            bool handleEvents();
+            void handleExec(int pid);
+            void handleExit(int pid);
+            /// Rebuild the table of running processes from /proc
+            void scan();
+            /**
+             * @brief Read name and start time of the process from /proc/<pid>/stat with a single pread
+             * @returns false if the process does not exist (anymore)
+             */
+            bool readProcessStat(int pid, std::string& name, uint64_t& startTime);
+            /// @returns the parent of pid from /proc/<pid>/stat, or -1 if the process does not exist (anymore)
+            int readParentPID(int pid) const;
+            /// @returns true if pid is ancestor or one of its descendants
+            bool isDescendant(int pid, int ancestor) const;
+            /**
+             * @brief Read cmdline, exe or cgroup of the process
+             * @returns false if the process does not exist (anymore) or has no value for field, eg the cmdline of a kernel thread
+             */
+            bool readProcessField(int pid, ProcessField field, std::string& value);
+            /// @returns index of the rule with the highest priority that matches the process or -1 if it is not watched
+            int matchProcess(int pid, const std::string& name);
+            void addProcess(int pid, int index);
+            void removeProcess(int pid);
+            /// Decrement the running count of the rule
+            void releaseRule(int index);
+    };
+}
@@ -6,6 +6,7 @@
 #include <gz-util/string/utility.hpp>
 #include <gz-util/exceptions.hpp>
 
+#include <charconv>
 #include <cstdint>
 #include <iostream>
 #include <sstream>
@@ -14,7 +15,7 @@
 // COLOR
 void toTwoDigitHex(std::string& appendTo, const uint8_t color) {
     std::stringstream ss;
-    ss << std::hex << color;
+    ss << std::hex << static_cast<int>(color);
     // make sure it has two digits
     std::string temp = ss.str();
     /* std::cout << "hex:" << color << " - " << temp << "\n"; */
@@ -71,15 +72,23 @@ orgb::DeviceType fromString(const std::string& s) {
 namespace rgb {
     std::string RGBSetting::toString() const {
         std::string s;
-        for (auto it = targetDevices.begin(); it != targetDevices.end(); it++) {
-            s += ::toString(*it);
-            s += ",";
+        for (uint32_t i = 0; i <= static_cast<uint32_t>(orgb::DeviceType::Unknown); i++) {
+            if (targetDevices.contains(static_cast<orgb::DeviceType>(i))) {
+                s += ::toString(static_cast<orgb::DeviceType>(i));
+                s += ",";
+            }
         }
-        s.erase(s.size() - 1);
+        if (!s.empty()) { s.erase(s.size() - 1); }
         s += "|";
         s += ::toString(transition) + "|";
         s += ::toString(mode) + "|";
         s += ::toString(color);
+        if (mode == RAINBOW) {
+            s += "|" + std::to_string(rainbowCycle) + "|" + std::to_string(rainbowSpread) + "|" + ::toString(rainbowDirection);
+        }
+        else if (transition == FADE) {
+            s += "|" + std::to_string(fadeDuration) + "|" + ::toString(fadeCurve);
+        }
     return s;
 
 
@@ -88,11 +97,25 @@ namespace rgb {
 } // namespace gz
 
 
+/**
+ * @brief Parse an unsigned integer <= max
+ * @throws gz::InvalidArgument if sv is not a number or too large
+ */
+static unsigned int parseUInt(const std::string_view& sv, unsigned int max, const std::string& name) {
+    unsigned int value;
+    auto [end, ec] = std::from_chars(sv.data(), sv.data() + sv.size(), value);
+    if (ec != std::errc() or end != sv.data() + sv.size() or value > max) {
+        throw gz::InvalidArgument("Invalid " + name + ": '" + std::string(sv) + "'", "fromString<RGBSetting>");
+    }
+    return value;
+}
+
+
 template<> rgb::RGBSetting fromString<rgb::RGBSetting>(const std::string& s) {
     rgb::RGBSetting rgb;
     std::vector<std::string_view> args = gz::util::splitStringInVector<std::string_view>(std::string_view(s), "|");
 
-    if (args.size() != 4) {
+    if (args.size() < 4) {
         throw gz::InvalidArgument("String has not enough arguments to construct RGBSetting", "fromString<RGBSetting>");
     }
 
@@ -105,6 +128,21 @@ template<> rgb::RGBSetting fromString<rgb::RGBSetting>(const std::string& s) {
     rgb.mode = fromString<rgb::RGBMode>(args[2]);
     rgb.color = fromString<orgb::Color>(std::string(args[3]));
 
+    // optional arguments
+    const size_t maxArgs = rgb.mode == rgb::RAINBOW ? 7 : 6;
+    if (args.size() > maxArgs) {
+        throw gz::InvalidArgument("String has too many arguments to construct RGBSetting", "fromString<RGBSetting>");
+    }
+    if (rgb.mode == rgb::RAINBOW) {
+        if (args.size() > 4) { rgb.rainbowCycle = static_cast<uint16_t>(parseUInt(args[4], UINT16_MAX, "rainbow cycle duration")); }
+        if (args.size() > 5) { rgb.rainbowSpread = static_cast<uint8_t>(parseUInt(args[5], UINT8_MAX, "rainbow spread")); }
+        if (args.size() > 6) { rgb.rainbowDirection = fromString<rgb::RainbowDirection>(args[6]); }
+    }
+    else {
+        if (args.size() > 4) { rgb.fadeDuration = static_cast<uint16_t>(parseUInt(args[4], UINT16_MAX, "fade duration")); }
+        if (args.size() > 5) { rgb.fadeCurve = fromString<rgb::FadeCurve>(args[5]); }
+    }
+
     return rgb;
 }
 
@@ -205,15 +243,15 @@ struct EnumStringConversion_RGBCommandType {
 
 gz::util::unordered_string_map<rgb::RGBCommandType> EnumStringConversion_RGBCommandType::name2type {
 	{ "CHANGE_SETTING", rgb::RGBCommandType::CHANGE_SETTING },
+	{ "SUSPEND", rgb::RGBCommandType::SUSPEND },
 	{ "RESUME_FROM_HIBERNATE", rgb::RGBCommandType::RESUME_FROM_HIBERNATE },
-	{ "SLEEP", rgb::RGBCommandType::SLEEP },
 	{ "QUIT", rgb::RGBCommandType::QUIT },
 };  // generated by gen_enum_str
 
 std::map<rgb::RGBCommandType, std::string> EnumStringConversion_RGBCommandType::type2name {
 	{ rgb::RGBCommandType::CHANGE_SETTING, "CHANGE_SETTING" },
+	{ rgb::RGBCommandType::SUSPEND, "SUSPEND" },
 	{ rgb::RGBCommandType::RESUME_FROM_HIBERNATE, "RESUME_FROM_HIBERNATE" },
-	{ rgb::RGBCommandType::SLEEP, "SLEEP" },
 	{ rgb::RGBCommandType::QUIT, "QUIT" },
 };  // generated by gen_enum_str
 
@@ -241,3 +279,90 @@ template<> rgb::RGBCommandType fromString<rgb::RGBCommandType>(const std::string
 
 
 // ENUM - STRING CONVERSION END
+
+
+// ENUM - STRING CONVERSION BY HAND
+// same interface as the generated conversions above
+//
+// FadeCurve
+//
+// Holds maps used by fromString and toString for conversion of FadeCurve values
+struct EnumStringConversion_FadeCurve {
+    static gz::util::unordered_string_map<rgb::FadeCurve> name2type;
+    static std::map<rgb::FadeCurve, std::string> type2name;
+};
+
+gz::util::unordered_string_map<rgb::FadeCurve> EnumStringConversion_FadeCurve::name2type {
+	{ "LINEAR", rgb::FadeCurve::LINEAR },
+	{ "EASE_IN_OUT", rgb::FadeCurve::EASE_IN_OUT },
+	{ "GAMMA", rgb::FadeCurve::GAMMA },
+};
+
+std::map<rgb::FadeCurve, std::string> EnumStringConversion_FadeCurve::type2name {
+	{ rgb::FadeCurve::LINEAR, "LINEAR" },
+	{ rgb::FadeCurve::EASE_IN_OUT, "EASE_IN_OUT" },
+	{ rgb::FadeCurve::GAMMA, "GAMMA" },
+};
+
+std::string toString(const rgb::FadeCurve& v) {
+	if (EnumStringConversion_FadeCurve::type2name.contains(v)) {
+		return EnumStringConversion_FadeCurve::type2name.at(v);
+	}
+	else {
+		throw gz::InvalidArgument("InvalidArgument: '" + std::to_string(static_cast<int>(v)) + "'", "toString(FadeCurve)");
+	}
+}
+
+template<> rgb::FadeCurve fromString<rgb::FadeCurve>(const std::string_view& sv) {
+	if (EnumStringConversion_FadeCurve::name2type.contains(sv)) {
+		return EnumStringConversion_FadeCurve::name2type.find(sv)->second;
+	}
+	else {
+		throw gz::InvalidArgument("InvalidArgument: '" + std::string(sv) + "'", "fromString<FadeCurve>");
+	}
+}
+
+template<> rgb::FadeCurve fromString<rgb::FadeCurve>(const std::string& s) {
+	return fromString<rgb::FadeCurve>(std::string_view(s));
+}
+
+//
+// RainbowDirection
+//
+// Holds maps used by fromString and toString for conversion of RainbowDirection values
+struct EnumStringConversion_RainbowDirection {
+    static gz::util::unordered_string_map<rgb::RainbowDirection> name2type;
+    static std::map<rgb::RainbowDirection, std::string> type2name;
+};
+
+gz::util::unordered_string_map<rgb::RainbowDirection> EnumStringConversion_RainbowDirection::name2type {
+	{ "FORWARD", rgb::RainbowDirection::FORWARD },
+	{ "BACKWARD", rgb::RainbowDirection::BACKWARD },
+};
+
+std::map<rgb::RainbowDirection, std::string> EnumStringConversion_RainbowDirection::type2name {
+	{ rgb::RainbowDirection::FORWARD, "FORWARD" },
+	{ rgb::RainbowDirection::BACKWARD, "BACKWARD" },
+};
+
+std::string toString(const rgb::RainbowDirection& v) {
+	if (EnumStringConversion_RainbowDirection::type2name.contains(v)) {
+		return EnumStringConversion_RainbowDirection::type2name.at(v);
+	}
+	else {
+		throw gz::InvalidArgument("InvalidArgument: '" + std::to_string(static_cast<int>(v)) + "'", "toString(RainbowDirection)");
+	}
+}
+
+template<> rgb::RainbowDirection fromString<rgb::RainbowDirection>(const std::string_view& sv) {
+	if (EnumStringConversion_RainbowDirection::name2type.contains(sv)) {
+		return EnumStringConversion_RainbowDirection::name2type.find(sv)->second;
+	}
+	else {
+		throw gz::InvalidArgument("InvalidArgument: '" + std::string(sv) + "'", "fromString<RainbowDirection>");
+	}
+}
+
+template<> rgb::RainbowDirection fromString<rgb::RainbowDirection>(const std::string& s) {
+	return fromString<rgb::RainbowDirection>(std::string_view(s));
+}
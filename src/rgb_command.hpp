@@ -7,8 +7,9 @@
 #include "OpenRGB/Client.hpp"
 #include "OpenRGB/DeviceInfo.hpp"
 
+#include <cstdint>
+#include <initializer_list>
 #include <string>
-#include <set>
 #include <type_traits>
 
 namespace rgb {
@@ -19,22 +20,85 @@ namespace rgb {
     enum RGBTransition {
         FADE, INSTANT,
     };
+
+    /**
+     * @brief How a fade moves from the start to the target color over its duration
+     * @details
+     *  - LINEAR: constant speed
+     *  - EASE_IN_OUT: slow start and end (smoothstep)
+     *  - GAMMA: constant speed, but the colors are blended in linear light, so the brightness changes evenly to the eye
+     */
+    enum FadeCurve {
+        LINEAR, EASE_IN_OUT, GAMMA,
+    };
+    /// Duration of a fade if the setting does not specify one
+    const uint16_t DEFAULT_FADE_DURATION_MS = 800;
+
+    /// Direction in which the rainbow moves along the leds of a device
+    enum RainbowDirection {
+        FORWARD, BACKWARD,
+    };
+    /// Time for one full rainbow cycle if the setting does not specify one
+    const uint16_t DEFAULT_RAINBOW_CYCLE_MS = 1700;
+    /// Hue difference between neighbouring leds (of 256 for the whole cycle) if the setting does not specify one
+    const uint8_t DEFAULT_RAINBOW_SPREAD = 5;
+
+    /**
+     * @brief Set of orgb::DeviceType stored as a bitmask
+     * @details
+     *  Unlike std::set, this is trivially copyable so that RGBSettings can be passed through the CommandQueue by value.
+     */
+    class DeviceTypeMask {
+        public:
+            constexpr DeviceTypeMask() = default;
+            constexpr DeviceTypeMask(std::initializer_list<orgb::DeviceType> types) {
+                for (orgb::DeviceType type : types) { insert(type); }
+            }
+            constexpr void insert(orgb::DeviceType type) { bits |= bit(type); }
+            constexpr void erase(orgb::DeviceType type) { bits &= ~bit(type); }
+            constexpr bool contains(orgb::DeviceType type) const { return (bits & bit(type)) != 0; }
+            constexpr bool empty() const { return bits == 0; }
+            /// @returns the types in this mask that are not in other
+            constexpr DeviceTypeMask without(const DeviceTypeMask& other) const { return fromBits(bits & ~other.bits); }
+            constexpr DeviceTypeMask& operator|=(const DeviceTypeMask& other) { bits |= other.bits; return *this; }
+            constexpr uint32_t getBits() const { return bits; }
+            constexpr bool operator==(const DeviceTypeMask& other) const = default;
+        private:
+            static constexpr DeviceTypeMask fromBits(uint32_t bits) { DeviceTypeMask mask; mask.bits = bits; return mask; }
+            static constexpr uint32_t bit(orgb::DeviceType type) { return uint32_t(1) << static_cast<uint32_t>(type); }
+            uint32_t bits = 0;
+    };
+    static_assert(static_cast<uint32_t>(orgb::DeviceType::Unknown) < 32, "DeviceTypeMask can not hold all orgb::DeviceType values");
+
+    /**
+     * @brief A rgb setting
+     * @details
+     *  String format: "DeviceType,...|TRANSITION|MODE|#rrggbb[|...]", the optional fields depend on the mode:
+     *  - RAINBOW: "|cycleMs[|spread[|DIRECTION]]"
+     *  - otherwise, for FADE transitions: "|durationMs[|CURVE]"
+     */
     struct RGBSetting {
-        std::set<orgb::DeviceType> targetDevices;
+        DeviceTypeMask targetDevices;
         RGBTransition transition;
         RGBMode mode;
         orgb::Color color;
+        uint16_t fadeDuration = DEFAULT_FADE_DURATION_MS;
+        FadeCurve fadeCurve = LINEAR;
+        uint16_t rainbowCycle = DEFAULT_RAINBOW_CYCLE_MS;
+        uint8_t rainbowSpread = DEFAULT_RAINBOW_SPREAD;
+        RainbowDirection rainbowDirection = FORWARD;
         public:
         std::string toString() const;
     };
 
     enum RGBCommandType {
-        CHANGE_SETTING, RESUME_FROM_HIBERNATE, SLEEP, QUIT
+        CHANGE_SETTING, SUSPEND, RESUME_FROM_HIBERNATE, QUIT
     };
     struct RGBCommand {
         RGBCommandType type;
         RGBSetting setting;
     };
+    static_assert(std::is_trivially_copyable_v<RGBCommand>, "RGBCommand is copied through the CommandQueue ring buffer");
 } // namespace rgb
 
 
@@ -152,7 +216,7 @@ rgb::RGBCommandType fromString(const std::string_view& sv);
  *  This function was generated by gen_enum_str.py\n
  *  Throws gz::InvalidArgument if s is invalid.
  * @throws gz::InvalidArgument if s is invalid.
- * @param v one of: CHANGE_SETTING, RESUME_FROM_HIBERNATE, SLEEP, QUIT,
+ * @param v one of: CHANGE_SETTING, SUSPEND, RESUME_FROM_HIBERNATE, QUIT,
  */
 template<> rgb::RGBCommandType fromString<rgb::RGBCommandType>(const std::string& s);
 /// @brief Convert a std::string_view to @ref {self.get_name()} "an enumeration value"
@@ -160,3 +224,56 @@ template<> rgb::RGBCommandType fromString<rgb::RGBCommandType>(const std::string
 
 
 // ENUM - STRING CONVERSION END
+
+
+// ENUM - STRING CONVERSION BY HAND
+// same interface as the generated conversions above
+//
+// FadeCurve
+//
+/**
+ * @brief Convert @ref rgb::FadeCurve "an enumeration value" to std::string
+ * @details
+ *  Throws gz::InvalidArgument if v is invalid.
+ * @throws gz::InvalidArgument if v is invalid.
+ */
+std::string toString(const rgb::FadeCurve& v);
+template<std::same_as<rgb::FadeCurve> T>
+rgb::FadeCurve fromString(const std::string& s);
+template<std::same_as<rgb::FadeCurve> T>
+rgb::FadeCurve fromString(const std::string_view& sv);
+/**
+ * @brief Convert a std::string to @ref rgb::FadeCurve "an enumeration value"
+ * @details
+ *  Throws gz::InvalidArgument if s is invalid.
+ * @throws gz::InvalidArgument if s is invalid.
+ * @param v one of: LINEAR, EASE_IN_OUT, GAMMA,
+ */
+template<> rgb::FadeCurve fromString<rgb::FadeCurve>(const std::string& s);
+/// @brief Convert a std::string_view to @ref rgb::FadeCurve "an enumeration value"
+template<> rgb::FadeCurve fromString<rgb::FadeCurve>(const std::string_view& sv);
+
+//
+// RainbowDirection
+//
+/**
+ * @brief Convert @ref rgb::RainbowDirection "an enumeration value" to std::string
+ * @details
+ *  Throws gz::InvalidArgument if v is invalid.
+ * @throws gz::InvalidArgument if v is invalid.
+ */
+std::string toString(const rgb::RainbowDirection& v);
+template<std::same_as<rgb::RainbowDirection> T>
+rgb::RainbowDirection fromString(const std::string& s);
+template<std::same_as<rgb::RainbowDirection> T>
+rgb::RainbowDirection fromString(const std::string_view& sv);
+/**
+ * @brief Convert a std::string to @ref rgb::RainbowDirection "an enumeration value"
+ * @details
+ *  Throws gz::InvalidArgument if s is invalid.
+ * @throws gz::InvalidArgument if s is invalid.
+ * @param v one of: FORWARD, BACKWARD,
+ */
+template<> rgb::RainbowDirection fromString<rgb::RainbowDirection>(const std::string& s);
+/// @brief Convert a std::string_view to @ref rgb::RainbowDirection "an enumeration value"
+template<> rgb::RainbowDirection fromString<rgb::RainbowDirection>(const std::string_view& sv);
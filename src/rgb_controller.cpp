@@ -1,195 +1,286 @@
 #include "rgb_controller.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 
 namespace rgb {
-    bool isSameColor(const orgb::Color& color1, const orgb::Color& color2) {
-        return color1.r == color2.r and color1.g == color2.g and color1.b == color2.b;
+    HuePalette makeRainbowPalette() {
+        HuePalette palette;
+        for (size_t i = 0; i < palette.size(); i++) {
+            const float phase = i * 2.0f / palette.size();
+            palette[i].r = static_cast<uint8_t>(127 * std::sin((phase + RED_PHASE)   * std::numbers::pi) + 128);
+            palette[i].g = static_cast<uint8_t>(127 * std::sin((phase + GREEN_PHASE) * std::numbers::pi) + 128);
+            palette[i].b = static_cast<uint8_t>(127 * std::sin((phase + BLUE_PHASE)  * std::numbers::pi) + 128);
+        }
+        return palette;
+    }
+
+
+    uint8_t getRainbowPhase(const RainbowTiming& rainbow, std::chrono::steady_clock::time_point now) {
+        if (rainbow.cycle.count() <= 0) { return 0; }
+        const auto elapsed = (now - rainbow.start) % rainbow.cycle;
+        const auto phase = static_cast<uint8_t>(elapsed * 256 / rainbow.cycle);
+        return rainbow.direction == FORWARD ? phase : static_cast<uint8_t>(-phase);
     }
-    void stepToTargetNumber(uint8_t& i, const uint8_t targetNumber) {
-        if (i < targetNumber) { 
-            i += std::min(FADE_STEP_SIZE, targetNumber - i);
+
+
+    float easeFade(FadeCurve curve, float progress) {
+        switch (curve) {
+            case EASE_IN_OUT:
+                return progress * progress * (3 - 2 * progress);
+            case LINEAR:
+            case GAMMA:
+            default:
+                return progress;
         }
-        else if (i > targetNumber) { 
-            i -= std::min(FADE_STEP_SIZE, i - targetNumber);
+    }
+
+
+    bool animateFade(const FadeTiming& fade, std::span<const orgb::Color> starts, std::span<const orgb::Color> targets,
+                     std::span<orgb::Color> colors, std::chrono::steady_clock::time_point now) {
+        const float progress = std::chrono::duration<float>(now - fade.start) / fade.duration;
+        if (progress >= 1) {
+            std::copy(targets.begin(), targets.end(), colors.begin());
+            return false;
+        }
+        const auto weight = static_cast<uint16_t>(std::lround(easeFade(fade.curve, progress) * BLEND_WEIGHT_MAX));
+        if (fade.curve == GAMMA) {
+            blendColorsLinearLight(starts, targets, colors, weight);
         }
+        else {
+            blendColors(starts, targets, colors, weight);
+        }
+        return true;
     }
-    void stepToTargetColor(orgb::Color& color, const orgb::Color& targetColor) {
-        stepToTargetNumber(color.r, targetColor.r);
-        stepToTargetNumber(color.g, targetColor.g);
-        stepToTargetNumber(color.b, targetColor.b);
+
+
+    void animateRainbow(const RainbowTiming& rainbow, const HuePalette& palette, std::span<orgb::Color> colors, std::chrono::steady_clock::time_point now) {
+        // led n shows the color the first led had when the phase was n * spread behind
+        fillFromPalette(colors, palette, getRainbowPhase(rainbow, now), -rainbow.spread);
     }
 
 
-    void simpleRainbowStep(orgb::Color& color, int i) {
-        color.r = static_cast<uint8_t>(127 * std::sin((i * 2.0f / RAINBOW_STEP_COUNT + RED_PHASE)   * std::numbers::pi) + 128);
-        color.g = static_cast<uint8_t>(127 * std::sin((i * 2.0f / RAINBOW_STEP_COUNT + GREEN_PHASE) * std::numbers::pi) + 128);
-        color.b = static_cast<uint8_t>(127 * std::sin((i * 2.0f / RAINBOW_STEP_COUNT + BLUE_PHASE)  * std::numbers::pi) + 128);
+    AnimationMode animateDevice(DeviceTable& table, size_t i, const HuePalette& palette, std::chrono::steady_clock::time_point now) {
+        std::span<orgb::Color> colors = table.getColors(i);
+        if (colors.empty()) { return AnimationMode::NONE; }
+        const AnimationMode mode = table.getMode(i);
+        switch (mode) {
+            case AnimationMode::NONE:
+                break;
+            case AnimationMode::FADE:
+                if (!animateFade(table.getFadeTiming(i), table.getFadeStarts(i), table.getFadeTargets(i), colors, now)) {
+                    /* rgblog("Finished fading for device", table.getDevice(i).name); */
+                    table.setMode(i, AnimationMode::NONE);
+                }
+                break;
+            case AnimationMode::RAINBOW:
+                animateRainbow(table.getRainbowTiming(i), palette, colors, now);
+                break;
+        }
+        return mode;
     }
 
 
 //
 // RGBController
 //
-    void RGBController::init(const std::set<orgb::DeviceType>& targetDevices) {
-        client.connectX(host, port);
-        getDevices(targetDevices);
-        setModes();
+    RGBController::RGBController(const std::vector<ServerAddress>& serverAddresses, UpdateStats& stats)
+        : frameDiff(stats), rainbowPalette(makeRainbowPalette())
+    {
+        for (const ServerAddress& address : serverAddresses) {
+            servers.push_back(std::make_unique<ServerConnection>(address, clientName, stats));
+        }
+        committedFrames.assign(servers.size(), 0);
     }
 
 
-    void RGBController::getDevices(const std::set<orgb::DeviceType>& targetDevices) {
-        deviceList = client.requestDeviceListX();
-        for (auto it = deviceList.begin(); it != deviceList.end(); it++) {
-            rgblog.clog({ gz::Color::BLUE, gz::Color::RESET }, "Found device", orgb::enumString(it->type), it->vendor, it->name, "Zones:", it->zones.size(), "Leds:", it->leds.size(), "Colors:", it->colors.size());
-            if (targetDevices.contains(it->type)) {
-                devices.push_back(&(*it));
-                deviceColors[&(*it)] = it->colors;
-            }
+    void RGBController::init(const DeviceTypeMask& targetDevices, std::function<void()> serversChanged) {
+        rgblog("Using", getColorKernelsName(), "color kernels");
+        for (auto& server : servers) {
+            server->start(targetDevices, serversChanged);
         }
     }
 
 
-    void RGBController::setModes() {
-        for (auto it = devices.begin(); it != devices.end(); it++) {
-            const orgb::Mode* mode = (*it)->findMode("Direct");
-            if (mode == nullptr) {
-                mode = (*it)->findMode("Static");
-            }
-            if (mode == nullptr) {
-                rgblog.warning("Device" , (*it)->name, "does not have static or direct mode and will not be used");
-                it = devices.erase(it);
-                continue;
-            }
+    void RGBController::updateServers() {
+        bool changed = false;
+        for (size_t s = 0; s < servers.size(); s++) {
+            std::optional<std::vector<DeviceInfo>> devices = servers[s]->takeDevices();
+            if (!devices) { continue; }
+            replaceDevices(s, *devices);
+            changed = true;
+        }
+        // sends all devices of the reconnected servers
+        if (changed) { commitFrame(); }
+    }
 
-            try {
-                client.changeModeX(*(*it), *mode);
-                /* log.warning("Would now change mode for device", (*it)->name); */
-                rgblog("Changed mode for device", (*it)->name);
-            } 
-            catch (orgb::Exception& e) {
-                rgblog.error("Device", (*it)->name, "Error during changeMode, removing device.", e.errorMessage());
-                it = devices.erase(it);
-                continue;
+
+    void RGBController::replaceDevices(size_t server, const std::vector<DeviceInfo>& devices) {
+        // the entries of a server are in the order of its devices
+        size_t matching = 0;
+        bool same = true;
+        for (size_t i = 0; i < table.size() and same; i++) {
+            if (table.getServer(i) != server) { continue; }
+            same = matching < devices.size() and table.getDevice(i) == devices[matching];
+            matching++;
+        }
+        if (same and matching == devices.size()) { return; }
+
+        table.removeServer(server);
+        const auto now = std::chrono::steady_clock::now();
+        for (const DeviceInfo& device : devices) {
+            const size_t i = table.add(device, server);
+            const std::optional<RGBSetting>& setting = lastSettings[static_cast<size_t>(device.type)];
+            if (setting) {
+                applySetting(i, *setting, now);
             }
         }
     }
 
 
-    void RGBController::setColor(orgb::Device& device, orgb::Color color) {
-        try {
-            client.setDeviceColorX(device, color);
-            deviceColors[&device].assign(deviceColors[&device].size(), color);
-            /* log.warning("setColor: would now set deviceColor to", color.r, color.g, color.b); */
-        } 
-        catch (orgb::Exception& e) {
-            rgblog.error("Device", device.name, "Error during setDeviceColor, skipping device.", e.errorMessage());
-        }
+    void RGBController::setColor(size_t deviceIdx, orgb::Color color) {
+        std::span<orgb::Color> colors = table.getColors(deviceIdx);
+        std::fill(colors.begin(), colors.end(), color);
+        send(deviceIdx);
     }
 
 
-    void RGBController::setColor(orgb::Device& device, std::vector<orgb::Color> colors) {
-        try {
-            client.setDeviceLEDColorsX(device, colors);
-            deviceColors[&device] = colors;
-            /* log.warning("setColor: would now set deviceColor to", color.r, color.g, color.b); */
-        } 
-        catch (orgb::Exception& e) {
-            rgblog.error("Device", device.name, "Error during setDeviceColor, skipping device.", e.errorMessage());
+    void RGBController::commitFrame() {
+        for (size_t s = 0; s < servers.size(); s++) {
+            ServerConnection& server = *servers[s];
+            if (server.takeFramesLost()) {
+                // the colors on the devices of this server are unknown, send everything
+                for (size_t i = 0; i < table.size(); i++) {
+                    if (table.getServer(i) != s) { continue; }
+                    table.setSentValid(i, false);
+                    send(i);
+                }
+            }
+            if (const uint64_t frameNumber = server.commit(); frameNumber != 0) {
+                committedFrames[s] = frameNumber;
+            }
         }
     }
 
 
     void RGBController::changeSetting(const RGBSetting& setting) {
         /* rgblog("changeSetting", to_string(setting.color)); */
+        for (size_t type = 0; type < DEVICE_TYPE_COUNT; type++) {
+            if (setting.targetDevices.contains(static_cast<orgb::DeviceType>(type))) {
+                lastSettings[type] = setting;
+            }
+        }
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < table.size(); i++) {
+            if (setting.targetDevices.contains(table.getType(i))) {
+                applySetting(i, setting, now);
+            }
+        }
+        commitFrame();
+    }
+
+
+    void RGBController::applySetting(size_t i, const RGBSetting& setting, std::chrono::steady_clock::time_point now) {
+        const std::string& name = table.getDevice(i).name;
         switch(setting.mode) {
             case RAINBOW:
-                for (orgb::Device* device : devices) {
-                    if (setting.targetDevices.contains(device->type)) {
-                        rgblog("Setting device", device->name, "to rainbow mode");
-                        fadeMode.erase(device);
-                        rainbowMode.insert(device);
-                    }
-                }
+                rgblog("Setting device", name, "to rainbow mode");
+                table.setMode(i, AnimationMode::RAINBOW);
+                table.getRainbowTiming(i) = { now, std::chrono::milliseconds(setting.rainbowCycle), setting.rainbowSpread, setting.rainbowDirection };
                 break;
             case STATIC:
-                if (setting.transition == INSTANT) {
-                    for (orgb::Device* device : devices) {
-                        if (setting.targetDevices.contains(device->type)) {
-                            rgblog("Setting device", device->name, "to static mode without transition.");
-                            rainbowMode.erase(device);
-                            fadeMode.erase(device);
-                            setColor(*device, setting.color);
-                        }
-                    }
+                if (setting.transition == INSTANT or setting.fadeDuration == 0) {
+                    rgblog("Setting device", name, "to static mode without transition.");
+                    table.setMode(i, AnimationMode::NONE);
+                    setColor(i, setting.color);
                 }
                 else {
-                    for (orgb::Device* device : devices) {
-                        if (setting.targetDevices.contains(device->type)) {
-                            rgblog("Setting device", device->name, "to static mode with transition");
-                            rainbowMode.erase(device);
-                            fadeMode[device] = setting.color;
-                        }
-                    }
+                    rgblog("Setting device", name, "to static mode with transition");
+                    table.setMode(i, AnimationMode::FADE);
+                    // start from the current colors, which might be in the middle of another fade
+                    std::span<const orgb::Color> colors = table.getColors(i);
+                    std::copy(colors.begin(), colors.end(), table.getFadeStarts(i).begin());
+                    std::span<orgb::Color> targets = table.getFadeTargets(i);
+                    std::fill(targets.begin(), targets.end(), setting.color);
+                    table.getFadeTiming(i) = { now, std::chrono::milliseconds(setting.fadeDuration), setting.fadeCurve };
                 }
                 break;
             case CLEAR:
-                    for (orgb::Device* device : devices) {
-                        if (setting.targetDevices.contains(device->type)) {
-                            rgblog("Setting device", device->name, "to clear mode");
-                            rainbowMode.erase(device);
-                            fadeMode.erase(device);
-                            setColor(*device, orgb::Color::Black);
-                        }
-                    }
+                rgblog("Setting device", name, "to clear mode");
+                table.setMode(i, AnimationMode::NONE);
+                setColor(i, orgb::Color::Black);
                 break;
         }
     }
 
 
     void RGBController::update() {
-        // fade colors
-        if (fadeMode.size() > 0) {
-            for (const auto& [device, color] : fadeMode) {
-                if (!isSameColor(deviceColors[device][0], color)) {
-                    orgb::Color newColor = deviceColors[device][0];
-                    stepToTargetColor(newColor, color);
-                    setColor(*(device), newColor);
-                } 
-                else {
-                    /* rgblog("Finished fading for device", device->name); */
-                    fadeFinished.push_back(device);
-                }
-            }
-            if (fadeFinished.size() > 0) {
-                for (auto device : fadeFinished) {
-                    fadeMode.erase(device);
-                }
-                fadeFinished.clear();
+        if (suspended) { return; }
+        const auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < table.size(); i++) {
+            switch (animateDevice(table, i, rainbowPalette, now)) {
+                case AnimationMode::NONE:
+                    break;
+                case AnimationMode::FADE:
+                    send(i);
+                    break;
+                case AnimationMode::RAINBOW:
+                    frameDiff.sendFull(servers[table.getServer(i)]->getFrame(), table, i);
+                    break;
             }
         }
-        if (rainbowMode.size() > 0) {
-            orgb::Color newColor;
-            simpleRainbowStep(newColor, rainbowStep);
-            for (auto it = rainbowMode.begin(); it != rainbowMode.end(); it++) {
-                std::rotate(deviceColors[*it].begin(), --deviceColors[*it].end(), deviceColors[*it].end());
-                deviceColors[*it][0] = newColor;
-                setColor(**it, deviceColors[*it]);
-            }
+        commitFrame();
+    }
 
-            if (++rainbowStep > RAINBOW_STEP_COUNT) { rainbowStep = 0; }
+
+    void RGBController::reSetSettings() {
+        // the colors on the devices are unknown, send everything
+        table.invalidateSent();
+        for (size_t i = 0; i < table.size(); i++) {
+            send(i);
         }
+        commitFrame();
     }
 
 
-    void RGBController::reSetSettings() {
-        for (auto& [device, colors] : deviceColors) {
-            setColor(*device, colors);
+    void RGBController::setBrightness(uint8_t brightness) {
+        if (brightness == this->brightness) { return; }
+        this->brightness = brightness;
+        // applied by resume()
+        if (suspended) { return; }
+        frameDiff.setBrightness(brightness);
+        reSetSettings();
+    }
+
+
+    void RGBController::suspend() {
+        if (suspended) { return; }
+        rgblog("Turning all leds off for sleep");
+        suspended = true;
+        frameDiff.setBrightness(0);
+        reSetSettings();
+        for (size_t s = 0; s < servers.size(); s++) {
+            servers[s]->notifyWhenDone(committedFrames[s]);
         }
     }
 
 
+    bool RGBController::isSuspendSent() const {
+        if (!suspended) { return false; }
+        for (size_t s = 0; s < servers.size(); s++) {
+            if (!servers[s]->isFrameDone(committedFrames[s])) { return false; }
+        }
+        return true;
+    }
 
-}
 
+    void RGBController::resume() {
+        if (suspended) {
+            rgblog("Turning all leds on after sleep");
+            suspended = false;
+            frameDiff.setBrightness(brightness);
+        }
+        reSetSettings();
+    }
+}
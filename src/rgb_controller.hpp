@@ -1,18 +1,24 @@
 #pragma once 
 
 #include "OpenRGB/DeviceInfo.hpp"
+#include "color_kernels.hpp"
+#include "device_table.hpp"
+#include "frame_diff.hpp"
 #include "rgb_command.hpp"
+#include "server_connection.hpp"
 
 #include "OpenRGB/Client.hpp"
 
 #include <gz-util/log.hpp>
 
-#include <unordered_map>
-#include <map>
-#include <set>
-
 #include <gz-util/string/conversion.hpp>
 
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
 // TODO remove
 /* static_assert(gz::ConstructibleFromString<rgb::RGBSetting>, "error"); */
 /* static_assert(gz::ConvertibleToString<orgb::DeviceType>, "error"); */
@@ -27,66 +33,138 @@ extern gz::Log rgblog;
 
 namespace rgb {
 
-    const std::string host = "127.0.0.1";
-    const uint16_t port = 6742;
+    /// OpenRGB servers if none are configured
+    const std::string defaultServers = "127.0.0.1:6742";
     const std::string clientName = "gzrgb";
+    constexpr size_t DEVICE_TYPE_COUNT = static_cast<size_t>(orgb::DeviceType::Unknown) + 1;
 
     // fade
-    bool isSameColor(const orgb::Color& color1, const orgb::Color& color2);
-    const int FADE_STEP_SIZE = 10;
-    void stepToTargetColor(orgb::Color& color, const orgb::Color& targetColor);
+    /**
+     * @brief Apply the easing of curve to the linear progress of a fade
+     * @param progress Elapsed part of the fade duration in [0, 1]
+     * @returns the part of the way from the start to the target color in [0, 1]
+     */
+    float easeFade(FadeCurve curve, float progress);
 
     // rainbow
-    const int RAINBOW_STEP_COUNT = 50;
     const float RED_PHASE = 0;
     const float BLUE_PHASE = 2.0f / 3;
     const float GREEN_PHASE = 4.0f / 3;
+    /// @returns one cycle of the sine rainbow, sampled at 256 phases
+    HuePalette makeRainbowPalette();
+    /// @returns the palette index of the first led at time now
+    uint8_t getRainbowPhase(const RainbowTiming& rainbow, std::chrono::steady_clock::time_point now);
+
+    /**
+     * @brief Blend colors between starts and targets by the progress of fade at now
+     * @returns false if the fade is finished, colors are the targets then
+     */
+    bool animateFade(const FadeTiming& fade, std::span<const orgb::Color> starts, std::span<const orgb::Color> targets,
+                     std::span<orgb::Color> colors, std::chrono::steady_clock::time_point now);
+    /// Fill colors with the rainbow at now
+    void animateRainbow(const RainbowTiming& rainbow, const HuePalette& palette, std::span<orgb::Color> colors, std::chrono::steady_clock::time_point now);
+    /**
+     * @brief Compute the colors of device i for the frame at now, with animateFade() or animateRainbow()
+     * @details A finished fade gets its target colors and AnimationMode::NONE. Nothing is sent.
+     * @returns the mode of the device before the frame, AnimationMode::NONE if it has no leds
+     */
+    AnimationMode animateDevice(DeviceTable& table, size_t i, const HuePalette& palette, std::chrono::steady_clock::time_point now);
 
 
     class RGBController {
         public:
-            RGBController() : client(clientName) {};
+            /**
+             * @param serverAddresses The OpenRGB servers, each gets a ServerConnection with its own worker thread
+             * @param stats Counters for the updates sent to the servers
+             */
+            RGBController(const std::vector<ServerAddress>& serverAddresses, UpdateStats& stats);
             /**
              * @brief Initialize the controller.
              * @details
-             *  Connects to OpenRGB server and sets the device modes
+             *  Starts the worker threads of the servers, which connect and set the device modes in the background and
+             *  reconnect when a connection is lost (see ServerConnection). Does not block.
+             * @param serversChanged Called from a worker thread when updateServers() has to be called or isSuspendSent() might have changed
              */
-            void init(const std::set<orgb::DeviceType>& targetDevices);
+            void init(const DeviceTypeMask& targetDevices, std::function<void()> serversChanged);
             /**
-             * Change a rgb setting. Fade and rainbow devices will be added to fadeMode or rainbowMode containers
-             * and will be processed during update()
+             * @brief Take the devices of servers that were (re)connected since the last call
+             * @details
+             *  If a server has the same devices as before, their state is kept and the current colors are sent again,
+             *  so animations continue where they are.
+             *  Otherwise the devices of the server are replaced and get the last setting for their device type.
+             */
+            void updateServers();
+            /**
+             * Change a rgb setting. Fade and rainbow devices get the corresponding AnimationMode
+             * and will be processed during update().
+             * The setting is also applied to devices that are found later.
              */
             void changeSetting(const RGBSetting& setting);
+            /**
+             * @brief Advance all animations
+             * @details
+             *  Fades and rainbows are computed from the time since they started on the steady clock,
+             *  so a late or skipped frame does not change their speed.
+             */
             void update();
-
-            void setColor(orgb::Device& device, orgb::Color color);
-            void setColor(orgb::Device& device, std::vector<orgb::Color> colors);
+            /// @returns true if update() needs to be called regularly
+            bool isAnimating() const { return !suspended and table.getAnimatedCount() > 0; }
 
             /**
              * @brief Re-set all colors for all devices.
              * @details
-             *  Calls setColor for all devices and colors stored in deviceColors.
+             *  Sends the colors stored in the device table to all devices, without comparing them to the colors sent before.
              *  Useful when another program or hibernation changed to colors
              */
             void reSetSettings();
+            /**
+             * @brief Scale all colors sent to the devices by brightness / 255
+             * @details
+             *  The colors in the device table are not changed. If the brightness differs, all colors are sent again.
+             */
+            void setBrightness(uint8_t brightness);
+            /**
+             * @brief Turn all leds off before the system goes to sleep
+             * @details
+             *  The devices are sent black, but the colors, animations and settings are kept.
+             *  Animations are paused and settings that are changed until resume() are only applied to the device table.
+             */
+            void suspend();
+            /// @returns true after suspend() when the black frame was sent to all servers or can not be sent to a server
+            bool isSuspendSent() const;
+            /// End suspend() and re-set all colors, animations continue where they would be without the pause
+            void resume();
 
         private:
-            orgb::Client client;
-            void getDevices(const std::set<orgb::DeviceType>& targetDevices);
-            void setModes();
-
-            // All devices
-            orgb::DeviceList deviceList;
-            // Target devices, pointers to deviceList elements
-            std::vector<orgb::Device*> devices;
-            //
+            std::vector<std::unique_ptr<ServerConnection>> servers;
+            /// Replace the devices of server with devices and give them their settings, unless they did not change
+            void replaceDevices(size_t server, const std::vector<DeviceInfo>& devices);
+            /// Set device deviceIdx to setting
+            void applySetting(size_t deviceIdx, const RGBSetting& setting, std::chrono::steady_clock::time_point now);
+            /// The last setting of each device type
+            std::array<std::optional<RGBSetting>, DEVICE_TYPE_COUNT> lastSettings;
+            /// Add the changed leds of device deviceIdx to the frame of its server
+            void send(size_t deviceIdx) { frameDiff.send(servers[table.getServer(deviceIdx)]->getFrame(), table, deviceIdx); }
+            /// Set all leds of device deviceIdx to color and add the changed leds to the current frame
+            void setColor(size_t deviceIdx, orgb::Color color);
+            /**
+             * @brief Hand the updates of all devices collected since the last commit to the server worker threads
+             * @details
+             *  Called by changeSetting(), update() and reSetSettings().
+             *  If frames to a server were lost, all colors of its devices are added before.
+             */
+            void commitFrame();
+            /// The number of the last frame committed to each server, see ServerConnection::isFrameDone()
+            std::vector<uint64_t> committedFrames;
+            FrameDiff frameDiff;
+
+            // Target devices of all servers
             // Storing and updating the device colors here rather than refreshing the device list all the time
-            std::map<orgb::Device*, std::vector<orgb::Color>> deviceColors;
-            // Active devices
-            std::set<orgb::Device*> rainbowMode;
-            int rainbowStep;
-            std::map<orgb::Device*, orgb::Color> fadeMode;
-            std::vector<orgb::Device*> fadeFinished;
+            DeviceTable table;
+            const HuePalette rainbowPalette;
+            uint8_t brightness = 255;
+            /// while true, the devices are sent with brightness 0
+            bool suspended = false;
     };
 
 
@@ -0,0 +1,242 @@
+#include "schedule.hpp"
+
+#include <gz-util/exceptions.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+namespace rgb {
+    static constexpr std::array<std::string_view, 7> WEEKDAY_NAMES { "sunday", "monday", "tuesday", "wednesday", "thursday", "friday", "saturday" };
+
+    static std::string_view trim(std::string_view s) {
+        const size_t begin = s.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) { return {}; }
+        return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+    }
+
+
+    /// @returns the c_encoding of the weekday
+    static unsigned parseWeekday(std::string_view s, const std::string& context) {
+        std::string lower(trim(s));
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (lower.size() >= 3) {
+            for (unsigned i = 0; i < WEEKDAY_NAMES.size(); i++) {
+                if (WEEKDAY_NAMES[i].starts_with(lower)) { return i; }
+            }
+        }
+        throw gz::InvalidArgument("Invalid weekday '" + std::string(s) + "' in '" + context + "'", "parseWeekdays");
+    }
+
+
+    WeekdayMask parseWeekdays(const std::string& s) {
+        WeekdayMask days = 0;
+        std::string_view rest(s);
+        while (true) {
+            const size_t comma = rest.find(',');
+            const std::string_view item = rest.substr(0, comma);
+            const size_t dash = item.find('-');
+            unsigned first = parseWeekday(item.substr(0, dash), s);
+            unsigned last = dash == std::string_view::npos ? first : parseWeekday(item.substr(dash + 1), s);
+            // ranges like Fri-Mon wrap around the end of the week
+            for (unsigned day = first; ; day = (day + 1) % 7) {
+                days |= static_cast<WeekdayMask>(1 << day);
+                if (day == last) { break; }
+            }
+            if (comma == std::string_view::npos) { break; }
+            rest.remove_prefix(comma + 1);
+        }
+        return days;
+    }
+
+
+    std::string weekdaysToString(WeekdayMask days) {
+        std::string s;
+        for (unsigned day = 0; day < WEEKDAY_NAMES.size(); day++) {
+            if ((days & (1 << day)) == 0) { continue; }
+            if (!s.empty()) { s += ','; }
+            s += static_cast<char>(std::toupper(WEEKDAY_NAMES[day][0]));
+            s += WEEKDAY_NAMES[day].substr(1, 2);
+        }
+        return s;
+    }
+
+
+    /// @param allow24 true if 24:00 is valid
+    static std::chrono::minutes parseTimeOfDay(std::string_view s, bool allow24, const std::string& context) {
+        s = trim(s);
+        unsigned hours = 0, minutes = 0;
+        const size_t colon = s.find(':');
+        bool valid = colon != std::string_view::npos and colon > 0 and s.size() - colon == 3;
+        if (valid) {
+            auto [hoursEnd, hoursEc] = std::from_chars(s.data(), s.data() + colon, hours);
+            auto [minutesEnd, minutesEc] = std::from_chars(s.data() + colon + 1, s.data() + s.size(), minutes);
+            valid = hoursEc == std::errc() and hoursEnd == s.data() + colon and minutesEc == std::errc() and minutesEnd == s.data() + s.size()
+                and minutes < 60 and (hours < 24 or (allow24 and hours == 24 and minutes == 0));
+        }
+        if (!valid) {
+            throw gz::InvalidArgument("Invalid time '" + std::string(s) + "' in '" + context + "', must be HH:MM", "parseTimeOfDay");
+        }
+        return std::chrono::hours(hours) + std::chrono::minutes(minutes);
+    }
+
+
+    static std::string timeOfDayToString(std::chrono::minutes time) {
+        const auto hours = time.count() / 60;
+        const auto minutes = time.count() % 60;
+        return (hours < 10 ? "0" : "") + std::to_string(hours) + (minutes < 10 ? ":0" : ":") + std::to_string(minutes);
+    }
+
+
+    /// Split "[days ]rest" at the last space
+    static std::pair<WeekdayMask, std::string_view> parseDaysPrefix(std::string_view s) {
+        s = trim(s);
+        const size_t space = s.find_last_of(" \t");
+        if (space == std::string_view::npos) { return { ALL_WEEKDAYS, s }; }
+        return { parseWeekdays(std::string(trim(s.substr(0, space)))), s.substr(space + 1) };
+    }
+
+
+    std::string ScheduleTime::toString() const {
+        return (days == ALL_WEEKDAYS ? "" : weekdaysToString(days) + " ") + timeOfDayToString(time);
+    }
+
+
+    ScheduleTime parseScheduleTime(const std::string& s) {
+        auto [days, time] = parseDaysPrefix(s);
+        return { days, parseTimeOfDay(time, false, s) };
+    }
+
+
+    std::string TimeWindow::toString() const {
+        return (days == ALL_WEEKDAYS ? "" : weekdaysToString(days) + " ") + timeOfDayToString(start) + "-" + timeOfDayToString(stop);
+    }
+
+
+    std::vector<TimeWindow> parseTimeWindows(const std::string& s) {
+        std::vector<TimeWindow> windows;
+        if (trim(s) == "always") { return windows; }
+        std::string_view rest(s);
+        while (true) {
+            const size_t semicolon = rest.find(';');
+            auto [days, times] = parseDaysPrefix(rest.substr(0, semicolon));
+            const size_t dash = times.find('-');
+            if (dash == std::string_view::npos) {
+                throw gz::InvalidArgument("Invalid time window '" + std::string(times) + "' in '" + s + "', must be HH:MM-HH:MM", "parseTimeWindows");
+            }
+            windows.push_back({ days, parseTimeOfDay(times.substr(0, dash), false, s), parseTimeOfDay(times.substr(dash + 1), true, s) });
+            if (semicolon == std::string_view::npos) { break; }
+            rest.remove_prefix(semicolon + 1);
+        }
+        return windows;
+    }
+
+
+    const std::chrono::time_zone* getTimeZone(const std::string& name) {
+        try {
+            if (name.empty()) { return std::chrono::current_zone(); }
+            return std::chrono::locate_zone(name);
+        }
+        catch (std::runtime_error& e) {
+            if (name.empty()) { return std::chrono::locate_zone("UTC"); }
+            throw gz::InvalidArgument("Unknown time zone '" + name + "'", "getTimeZone");
+        }
+    }
+
+
+    //
+    // SCHEDULE
+    //
+    Schedule::Schedule() : zone(std::chrono::locate_zone("UTC")) {}
+
+
+    Schedule::Schedule(const std::vector<TimeWindow>& windows, const std::vector<ScheduleTime>& settingTimes, const std::chrono::time_zone* zone)
+        : windows(windows), settingTimes(settingTimes), zone(zone) {}
+
+
+    std::chrono::system_clock::time_point Schedule::toSys(std::chrono::local_days day, std::chrono::minutes time) const {
+        // earliest: the first of two equal local times, for a skipped local time both choices are the moment of the change
+        return std::chrono::zoned_time(zone, day + time, std::chrono::choose::earliest).get_sys_time();
+    }
+
+
+    std::chrono::local_days Schedule::toLocalDay(std::chrono::system_clock::time_point time) const {
+        return std::chrono::floor<std::chrono::days>(std::chrono::zoned_time(zone, time).get_local_time());
+    }
+
+
+    /// @returns true if day is one of days
+    static bool onWeekday(WeekdayMask days, std::chrono::local_days day) {
+        return (days & (1 << std::chrono::weekday(day).c_encoding())) != 0;
+    }
+
+
+    bool Schedule::isInWindow(std::chrono::system_clock::time_point time) const {
+        if (windows.empty()) { return true; }
+        const std::chrono::local_days today = toLocalDay(time);
+        // a window of yesterday might last until today
+        for (std::chrono::local_days day = today - std::chrono::days(1); day <= today; day += std::chrono::days(1)) {
+            for (const TimeWindow& window : windows) {
+                if (!onWeekday(window.days, day)) { continue; }
+                const auto start = toSys(day, window.start);
+                const auto stop = toSys(day, window.stop > window.start ? window.stop : window.stop + std::chrono::days(1));
+                if (start <= time and time < stop) { return true; }
+            }
+        }
+        return false;
+    }
+
+
+    int Schedule::getActiveSetting(std::chrono::system_clock::time_point time) const {
+        if (settingTimes.empty()) { return -1; }
+        // the latest window start or setting time before time
+        auto latest = std::chrono::system_clock::time_point::min();
+        int active = -1;
+        const std::chrono::local_days today = toLocalDay(time);
+        for (std::chrono::local_days day = today - std::chrono::days(SCHEDULE_LOOKAHEAD_DAYS); day <= today; day += std::chrono::days(1)) {
+            for (const TimeWindow& window : windows) {
+                if (!onWeekday(window.days, day)) { continue; }
+                const auto start = toSys(day, window.start);
+                if (start <= time and start > latest) {
+                    latest = start;
+                    active = -1;
+                }
+            }
+            // a setting wins against a window that starts at the same time, and the last of several settings at the same time wins
+            for (size_t i = 0; i < settingTimes.size(); i++) {
+                if (!onWeekday(settingTimes[i].days, day)) { continue; }
+                const auto at = toSys(day, settingTimes[i].time);
+                if (at <= time and at >= latest) {
+                    latest = at;
+                    active = static_cast<int>(i);
+                }
+            }
+        }
+        return active;
+    }
+
+
+    std::chrono::system_clock::time_point Schedule::getNextTransition(std::chrono::system_clock::time_point time) const {
+        auto next = std::chrono::system_clock::time_point::max();
+        auto consider = [time, &next](std::chrono::system_clock::time_point transition) {
+            if (transition > time and transition < next) { next = transition; }
+        };
+        const std::chrono::local_days today = toLocalDay(time);
+        // a window of yesterday might stop today
+        for (std::chrono::local_days day = today - std::chrono::days(1); day <= today + std::chrono::days(SCHEDULE_LOOKAHEAD_DAYS); day += std::chrono::days(1)) {
+            for (const TimeWindow& window : windows) {
+                if (!onWeekday(window.days, day)) { continue; }
+                consider(toSys(day, window.start));
+                consider(toSys(day, window.stop > window.start ? window.stop : window.stop + std::chrono::days(1)));
+            }
+            for (const ScheduleTime& settingTime : settingTimes) {
+                if (!onWeekday(settingTime.days, day)) { continue; }
+                consider(toSys(day, settingTime.time));
+            }
+        }
+        return next;
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace rgb {
+    /// Set of weekdays, bit n is the std::chrono::weekday with c_encoding() n (0 is Sunday)
+    using WeekdayMask = uint8_t;
+    constexpr WeekdayMask ALL_WEEKDAYS = 0x7f;
+    /// Schedule::getNextTransition() looks at most this many days ahead, every weekly schedule has a transition in this range
+    constexpr int SCHEDULE_LOOKAHEAD_DAYS = 8;
+
+    /**
+     * @brief Parse a set of weekdays
+     * @param s comma separated days or ranges of days, eg. "Mon-Fri", "Sat,Sun" or "Fri-Mon". Case insensitive, the first three letters are enough
+     * @throws gz::InvalidArgument if s is not valid
+     */
+    WeekdayMask parseWeekdays(const std::string& s);
+    /// @returns the days in the format of parseWeekdays()
+    std::string weekdaysToString(WeekdayMask days);
+
+
+    /// A local time of day on some weekdays
+    struct ScheduleTime {
+        WeekdayMask days = ALL_WEEKDAYS;
+        /// since midnight
+        std::chrono::minutes time { 0 };
+        bool operator==(const ScheduleTime& other) const = default;
+        /// @returns the string representation, as in the config file
+        std::string toString() const;
+    };
+
+    /**
+     * @brief Parse a time of day with optional weekdays
+     * @param s "[days ]HH:MM", eg. "23:00" or "Fri,Sat 23:30"
+     * @throws gz::InvalidArgument if s is not valid
+     */
+    ScheduleTime parseScheduleTime(const std::string& s);
+
+
+    /// Local time window, starts on its weekdays
+    struct TimeWindow {
+        WeekdayMask days = ALL_WEEKDAYS;
+        std::chrono::minutes start { 0 };
+        /// if it is not after start, the window ends on the next day
+        std::chrono::minutes stop { 0 };
+        bool operator==(const TimeWindow& other) const = default;
+        std::string toString() const;
+    };
+
+    /**
+     * @brief Parse the time windows of a schedule
+     * @param s
+     *  "always" or windows "[days ]HH:MM-HH:MM" separated by ";", eg. "Mon-Fri 18:30-23:00; Sat,Sun 10:00-02:00".
+     *  The stop time can be 24:00.
+     * @returns the windows, empty for "always"
+     * @throws gz::InvalidArgument if s is not valid
+     */
+    std::vector<TimeWindow> parseTimeWindows(const std::string& s);
+
+    /**
+     * @brief Look up a time zone of the tz database
+     * @param name eg. "Europe/Berlin", or empty for the time zone of the system (/etc/localtime), UTC if it is not set
+     * @throws gz::InvalidArgument if name is not a known time zone
+     */
+    const std::chrono::time_zone* getTimeZone(const std::string& name);
+
+
+    /**
+     * @brief Time windows and times for scheduled settings in local time
+     * @details
+     *  All times are converted to instants with std::chrono::zoned_time for the day they happen on, so that they
+     *  stay at the same local time when the UTC offset changes. A time that is skipped when the clocks are set forward
+     *  happens at the moment of the change, a time that happens twice when they are set back happens the first time.
+     *  Immutable after construction.
+     */
+    class Schedule {
+        public:
+            /// Always in the window, no scheduled settings, UTC
+            Schedule();
+            /**
+             * @param windows When process watching is enabled, always if empty
+             * @param settingTimes When scheduled settings take over from the idle setting
+             * @param zone For the local times
+             */
+            Schedule(const std::vector<TimeWindow>& windows, const std::vector<ScheduleTime>& settingTimes, const std::chrono::time_zone* zone);
+
+            bool isInWindow(std::chrono::system_clock::time_point time) const;
+            /**
+             * @brief Get the scheduled setting at time
+             * @details
+             *  A scheduled setting lasts until the next scheduled setting or the start of the next time window.
+             *  When both happen at the same time, the scheduled setting wins.
+             * @returns index into settingTimes, or -1 if the idle setting applies
+             */
+            int getActiveSetting(std::chrono::system_clock::time_point time) const;
+            /**
+             * @returns the first instant after time at which isInWindow() or getActiveSetting() can change,
+             *  or system_clock::time_point::max() if there is none
+             */
+            std::chrono::system_clock::time_point getNextTransition(std::chrono::system_clock::time_point time) const;
+
+            const std::vector<TimeWindow>& getWindows() const { return windows; }
+            const std::vector<ScheduleTime>& getSettingTimes() const { return settingTimes; }
+            const std::chrono::time_zone* getTimeZone() const { return zone; }
+
+        private:
+            std::vector<TimeWindow> windows;
+            std::vector<ScheduleTime> settingTimes;
+            const std::chrono::time_zone* zone;
+            /// @returns the instant of the local time since the start of day
+            std::chrono::system_clock::time_point toSys(std::chrono::local_days day, std::chrono::minutes time) const;
+            std::chrono::local_days toLocalDay(std::chrono::system_clock::time_point time) const;
+    };
+}
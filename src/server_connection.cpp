@@ -0,0 +1,380 @@
+#include "server_connection.hpp"
+
+#include <gz-util/exceptions.hpp>
+#include <gz-util/log.hpp>
+#include <gz-util/string/utility.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <system_error>
+
+extern gz::Log rgblog;
+
+namespace rgb {
+    std::string ServerAddress::toString() const {
+        // ipv6 addresses contain colons
+        if (host.find(':') != std::string::npos) { return "[" + host + "]:" + std::to_string(port); }
+        return host + ":" + std::to_string(port);
+    }
+
+
+    static std::string_view trim(std::string_view s) {
+        const size_t begin = s.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) { return {}; }
+        return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+    }
+
+
+    std::vector<ServerAddress> parseServerAddresses(const std::string& s) {
+        std::vector<ServerAddress> servers;
+        for (std::string_view item : gz::util::splitStringInVector<std::string_view>(std::string_view(s), ",")) {
+            const std::string_view server = trim(item);
+            if (server.empty()) { continue; }
+            auto invalid = [&server](const std::string& what) {
+                return gz::InvalidArgument("Invalid " + what + " in server address: '" + std::string(server) + "'", "parseServerAddresses");
+            };
+            ServerAddress address;
+            std::string_view port;
+            if (server.front() == '[') {
+                // [ipv6]:port
+                const size_t close = server.find(']');
+                if (close == std::string_view::npos or (close + 1 < server.size() and server[close + 1] != ':')) { throw invalid("ipv6 address"); }
+                address.host = server.substr(1, close - 1);
+                port = server.substr(std::min(close + 2, server.size()));
+                if (close + 1 < server.size() and port.empty()) { throw invalid("port"); }
+            }
+            else {
+                // a single colon separates the port, several are an ipv6 address without port
+                const size_t colon = server.find(':');
+                const bool hasPort = colon != std::string_view::npos and server.find(':', colon + 1) == std::string_view::npos;
+                address.host = server.substr(0, hasPort ? colon : server.size());
+                if (hasPort) {
+                    port = server.substr(colon + 1);
+                    if (port.empty()) { throw invalid("port"); }
+                }
+            }
+            if (address.host.empty()) { throw invalid("host"); }
+            if (!port.empty()) {
+                auto [end, ec] = std::from_chars(port.data(), port.data() + port.size(), address.port);
+                if (ec != std::errc() or end != port.data() + port.size() or address.port == 0) { throw invalid("port"); }
+            }
+            servers.push_back(std::move(address));
+        }
+        if (servers.empty()) {
+            throw gz::InvalidArgument("No server address in: '" + s + "'", "parseServerAddresses");
+        }
+        return servers;
+    }
+
+
+    std::chrono::milliseconds getReconnectDelay(unsigned int failedAttempts, std::minstd_rand& rng) {
+        std::chrono::milliseconds delay = RECONNECT_DELAY_MAX;
+        const unsigned int doublings = std::max(failedAttempts, 1u) - 1;
+        if (doublings < 16) {
+            delay = std::min(delay, RECONNECT_DELAY_MIN * (1 << doublings));
+        }
+        std::uniform_real_distribution<float> jitter(1 - RECONNECT_JITTER, 1 + RECONNECT_JITTER);
+        return std::chrono::duration_cast<std::chrono::milliseconds>(delay * jitter(rng));
+    }
+
+
+    ServerConnection::ServerConnection(const ServerAddress& address, const std::string& clientName, UpdateStats& stats, const std::string& cacheDir, bool verifyCache)
+        : address(address), clientName(clientName), stats(stats), frame(stats), pending(stats), client(clientName),
+          cachePath(getDeviceCachePath(address.toString(), cacheDir)), verifyCache(verifyCache), sender(stats)
+    {}
+
+
+    ServerConnection::~ServerConnection() {
+        if (!worker.joinable()) { return; }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopWorker = true;
+        }
+        wakeWorker.notify_one();
+        worker.join();
+    }
+
+
+    void ServerConnection::start(const DeviceTypeMask& targetDevices, std::function<void()> notify) {
+        this->targetDevices = targetDevices;
+        this->notify = std::move(notify);
+        worker = std::thread(&ServerConnection::workerFunction, this);
+    }
+
+
+    std::optional<std::vector<DeviceInfo>> ServerConnection::takeDevices() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::optional<std::vector<DeviceInfo>> devices;
+        std::swap(devices, newDevices);
+        // set with the devices, so that the next commitFrame() sends everything to the new devices and not to the old ones
+        if (devices) { framesLost = true; }
+        return devices;
+    }
+
+
+    void ServerConnection::setFramesDone(uint64_t frameNumber) {
+        doneFrame = frameNumber;
+        if (notifyFrame != 0 and frameNumber >= notifyFrame) {
+            notifyFrame = 0;
+            notify();
+        }
+    }
+
+
+    void ServerConnection::publishDevices(std::vector<DeviceInfo>&& devices) {
+        pending.clear();
+        setFramesDone(committedFrame);
+        newDevices = std::move(devices);
+        notify();
+    }
+
+
+    uint64_t ServerConnection::commit() {
+        if (frame.empty()) { return 0; }
+        uint64_t frameNumber;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state != ServerState::CONNECTED or newDevices) {
+                // the frame is for the old devices, the new ones get all colors once the controller took them
+                frame.clear();
+                return 0;
+            }
+            if (pending.size() + frame.size() > MAX_PENDING_FRAME_BYTES) {
+                // the server does not keep up, start over with full frames once it does
+                pending.clear();
+                frame.clear();
+                framesLost = true;
+                setFramesDone(committedFrame);
+                return 0;
+            }
+            pending.merge(frame);
+            frameNumber = ++committedFrame;
+        }
+        wakeWorker.notify_one();
+        return frameNumber;
+    }
+
+
+    void ServerConnection::notifyWhenDone(uint64_t frameNumber) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (doneFrame < frameNumber) { notifyFrame = frameNumber; }
+    }
+
+
+    const orgb::Mode* ServerConnection::setMode(orgb::Device& device) {
+        const orgb::Mode* mode = device.findMode("Direct");
+        if (mode == nullptr) {
+            mode = device.findMode("Static");
+        }
+        if (mode == nullptr) {
+            rgblog.warning("Device" , device.name, "does not have static or direct mode and will not be used");
+            return nullptr;
+        }
+
+        try {
+            client.changeModeX(device, *mode);
+            /* log.warning("Would now change mode for device", device.name); */
+            rgblog("Changed mode for device", device.name);
+        } 
+        catch (orgb::Exception& e) {
+            rgblog.error("Device", device.name, "Error during changeMode, removing device.", e.errorMessage());
+            return nullptr;
+        }
+        return mode;
+    }
+
+
+    std::vector<DeviceInfo> ServerConnection::enumerateDevices() {
+        orgb::DeviceList deviceList = client.requestDeviceListX();
+        return setModes(deviceList);
+    }
+
+
+    std::vector<DeviceInfo> ServerConnection::setModes(orgb::DeviceList& deviceList) {
+        std::vector<DeviceInfo> devices;
+        for (auto it = deviceList.begin(); it != deviceList.end(); it++) {
+            rgblog.clog({ gz::Color::BLUE, gz::Color::RESET }, "Found device", orgb::enumString(it->type), it->vendor, it->name, "Zones:", it->zones.size(), "Leds:", it->leds.size(), "Colors:", it->colors.size());
+            if (!targetDevices.contains(it->type)) { continue; }
+            if (setMode(*it) != nullptr) {
+                devices.emplace_back(*it);
+            }
+        }
+        try {
+            saveDeviceCache(cachePath, getDeviceFingerprint(static_cast<uint32_t>(deviceList.size()), targetDevices), devices);
+        }
+        catch (std::system_error& e) {
+            rgblog.warning("Could not write device cache:", e.what());
+        }
+        return devices;
+    }
+
+
+    std::optional<std::vector<DeviceInfo>> ServerConnection::verifyDeviceCache() {
+        orgb::DeviceList deviceList = client.requestDeviceListX();
+        std::vector<DeviceInfo> devices;
+        for (auto it = deviceList.begin(); it != deviceList.end(); it++) {
+            // the same devices as setModes() would choose, without changing their modes
+            if (targetDevices.contains(it->type) and (it->findMode("Direct") != nullptr or it->findMode("Static") != nullptr)) {
+                devices.emplace_back(*it);
+            }
+        }
+        std::optional<std::vector<DeviceInfo>> cached;
+        std::swap(cached, cachedDevices);
+        if (devices == *cached) { return std::nullopt; }
+        rgblog("Cached devices of OpenRGB server", address.toString(), "are outdated");
+        return setModes(deviceList);
+    }
+
+
+    std::optional<std::vector<DeviceInfo>> ServerConnection::checkDeviceList() {
+        switch (client.checkForDeviceUpdatesX()) {
+            case orgb::UpdateStatus::UpToDate:
+                return std::nullopt;
+            case orgb::UpdateStatus::OutOfDate:
+                rgblog("Device list of OpenRGB server", address.toString(), "changed");
+                return enumerateDevices();
+            case orgb::UpdateStatus::ConnectionClosed:
+                throw std::system_error(ECONNRESET, std::generic_category(), "ServerConnection: Connection closed by server");
+            case orgb::UpdateStatus::OtherError:
+            default:
+                throw std::system_error(EIO, std::generic_category(), "ServerConnection: Could not check for device list updates");
+        }
+    }
+
+
+    std::optional<std::vector<DeviceInfo>> ServerConnection::connectServer() {
+        auto connectError = [this](const std::string& error) {
+            stats.connectFailures++;
+            // only log the first of the errors while the server is gone
+            if (!connectFailed) {
+                rgblog.warning("Could not connect to OpenRGB server", address.toString() + ":", error, "- Retrying in the background.");
+                connectFailed = true;
+            }
+            if (client.isConnected()) { client.disconnect(); }
+            sender.disconnect();
+            return std::nullopt;
+        };
+        std::optional<std::vector<DeviceInfo>> devices;
+        cachedDevices.reset();
+        try {
+            if (client.isConnected()) { client.disconnect(); }
+            // the frame connection resolves the host and gives up after CONNECT_TIMEOUT. The SDK has no connect timeout,
+            // so the client only connects to the address that just accepted the frame connection
+            sender.connect(address.host, address.port, clientName);
+            client.connectX(sender.getPeerAddress(), address.port);
+            if (!client.setTimeout(SDK_RECEIVE_TIMEOUT)) {
+                throw std::system_error(EIO, std::generic_category(), "ServerConnection: Could not set the receive timeout of the SDK client");
+            }
+            devices = loadDeviceCache(cachePath, getDeviceFingerprint(client.requestDeviceCountX(), targetDevices));
+            if (devices) {
+                // SETCUSTOMMODE lets the server choose the direct (or static) mode, so the mode data is not needed
+                for (const DeviceInfo& device : *devices) {
+                    sender.setCustomMode(device.idx);
+                }
+                sender.commit();
+                if (verifyCache) { cachedDevices = devices; }
+                rgblog("Using", devices->size(), "cached devices of OpenRGB server", address.toString());
+            }
+            else {
+                devices = enumerateDevices();
+            }
+        }
+        catch (orgb::Exception& e) {
+            return connectError(e.errorMessage());
+        }
+        catch (std::system_error& e) {
+            return connectError(e.what());
+        }
+        stats.connects++;
+        connectFailed = false;
+        rgblog("Connected to OpenRGB server", address.toString() + ", protocol version", sender.getProtocolVersion());
+        return devices;
+    }
+
+
+    void ServerConnection::workerFunction() {
+        std::minstd_rand rng(std::random_device{}());
+        unsigned int failedAttempts = 0;
+        auto nextDeviceListCheck = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopWorker) {
+            switch (state) {
+                case ServerState::CONNECTING: {
+                    lock.unlock();
+                    std::optional<std::vector<DeviceInfo>> devices = connectServer();
+                    lock.lock();
+                    if (!devices) {
+                        failedAttempts++;
+                        state = ServerState::BACKOFF;
+                        break;
+                    }
+                    failedAttempts = 0;
+                    nextDeviceListCheck = std::chrono::steady_clock::now() + DEVICE_LIST_CHECK_INTERVAL;
+                    state = ServerState::CONNECTED;
+                    publishDevices(std::move(*devices));
+                    break;
+                }
+                case ServerState::BACKOFF:
+                    wakeWorker.wait_for(lock, getReconnectDelay(failedAttempts, rng), [this]() { return stopWorker; });
+                    state = ServerState::CONNECTING;
+                    break;
+                case ServerState::CONNECTED: {
+                    wakeWorker.wait_until(lock, nextDeviceListCheck, [this]() { return stopWorker or !pending.empty(); });
+                    // the pending frames are sent by flushPending()
+                    if (stopWorker) { break; }
+                    sender.merge(pending);
+                    const uint64_t sendingFrame = committedFrame;
+                    lock.unlock();
+                    std::optional<std::vector<DeviceInfo>> devices;
+                    std::string error;
+                    try {
+                        sender.commit();
+                        const auto now = std::chrono::steady_clock::now();
+                        if (now >= nextDeviceListCheck) {
+                            nextDeviceListCheck = now + DEVICE_LIST_CHECK_INTERVAL;
+                            devices = cachedDevices ? verifyDeviceCache() : checkDeviceList();
+                        }
+                    }
+                    catch (orgb::Exception& e) {
+                        error = e.errorMessage();
+                    }
+                    catch (std::system_error& e) {
+                        error = e.what();
+                    }
+                    lock.lock();
+                    if (!error.empty()) {
+                        rgblog.error("Lost connection to OpenRGB server", address.toString() + ":", error);
+                        client.disconnect();
+                        sender.disconnect();
+                        // reconnect right away, the server might just have been restarted
+                        pending.clear();
+                        setFramesDone(committedFrame);
+                        state = ServerState::CONNECTING;
+                    }
+                    else {
+                        setFramesDone(sendingFrame);
+                        if (devices) {
+                            publishDevices(std::move(*devices));
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+        flushPending(lock);
+    }
+
+
+    void ServerConnection::flushPending(std::unique_lock<std::mutex>& lock) {
+        if (state != ServerState::CONNECTED or pending.empty()) { return; }
+        sender.merge(pending);
+        lock.unlock();
+        try {
+            sender.commit(std::chrono::steady_clock::now() + STOP_FLUSH_TIMEOUT);
+        }
+        catch (std::system_error& e) {
+            rgblog.warning("Could not send the last frame to OpenRGB server", address.toString() + ":", e.what());
+        }
+        lock.lock();
+    }
+}
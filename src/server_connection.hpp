@@ -0,0 +1,217 @@
+#pragma once
+
+#include "device_inventory.hpp"
+#include "frame_batch.hpp"
+#include "rgb_command.hpp"
+
+#include "OpenRGB/Client.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rgb {
+    /// Default port of the OpenRGB SDK server
+    const uint16_t DEFAULT_SERVER_PORT = 6742;
+    /// When the packets waiting for a slow server exceed this size, they are dropped and the devices of the server are sent in full again
+    const size_t MAX_PENDING_FRAME_BYTES = 1 << 20;
+    /// Wait before the second attempt to connect to a server, doubled after every failed attempt
+    constexpr auto RECONNECT_DELAY_MIN = std::chrono::milliseconds(250);
+    constexpr auto RECONNECT_DELAY_MAX = std::chrono::seconds(5);
+    /// The reconnect delays are randomized by +- this fraction, so that several servers or clients do not retry in lockstep
+    constexpr float RECONNECT_JITTER = 0.25f;
+    /// How often a connected server is asked if its device list changed
+    constexpr auto DEVICE_LIST_CHECK_INTERVAL = std::chrono::seconds(1);
+    /**
+     * @brief Receive timeout of the SDK client
+     * @details
+     *  A server that stops answering a request (eg. the device list) makes the request fail after this time,
+     *  so that the worker does not hang and can reconnect or stop.
+     */
+    constexpr auto SDK_RECEIVE_TIMEOUT = std::chrono::seconds(2);
+    /// How long the frames that are pending when the connection is destroyed may take to send, eg. the lights turned off on exit
+    constexpr auto STOP_FLUSH_TIMEOUT = std::chrono::milliseconds(250);
+
+    struct ServerAddress {
+        /// ip address or host name, resolved when connecting
+        std::string host;
+        uint16_t port = DEFAULT_SERVER_PORT;
+        /// @returns host:port, or [host]:port for ipv6 addresses
+        std::string toString() const;
+    };
+
+    /**
+     * @brief Parse a comma separated list of servers
+     * @param s eg "127.0.0.1, localhost:6743, [::1]:6744, fd00::5", the port is optional. Spaces around the entries are ignored
+     * @throws gz::InvalidArgument if s is empty, or a host or port is invalid
+     */
+    std::vector<ServerAddress> parseServerAddresses(const std::string& s);
+
+    /**
+     * @brief Get the time to wait before the next attempt to connect
+     * @param failedAttempts Number of attempts that failed since the connection was lost, at least 1
+     * @returns RECONNECT_DELAY_MIN * 2^(failedAttempts - 1), at most RECONNECT_DELAY_MAX, with jitter
+     */
+    std::chrono::milliseconds getReconnectDelay(unsigned int failedAttempts, std::minstd_rand& rng);
+
+
+    enum class ServerState : uint8_t {
+        /// connecting, getting the devices and setting their modes
+        CONNECTING,
+        /// sending frames and checking for device list updates
+        CONNECTED,
+        /// waiting before the next attempt to connect
+        BACKOFF,
+    };
+
+
+    /**
+     * @brief Connection to one OpenRGB server
+     * @details
+     *  A worker thread owns the SDK client and the connection for the led updates (see FrameBatch) and runs this state machine:
+     *  - CONNECTING: connect the client and the frame connection and get the target devices.
+     *    Requests of the client fail after SDK_RECEIVE_TIMEOUT when the server does not answer.
+     *    If the device cache of the server is valid (see loadDeviceCache()), the devices are taken from it and set to their mode with
+     *    a single SETCUSTOMMODE write, which avoids requesting the full data of every device before the first frame.
+     *    Otherwise the device list is requested, the target devices are set to direct or static mode and the cache is written.
+     *    On success the devices are published (see takeDevices()) and the state is CONNECTED, otherwise BACKOFF.
+     *  - CONNECTED: send the committed frames. If sending fails, the connections are closed and the state is CONNECTING.
+     *    Every DEVICE_LIST_CHECK_INTERVAL the client is checked for a device list update from the server,
+     *    after one the device list is requested again and the new devices are published.
+     *    The first check after connecting with cached devices requests the device list instead and compares it to the cache,
+     *    so that a device that was replaced by another one of the same type is noticed.
+     *  - BACKOFF: wait with exponential backoff and jitter (see getReconnectDelay()), then CONNECTING.
+     *
+     *  Nothing blocks the rgb controller thread: it collects the led updates in getFrame() and commit() hands them to the worker.
+     *  Frames that are committed while the worker is still busy are appended to the pending packets and sent together,
+     *  frames committed while not connected or before the controller took the published devices are dropped.
+     *  When frames are lost (too many were pending or new devices were taken), takeFramesLost() returns true once,
+     *  and the controller must send all colors of the devices of this server again.
+     *  commit() numbers the frames, isFrameDone() tells when one was sent or dropped, eg. to wait for the lights to be off before sleep.
+     */
+    class ServerConnection {
+        public:
+            /**
+             * @param cacheDir Directory of the device cache, another one than DEVICE_CACHE_DIR only for tests
+             * @param verifyCache Compare the cached devices to the device list after connecting, false only for tests with servers that never send the device list
+             */
+            ServerConnection(const ServerAddress& address, const std::string& clientName, UpdateStats& stats, const std::string& cacheDir=DEVICE_CACHE_DIR, bool verifyCache=true);
+            /**
+             * @brief Stops the worker thread
+             * @details
+             *  While connected, the pending frames are sent first, for at most STOP_FLUSH_TIMEOUT.
+             *  Waits for an attempt to connect that is in progress (the connection attempt is given up after CONNECT_TIMEOUT).
+             */
+            ~ServerConnection();
+            ServerConnection(const ServerConnection&) = delete;
+            ServerConnection& operator=(const ServerConnection&) = delete;
+
+            const ServerAddress& getAddress() const { return address; }
+            ServerState getState() const { return state; }
+            /**
+             * @brief Start the worker thread, which connects in the background
+             * @param targetDevices Devices that are set to direct or static mode
+             * @param notify Called from the worker thread when new devices can be taken with takeDevices()
+             *  or a frame passed to notifyWhenDone() is done
+             */
+            void start(const DeviceTypeMask& targetDevices, std::function<void()> notify);
+            /**
+             * @brief Take the target devices that were published after the worker connected or the device list changed
+             * @details The colors on the devices are unknown then, so the frames are reported as lost (see takeFramesLost())
+             * @returns std::nullopt if there are no new devices since the last call
+             */
+            std::optional<std::vector<DeviceInfo>> takeDevices();
+
+            /// Updates for the next commit(), only used by the rgb controller thread
+            FrameBatch& getFrame() { return frame; }
+            /**
+             * @brief Hand the collected updates to the worker thread, does not wait for them to be sent
+             * @returns the number of the frame for isFrameDone(), 0 if nothing has to be sent
+             */
+            uint64_t commit();
+            /// @returns true when frameNumber was sent, or was dropped because the connection was lost or the devices changed
+            bool isFrameDone(uint64_t frameNumber) const { return doneFrame >= frameNumber; }
+            /// Have notify (see start()) called once when frameNumber is done, unless it is already
+            void notifyWhenDone(uint64_t frameNumber);
+            /// @returns true if frames were lost since the last call
+            bool takeFramesLost() { return framesLost.exchange(false); }
+
+        private:
+            void workerFunction();
+            /**
+             * @brief CONNECTING
+             * @returns the target devices if connected
+             */
+            std::optional<std::vector<DeviceInfo>> connectServer();
+            /**
+             * @brief Request the device list, set the modes of the target devices and update the cache
+             * @throws orgb::Exception or std::system_error
+             */
+            std::vector<DeviceInfo> enumerateDevices();
+            /// Set the modes of the target devices in deviceList and update the cache, @throws orgb::Exception or std::system_error
+            std::vector<DeviceInfo> setModes(orgb::DeviceList& deviceList);
+            /**
+             * @brief Compare the devices taken from the cache to the device list of the server
+             * @returns the new target devices if the cache was outdated
+             * @throws orgb::Exception or std::system_error if the connection was lost
+             */
+            std::optional<std::vector<DeviceInfo>> verifyDeviceCache();
+            /**
+             * @brief Check if the server sent a device list update
+             * @returns the new target devices after an update
+             * @throws orgb::Exception or std::system_error if the connection was lost
+             */
+            std::optional<std::vector<DeviceInfo>> checkDeviceList();
+            /// Set the frames up to frameNumber done and call notify if one was waited for, mutex must be locked
+            void setFramesDone(uint64_t frameNumber);
+            /// Hand devices to the controller thread and drop the pending frames, which are for the old devices. mutex must be locked
+            void publishDevices(std::vector<DeviceInfo>&& devices);
+            /// Send the pending frames for at most STOP_FLUSH_TIMEOUT when the worker stops, lock must hold mutex
+            void flushPending(std::unique_lock<std::mutex>& lock);
+            /// Set device to direct or static mode, @returns the mode or nullptr if neither is possible
+            const orgb::Mode* setMode(orgb::Device& device);
+            ServerAddress address;
+            std::string clientName;
+            UpdateStats& stats;
+            FrameBatch frame;
+
+            std::mutex mutex;
+            /// notified when a frame was committed or the worker has to stop
+            std::condition_variable wakeWorker;
+            std::atomic<ServerState> state = ServerState::CONNECTING;
+            /// packets committed but not yet taken by the worker, guarded by mutex
+            FrameBatch pending;
+            /// devices published by the worker, guarded by mutex
+            std::optional<std::vector<DeviceInfo>> newDevices;
+            /// number of the last frame in pending, guarded by mutex
+            uint64_t committedFrame = 0;
+            /// frame passed to notifyWhenDone() or 0, guarded by mutex
+            uint64_t notifyFrame = 0;
+            /// number of the last frame that was sent or dropped
+            std::atomic<uint64_t> doneFrame = 0;
+            bool stopWorker = false;
+            std::atomic<bool> framesLost = false;
+
+            // only used by the worker
+            DeviceTypeMask targetDevices;
+            std::function<void()> notify;
+            orgb::Client client;
+            std::string cachePath;
+            bool verifyCache;
+            /// owns the frame connection
+            FrameBatch sender;
+            /// true while connecting fails, to log only the first error
+            bool connectFailed = false;
+            /// the devices that were taken from the cache, until they were compared to the device list
+            std::optional<std::vector<DeviceInfo>> cachedDevices;
+            std::thread worker;
+    };
+}
@@ -0,0 +1,105 @@
+#include "sleep_watcher.hpp"
+
+#include <gz-util/log.hpp>
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <systemd/sd-bus.h>
+#include <unistd.h>
+
+extern gz::Log rgblog;
+
+namespace rgb {
+    static const char* LOGIND_SERVICE = "org.freedesktop.login1";
+    static const char* LOGIND_PATH = "/org/freedesktop/login1";
+    static const char* LOGIND_INTERFACE = "org.freedesktop.login1.Manager";
+
+
+    SleepWatcher::SleepWatcher() {
+        int r = sd_bus_open_system(&bus);
+        if (r < 0) {
+            throw std::system_error(-r, std::generic_category(), "SleepWatcher: Can not connect to the system bus");
+        }
+        r = sd_bus_match_signal(bus, &matchSlot, LOGIND_SERVICE, LOGIND_PATH, LOGIND_INTERFACE, "PrepareForSleep", onPrepareForSleep, this);
+        if (r < 0) {
+            sd_bus_flush_close_unref(bus);
+            throw std::system_error(-r, std::generic_category(), "SleepWatcher: Can not subscribe to PrepareForSleep");
+        }
+        fd = sd_bus_get_fd(bus);
+    }
+
+
+    SleepWatcher::~SleepWatcher() {
+        releaseInhibitor();
+        sd_bus_slot_unref(inhibitSlot);
+        sd_bus_slot_unref(matchSlot);
+        sd_bus_flush_close_unref(bus);
+    }
+
+
+    int SleepWatcher::onPrepareForSleep(sd_bus_message* message, void* userdata, sd_bus_error*) {
+        int sleeping;
+        if (sd_bus_message_read(message, "b", &sleeping) < 0) {
+            rgblog.warning("Sleep Watcher: Invalid PrepareForSleep signal");
+            return 0;
+        }
+        static_cast<SleepWatcher*>(userdata)->lastSignal = sleeping != 0;
+        return 0;
+    }
+
+
+    std::optional<bool> SleepWatcher::readSleep() {
+        lastSignal.reset();
+        int r;
+        // one message per call, also calls onInhibitReply()
+        while ((r = sd_bus_process(bus, nullptr)) > 0);
+        if (r < 0) {
+            throw std::system_error(-r, std::generic_category(), "SleepWatcher: Lost the connection to the system bus");
+        }
+        return lastSignal;
+    }
+
+
+    void SleepWatcher::takeInhibitor() {
+        if (inhibitorFd >= 0 or inhibitPending) { return; }
+        // a synchronous call would read a PrepareForSleep signal that arrives before the reply into the queue of sd-bus,
+        // without the fd becoming readable. The reply is handled by readSleep() like the signals.
+        sd_bus_slot_unref(inhibitSlot);
+        inhibitSlot = nullptr;
+        int r = sd_bus_call_method_async(bus, &inhibitSlot, LOGIND_SERVICE, LOGIND_PATH, LOGIND_INTERFACE, "Inhibit", onInhibitReply, this,
+                "ssss", "sleep", "gz-rgb", "Turn off the lights before sleeping", "delay");
+        if (r < 0) {
+            rgblog.warning("Sleep Watcher: Can not take the inhibitor lock: '" + std::generic_category().message(-r) + "'");
+            return;
+        }
+        inhibitPending = true;
+    }
+
+
+    int SleepWatcher::onInhibitReply(sd_bus_message* reply, void* userdata, sd_bus_error*) {
+        auto* watcher = static_cast<SleepWatcher*>(userdata);
+        watcher->inhibitPending = false;
+        const sd_bus_error* error = sd_bus_message_get_error(reply);
+        int lockFd = -1;
+        int r = error != nullptr ? -sd_bus_message_get_errno(reply) : sd_bus_message_read(reply, "h", &lockFd);
+        if (r >= 0) {
+            // the fd belongs to the reply
+            watcher->inhibitorFd = fcntl(lockFd, F_DUPFD_CLOEXEC, 3);
+            if (watcher->inhibitorFd < 0) { r = -errno; }
+        }
+        if (r < 0) {
+            rgblog.warning("Sleep Watcher: Can not take the inhibitor lock: '" + std::string(error != nullptr and error->message != nullptr ? error->message : std::generic_category().message(-r)) + "'");
+        }
+        return 0;
+    }
+
+
+    void SleepWatcher::releaseInhibitor() {
+        if (inhibitorFd < 0) { return; }
+        close(inhibitorFd);
+        inhibitorFd = -1;
+    }
+}
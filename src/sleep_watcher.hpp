@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+
+struct sd_bus;
+struct sd_bus_message;
+struct sd_bus_error;
+struct sd_bus_slot;
+
+namespace rgb {
+    /// After PrepareForSleep(true), the inhibitor lock is released when the controller sent black to the devices, but at the latest after this time
+    constexpr auto SLEEP_INHIBIT_RELEASE_DELAY = std::chrono::milliseconds(1000);
+
+    /**
+     * @brief Follows the PrepareForSleep signal of systemd-logind on the system bus
+     * @details
+     *  Holds a "delay" inhibitor lock for sleep, so that logind waits until releaseInhibitor() before suspending
+     *  (at most InhibitDelayMaxSec, see logind.conf). The lock has to be taken again with takeInhibitor() after resuming.
+     *  getFd() becomes readable when messages arrive, readSleep() then processes them without blocking.
+     *  The system bus can be changed with $DBUS_SYSTEM_BUS_ADDRESS.
+     */
+    class SleepWatcher {
+        public:
+            /// @throws std::system_error if the system bus is not available or the signal can not be subscribed
+            SleepWatcher();
+            ~SleepWatcher();
+            SleepWatcher(const SleepWatcher&) = delete;
+            SleepWatcher& operator=(const SleepWatcher&) = delete;
+            int getFd() const { return fd; }
+            /**
+             * @brief Handle the pending messages
+             * @returns the argument of the last PrepareForSleep signal: true before sleep, false after waking up. std::nullopt if there was none
+             * @throws std::system_error if the connection to the bus was lost
+             */
+            std::optional<bool> readSleep();
+            /**
+             * @brief Request the inhibitor lock, if it is not already held or requested
+             * @details Does not wait for logind: the lock is held after readSleep() handled the reply. If logind refuses it, the reason is logged.
+             */
+            void takeInhibitor();
+            /// Release the inhibitor lock, so that the system can go to sleep
+            void releaseInhibitor();
+            bool holdsInhibitor() const { return inhibitorFd >= 0; }
+
+        private:
+            sd_bus* bus = nullptr;
+            sd_bus_slot* matchSlot = nullptr;
+            /// the Inhibit call
+            sd_bus_slot* inhibitSlot = nullptr;
+            bool inhibitPending = false;
+            int fd = -1;
+            /// the fd of the lock, closing it releases the lock
+            int inhibitorFd = -1;
+            std::optional<bool> lastSignal;
+            static int onPrepareForSleep(sd_bus_message* message, void* userdata, sd_bus_error* error);
+            static int onInhibitReply(sd_bus_message* reply, void* userdata, sd_bus_error* error);
+    };
+}